@@ -0,0 +1,145 @@
+/* -*- mode: C++ -*- */
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Find the packets where the device passes a given azimuth.
+ *
+ *  Every data block starts with the rotation of the device when it
+ *  fired (0-35999, hundredths of a degree).  A packet completes a
+ *  revolution when the cut azimuth lies after the last block of the
+ *  previous packet and no later than its own last block, so each
+ *  revolution holds exactly one such packet, however many packets
+ *  the device sends per turn.
+ *
+ *  The revolution may further be divided into sectors of equal
+ *  width, starting at the cut azimuth; the last one is narrower if
+ *  the width does not divide 360 degrees.  A packet then also ends a
+ *  sector when it passes one of their boundaries.
+ */
+
+#ifndef _VELODYNE_AZIMUTH_CUT_H_
+#define _VELODYNE_AZIMUTH_CUT_H_ 1
+
+#include <stdint.h>
+#include <cmath>
+
+#include <velodyne_msgs/VelodynePacket.h>
+
+namespace velodyne_driver
+{
+
+class AzimuthCut
+{
+public:
+
+  AzimuthCut():
+    cut_(-1),
+    sector_(ROTATION_MAX_UNITS),
+    last_(-1),
+    revolution_(false),
+    passed_(0)
+  {}
+
+  /** @param angle cut azimuth in radians, negative disables cutting
+   *  @param sector sector width in radians, 0 or 2*pi for a single
+   *                sector per revolution
+   */
+  void setCutAngle(double angle, double sector = 0.0)
+  {
+    if (angle < 0.0)
+      cut_ = -1;
+    else
+      cut_ = toUnits(angle) % ROTATION_MAX_UNITS;
+    sector_ = toUnits(sector);
+    if (sector_ <= 0 || sector_ > ROTATION_MAX_UNITS)
+      sector_ = ROTATION_MAX_UNITS;
+    last_ = -1;
+  }
+
+  bool enabled() const
+  {
+    return cut_ >= 0;
+  }
+
+  /** @returns number of sectors in a revolution */
+  int sectors() const
+  {
+    return (ROTATION_MAX_UNITS + sector_ - 1) / sector_;
+  }
+
+  /** @brief Check the next packet of the stream.
+   *
+   *  @returns true if pkt is the last packet of a sector
+   */
+  bool check(const velodyne_msgs::VelodynePacket &pkt)
+  {
+    revolution_ = false;
+    if (cut_ < 0)
+      return false;
+
+    const uint8_t *data = &pkt.data[LAST_ROTATION_OFFSET];
+    const int rotation = data[0] | (data[1] << 8);
+    if (rotation >= ROTATION_MAX_UNITS)  // not a data packet?
+      return false;
+
+    const int last = last_;
+    last_ = rotation;
+    if (last < 0)
+      return false;
+
+    // rotations relative to the cut, which is a sector boundary
+    const int from = (last - cut_ + ROTATION_MAX_UNITS) % ROTATION_MAX_UNITS;
+    const int to = (rotation - cut_ + ROTATION_MAX_UNITS) % ROTATION_MAX_UNITS;
+    revolution_ = to < from;
+    if (!revolution_ && to / sector_ == from / sector_)
+      return false;
+
+    passed_ = (cut_ + (to / sector_) * sector_) % ROTATION_MAX_UNITS;
+    return true;
+  }
+
+  /** @returns true if the last packet checked ended a revolution */
+  bool revolution() const
+  {
+    return revolution_;
+  }
+
+  /** @returns rotation of the last sector boundary passed
+   *           (hundredths of a degree)
+   */
+  int passed() const
+  {
+    return passed_;
+  }
+
+  /** @brief Start over, e.g. when the input is rewound. */
+  void reset()
+  {
+    last_ = -1;
+  }
+
+private:
+
+  static const int ROTATION_MAX_UNITS = 36000;
+  static const int LAST_ROTATION_OFFSET = 11 * 100 + 2; ///< of block 11
+
+  static int toUnits(double angle)
+  {
+    return (int) lrint(angle * 18000.0 / M_PI);
+  }
+
+  int cut_;                             ///< cut azimuth, -1 if disabled
+  int sector_;                          ///< sector width
+  int last_;                            ///< last block rotation seen
+  bool revolution_;                     ///< last packet ended a revolution
+  int passed_;                          ///< last sector boundary passed
+};
+
+} // namespace velodyne_driver
+
+#endif // _VELODYNE_AZIMUTH_CUT_H_
@@ -0,0 +1,86 @@
+/* -*- mode: C++ -*- */
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  In-memory black box of the most recent Velodyne packets.
+ *
+ *  All packets read are copied into a preallocated ring holding the
+ *  last few seconds of data.  When something interesting happens,
+ *  the ring is written to a pcap file by a background thread while
+ *  new packets keep coming in.
+ *
+ *  The ring is divided into chunks, each with its own lock.  The
+ *  driver locks a chunk while filling it, the dump thread while
+ *  copying it out, so neither waits for more than one chunk copy and
+ *  neither ever waits for the disk.
+ */
+
+#ifndef _VELODYNE_BLACK_BOX_H_
+#define _VELODYNE_BLACK_BOX_H_ 1
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <velodyne_msgs/VelodynePacket.h>
+
+namespace velodyne_driver
+{
+
+class BlackBox
+{
+public:
+
+  /** @param capacity number of packets kept
+   *  @param port UDP port written in the dumped packet headers
+   *  @param device_ip source address written in the headers
+   */
+  BlackBox(size_t capacity, uint16_t port, const std::string &device_ip);
+  ~BlackBox();
+
+  /** @brief Keep copies of packets, dropping the oldest ones.
+   *
+   *  Call from one thread only.
+   */
+  void add(const velodyne_msgs::VelodynePacket *pkts, int npkts);
+
+  /** @brief Start writing the newest packets to a pcap file.
+   *
+   *  @param npkts number of packets to write, 0 for all kept
+   *  @returns false if a dump is still running
+   */
+  bool dump(const std::string &filename, size_t npkts);
+
+  bool dumping() const { return dumping_; }
+
+  size_t capacity() const { return capacity_; }
+
+private:
+
+  void dumpLoop(std::string filename, uint64_t begin, uint64_t end);
+
+  static const size_t CHUNK_SIZE = 1024; ///< packets per chunk
+
+  std::vector<velodyne_msgs::VelodynePacket> slots_;
+  size_t capacity_;                     ///< multiple of CHUNK_SIZE
+  boost::scoped_array<boost::mutex> chunk_locks_;
+  std::atomic<uint64_t> head_;          ///< total packets added
+
+  uint16_t port_;
+  std::string device_ip_;
+  boost::shared_ptr<boost::thread> dump_thread_;
+  std::atomic<bool> dumping_;
+};
+
+} // namespace velodyne_driver
+
+#endif // _VELODYNE_BLACK_BOX_H_
@@ -0,0 +1,223 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (C) 2012 Austin Robot Technology, Jack O'Quin
+ * 
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  ROS driver interface for the Velodyne 3D LIDARs
+ */
+
+#ifndef _VELODYNE_DRIVER_H_
+#define _VELODYNE_DRIVER_H_ 1
+
+#include <string>
+#include <atomic>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <ros/ros.h>
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <diagnostic_updater/publisher.h>
+#include <dynamic_reconfigure/server.h>
+
+#include <velodyne_driver/azimuth_cut.h>
+#include <velodyne_driver/black_box.h>
+#include <velodyne_driver/input.h>
+#include <velodyne_driver/model.h>
+#include <velodyne_driver/packet_ring.h>
+#include <velodyne_driver/pcap_writer.h>
+#include <velodyne_driver/scan_pool.h>
+#include <velodyne_driver/sequence_check.h>
+#include <velodyne_driver/VelodyneNodeConfig.h>
+#include <velodyne_msgs/VelodyneScan.h>
+#include <velodyne_msgs/DumpBlackBox.h>
+#include <velodyne_msgs/Seek.h>
+
+namespace velodyne_driver
+{
+
+class VelodyneDriver
+{
+public:
+
+  /** @brief Handler of each packet read, for decoding it in the same
+   *         process as soon as it arrives.
+   *
+   *  Called on the thread calling poll(), in packet order, with the
+   *  frame ID of the device.
+   */
+  typedef boost::function<void(const velodyne_msgs::VelodynePacket &pkt,
+                               const std::string &frame_id)> PacketHandler;
+
+  VelodyneDriver(ros::NodeHandle node,
+                 ros::NodeHandle private_nh,
+                 const PacketHandler &packet_handler = PacketHandler());
+  ~VelodyneDriver();
+
+  bool poll(void);
+
+private:
+
+  /** scan size and rate of a device, which grow once it turns out to
+   *  send dual returns */
+  struct ReturnMode
+  {
+    bool dual;                          ///< device sends dual returns
+    int max_packets;                    ///< packets allocated for each scan
+    double diag_min_freq;               ///< expected scan rate (Hz)
+    double diag_max_freq;
+  };
+
+  /** one of several devices served by a single driver */
+  struct Sensor
+  {
+    std::string name;
+    std::string frame_id;
+    int port;
+    boost::shared_ptr<Input> input;
+    ros::Publisher output;
+    boost::shared_ptr<diagnostic_updater::TopicDiagnostic> diag_topic;
+    velodyne_msgs::VelodyneScanPtr scan; ///< scan being filled
+    int npackets_read;                  ///< packets already in scan
+    int npackets_checked;               ///< packets of scan checked
+    SequenceCheck sequence;
+    AzimuthCut cut;
+    ModelDetector detector;
+    ReturnMode returns;
+    uint64_t kernel_drops_reported;
+    uint64_t missing_reported;
+    boost::shared_ptr<PcapWriter> recorder;
+    boost::shared_ptr<BlackBox> black_box;
+  };
+
+  void openSensors(ros::NodeHandle node, ros::NodeHandle private_nh,
+                   const std::vector<std::string> &names,
+                   double packet_rate);
+  bool pollSensors(void);
+  void readSensor(Sensor &sensor);
+  void sensorDiagnostics(Sensor *sensor,
+                         diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void reportLoss(diagnostic_updater::DiagnosticStatusWrapper &stat,
+                  const Input &input, const SequenceCheck &sequence,
+                  uint64_t *kernel_drops_reported,
+                  uint64_t *missing_reported);
+  int readPackets(velodyne_msgs::VelodynePacket *pkts, int max_pkts,
+                  bool *restarted);
+  velodyne_msgs::VelodyneScanPtr newScan(int max_packets);
+  bool checkPackets(velodyne_msgs::VelodyneScan &scan, int *checked,
+                    int nread, SequenceCheck &sequence, AzimuthCut &cut,
+                    ModelDetector &detector, ReturnMode &returns);
+  void modelDetected(const ModelDetector &detector, SequenceCheck &sequence,
+                     ReturnMode &returns);
+  void modelDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void reportModel(diagnostic_updater::DiagnosticStatusWrapper &stat,
+                   const std::string &name, const ModelDetector &detector);
+  velodyne_msgs::VelodyneScanPtr closeScan(velodyne_msgs::VelodyneScanPtr &scan,
+                                           int checked, int *nread,
+                                           int max_packets);
+  bool seek(velodyne_msgs::Seek::Request &req,
+            velodyne_msgs::Seek::Response &res);
+  bool dumpBlackBox(velodyne_msgs::DumpBlackBox::Request &req,
+                    velodyne_msgs::DumpBlackBox::Response &res);
+  void receiveLoop(void);
+  void ringDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  boost::shared_ptr<PcapWriter> openRecorder(ros::NodeHandle nh,
+                                             const std::string &prefix,
+                                             int udp_port);
+  void recorderDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void lossDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+
+  ///Callback for dynamic reconfigure
+  void callback(velodyne_driver::VelodyneNodeConfig &config,
+              uint32_t level);
+
+  ///Pointer to dynamic reconfigure service srv_
+  boost::shared_ptr<dynamic_reconfigure::Server<velodyne_driver::
+              VelodyneNodeConfig> > srv_;
+
+  // configuration parameters
+  struct
+  {
+    std::string frame_id;            ///< tf frame ID
+    std::string model;               ///< device model name
+    int    npackets;                 ///< number of packets to collect
+    int    max_packets;              ///< packets of a single return scan
+    double cut_angle;                ///< azimuth ending a scan (rad), <0 off
+    double sector_angle;             ///< width of a scan (rad), 0 revolution
+    double rpm;                      ///< device rotation rate (RPMs)
+    double packet_rate;              ///< device packet frequency (Hz)
+    double time_offset;              ///< time in seconds added to each velodyne time stamp
+  } config_;
+
+  boost::shared_ptr<Input> input_;
+  ros::Publisher output_;
+  bool publish_packets_;                ///< publish scans on output_
+  PacketHandler packet_handler_;
+
+  /** model configured, and as told by the packets */
+  int model_;                           ///< ModelId
+  ModelDetector detector_;
+  ReturnMode returns_;                  ///< of the device, or as sensors start
+
+  /** scan being filled; may start with packets read past the last cut */
+  velodyne_msgs::VelodyneScanPtr scan_;
+  int npackets_read_;                   ///< packets already in scan_
+  AzimuthCut cut_;
+
+  /** scans released by their subscribers, for reuse */
+  static const size_t SCAN_POOL_SIZE = 32;
+  ScanPool scan_pool_;
+
+  /** receive thread filling ring_, drained by poll() */
+  boost::shared_ptr<PacketRing> ring_;
+  boost::shared_ptr<boost::thread> receive_thread_;
+  std::atomic<bool> receiving_;         ///< receive thread should run
+  std::atomic<bool> input_done_;        ///< input reached end of file
+  std::atomic<uint64_t> ring_overflows_; ///< packets dropped, ring full
+  size_t ring_high_water_;              ///< highest occupancy seen
+  uint64_t ring_overflows_reported_;    ///< overflows at last update
+
+  /** wake poll() when it waits for an empty ring */
+  boost::mutex ring_mutex_;
+  boost::condition_variable ring_cond_;
+  std::atomic<bool> ring_waiting_;
+  std::atomic<bool> ring_restarted_;    ///< ring packets start over
+
+  /** wake the receive thread when it waits for poll() to empty the
+   *  ring, before a jump in the input */
+  boost::condition_variable ring_drained_;
+  std::atomic<bool> ring_draining_;
+
+  /** optional black box of the most recent packets */
+  boost::shared_ptr<BlackBox> black_box_;
+  std::string black_box_prefix_;
+  ros::ServiceServer black_box_service_;
+
+  /** seek service, for capture file input */
+  ros::ServiceServer seek_service_;
+
+  /** packet loss accounting */
+  SequenceCheck sequence_;
+  uint64_t kernel_drops_reported_;      ///< kernel drops at last update
+  uint64_t missing_reported_;           ///< missing packets at last update
+
+  /** optional recording of the packets read */
+  boost::shared_ptr<PcapWriter> recorder_;
+  uint64_t recorder_dropped_reported_;
+
+  /** devices multiplexed with epoll, when the sensors parameter is set */
+  std::vector<boost::shared_ptr<Sensor> > sensors_;
+  int epoll_fd_;
+
+  /** diagnostics updater */
+  diagnostic_updater::Updater diagnostics_;
+  boost::shared_ptr<diagnostic_updater::TopicDiagnostic> diag_topic_;
+};
+
+} // namespace velodyne_driver
+
+#endif // _VELODYNE_DRIVER_H_
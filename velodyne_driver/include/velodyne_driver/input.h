@@ -27,6 +27,10 @@
  *
  *     velodyne::InputPCAP -- derived class provides a similar interface
  *                      from a PCAP dump file
+ *
+ *     velodyne::InputPacketMmap -- derived class reads live data from
+ *                      a memory-mapped AF_PACKET ring on a network
+ *                      interface
  */
 
 #ifndef __VELODYNE_INPUT_H
@@ -36,9 +40,17 @@
 #include <stdio.h>
 #include <pcap.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <vector>
 
 #include <ros/ros.h>
 #include <velodyne_msgs/VelodynePacket.h>
+#include <velodyne_driver/pcap_index.h>
+#include <velodyne_driver/pcap_reader.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 
 namespace velodyne_driver
 {
@@ -63,6 +75,66 @@ namespace velodyne_driver
     virtual int getPacket(velodyne_msgs::VelodynePacket *pkt,
                           const double time_offset) = 0;
 
+    /** @brief Read up to max_pkts Velodyne packets.
+     *
+     * The default implementation reads a single packet using
+     * getPacket().  Derived classes may override it to fill several
+     * consecutive slots with one system call.
+     *
+     * @param pkts points to an array of at least max_pkts messages
+     * @param max_pkts maximum number of packets to read
+     *
+     * @returns number of packets read (0 if none available),
+     *          -1 if end of file
+     */
+    virtual int getPackets(velodyne_msgs::VelodynePacket *pkts,
+                           int max_pkts, const double time_offset);
+
+    /** @brief Number of packets the kernel dropped before they
+     *         could be read, 0 if the input cannot tell.
+     *
+     *  May be called from another thread than getPackets().
+     */
+    virtual uint64_t droppedPackets() const { return 0; }
+
+    /** @brief Receive buffer size in bytes, 0 if not applicable. */
+    virtual int receiveBufferSize() const { return 0; }
+
+    /** @brief File descriptor that becomes readable when
+     *         getAvailablePackets() has data, -1 if not supported.
+     */
+    virtual int descriptor() const { return -1; }
+
+    /** @brief Read the packets already queued, without waiting.
+     *
+     * @returns number of packets read (0 if none available)
+     */
+    virtual int getAvailablePackets(velodyne_msgs::VelodynePacket *pkts,
+                                    int max_pkts, const double time_offset)
+    {
+      return 0;
+    }
+
+    /** @brief Request continuing at seconds after the first packet.
+     *
+     *  May be called from another thread than the one reading.
+     *
+     * @returns false if the input cannot seek there
+     */
+    virtual bool seekTime(double seconds) { return false; }
+
+    /** @brief Request continuing at the start of a revolution. */
+    virtual bool seekRevolution(uint32_t revolution) { return false; }
+
+    /** @brief Tell whether the packets of the last getPackets() call
+     *         do not follow the ones before it, because the input
+     *         started over or seeked.  The packets of one call never
+     *         straddle the jump.
+     *
+     * @returns true once per jump
+     */
+    virtual bool restarted() { return false; }
+
   protected:
     ros::NodeHandle private_nh_;
     uint16_t port_;
@@ -80,15 +152,94 @@ namespace velodyne_driver
 
     virtual int getPacket(velodyne_msgs::VelodynePacket *pkt, 
                           const double time_offset);
+    virtual int getPackets(velodyne_msgs::VelodynePacket *pkts,
+                           int max_pkts, const double time_offset);
+    virtual uint64_t droppedPackets() const { return kernel_drops_; }
+    virtual int receiveBufferSize() const { return rcvbuf_size_; }
+    virtual int descriptor() const { return sockfd_; }
+    virtual int getAvailablePackets(velodyne_msgs::VelodynePacket *pkts,
+                                    int max_pkts, const double time_offset);
     void setDeviceIP( const std::string& ip );
   private:
 
+    void setReceiveBuffer(int size);
+    bool parseControl(const cmsghdr *cmsg, ros::Time *stamp);
+    int receiveBatch(velodyne_msgs::VelodynePacket *pkts,
+                     int batch, bool kernel_time);
+    int recvBatch(velodyne_msgs::VelodynePacket *pkts,
+                  int batch, bool kernel_time);
+    void stampPackets(velodyne_msgs::VelodynePacket *pkts, int npkts,
+                      const ros::Time &time_start, bool kernel_time,
+                      const double time_offset);
+    bool initUring(void);
+    int receiveUring(velodyne_msgs::VelodynePacket *pkts,
+                     int batch, bool kernel_time);
+
   private:
     int sockfd_;
     in_addr devip_;
+    int rcvbuf_size_;                   ///< actual SO_RCVBUF size
+    std::atomic<uint64_t> kernel_drops_; ///< from SO_RXQ_OVFL
+    uint32_t last_drop_count_;          ///< last raw SO_RXQ_OVFL value
+
+    /** recvmmsg() state, one entry per datagram in a batch */
+    int batch_size_;
+    std::vector<mmsghdr> msgs_;
+    std::vector<iovec> iovecs_;
+    std::vector<sockaddr_in> sender_addrs_;
+
+    /** stamp packets with their kernel receive time (SO_TIMESTAMPNS) */
+    bool kernel_time_;
+    std::vector<char> control_;         ///< ancillary data buffers
+
+    /** io_uring receive state, NULL when using recvmmsg() */
+    struct Uring;
+    boost::shared_ptr<Uring> uring_;
   };
 
 
+  /** @brief Live Velodyne input from a memory-mapped packet ring.
+   *
+   * Captures the Ethernet frames arriving on a dedicated interface
+   * through a PACKET_MMAP (TPACKET_V3) receive ring.  The kernel fills
+   * whole blocks of frames and hands them over together, so reading
+   * does not take a system call per packet.  Frames are selected by a
+   * BPF program attached to the socket, using the same port and
+   * device IP filter as the other inputs.
+   */
+  class InputPacketMmap: public Input
+  {
+  public:
+    InputPacketMmap(ros::NodeHandle private_nh,
+                    uint16_t port = DATA_PORT_NUMBER,
+                    std::string interface = "");
+    virtual ~InputPacketMmap();
+
+    virtual int getPacket(velodyne_msgs::VelodynePacket *pkt,
+                          const double time_offset);
+    virtual int getPackets(velodyne_msgs::VelodynePacket *pkts,
+                           int max_pkts, const double time_offset);
+    virtual uint64_t droppedPackets() const;
+    virtual int receiveBufferSize() const { return ring_size_; }
+
+  private:
+
+    bool attachFilter(void);
+    void releaseBlock(void);
+
+  private:
+    int fd_;
+    std::string interface_;
+    uint8_t *ring_;                     ///< mapped receive ring
+    int ring_size_;                     ///< ring size in bytes
+    int block_size_;
+    int block_count_;
+    int current_block_;                 ///< block being read
+    uint8_t *frame_;                    ///< next frame in current block
+    uint32_t frames_left_;              ///< frames left in current block
+    mutable std::atomic<uint64_t> drops_; ///< total frames dropped
+  };
+
   /** @brief Velodyne input from PCAP dump file.
    *
    * Dump files can be grabbed by libpcap, Velodyne's DSR software,
@@ -108,18 +259,52 @@ namespace velodyne_driver
 
     virtual int getPacket(velodyne_msgs::VelodynePacket *pkt, 
                           const double time_offset);
+    virtual int getPackets(velodyne_msgs::VelodynePacket *pkts,
+                           int max_pkts, const double time_offset);
+    virtual bool seekTime(double seconds);
+    virtual bool seekRevolution(uint32_t revolution);
+    virtual bool restarted();
     void setDeviceIP( const std::string& ip );
 
   private:
-    ros::Rate packet_rate_;
+    bool openIndex(size_t file);
+    void applySeek();
+    bool nextRecord(PcapRecord *rec);
+    bool restart();
+    uint64_t recordTime(const PcapRecord &rec);
+
+    double packet_rate_;
     std::string filename_;
-    pcap_t *pcap_;
-    bpf_program pcap_packet_filter_;
-    char errbuf_[PCAP_ERRBUF_SIZE];
+    PcapFileSet files_;
+    in_addr devip_;
     bool empty_;
     bool read_once_;
     bool read_fast_;
     double repeat_delay_;
+
+    /** replay pacing, anchored at the first record replayed */
+    double replay_speed_;               ///< 0 means as fast as possible
+    bool pcap_time_;                    ///< stamp with capture time
+    bool anchored_;
+    uint64_t anchor_ns_;                ///< record time at the anchor
+    ros::WallTime anchor_wall_;
+    ros::Time anchor_stamp_;
+    uint64_t last_ns_;                  ///< record time of the last packet
+    uint64_t synthetic_ns_;             ///< for records without time stamp
+    PcapRecord pending_;                ///< read, but not yet due
+    uint64_t pending_ns_;               ///< recordTime() of pending_
+    bool have_pending_;
+    bool restarted_;                    ///< jumped since restarted()
+
+    /** seek requests, applied by the reading thread */
+    boost::mutex seek_mutex_;
+    std::vector<boost::shared_ptr<PcapIndex> > indexes_; ///< of each file
+    int index_interval_;
+    std::atomic<bool> seek_pending_;
+    bool seek_by_time_;
+    size_t seek_file_;
+    uint64_t seek_time_ns_;
+    uint32_t seek_revolution_;
   };
 
 } // velodyne_driver namespace
@@ -0,0 +1,234 @@
+/* -*- mode: C++ -*- */
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Velodyne 3D LIDAR models.
+ *
+ *  One table describes every supported device, for the driver (packet
+ *  rate) and for the decoder in velodyne_pointcloud (lasers, firing
+ *  timing, distance resolution).  The table is constexpr, so code
+ *  templated on a ModelId reads its entry as compile-time constants.
+ *
+ *  Timing values are from the device user manuals; the HDL-64E
+ *  firing timing is not modelled, its points take the packet time.
+ *
+ *  Except for the HDL-64E, the devices end each packet with two
+ *  factory bytes: the return mode (offset 1204) and the product ID
+ *  (offset 1205).  ModelDetector looks at them in the first packets
+ *  received to tell which device sent them.
+ */
+
+#ifndef _VELODYNE_MODEL_H_
+#define _VELODYNE_MODEL_H_ 1
+
+#include <stdint.h>
+#include <string>
+
+namespace velodyne_driver
+{
+
+/** return modes, as a bit mask */
+enum ReturnMode
+{
+  RETURN_STRONGEST = 0x1,
+  RETURN_LAST = 0x2,
+  RETURN_DUAL = 0x4
+};
+
+/** index of each model in MODELS */
+enum ModelId
+{
+  MODEL_64E_S2,
+  MODEL_64E_S21,
+  MODEL_64E,
+  MODEL_32E,
+  MODEL_VLP16,
+  MODEL_VLP32,
+  N_MODELS
+};
+
+struct ModelSpec
+{
+  const char *name;                     ///< model parameter value
+  const char *full_name;                ///< product name
+  int lasers;                           ///< number of lasers
+  int firing_seqs_per_block;            ///< times each laser fires per block
+  int lasers_per_firing;                ///< lasers fired together
+  float firing_duration;                ///< between firings [us]
+  float firing_seq_duration;            ///< of all lasers firing once [us]
+  float distance_resolution;            ///< of raw distances [m]
+  double packet_rate;                   ///< single return packets [Hz]
+  int return_modes;                     ///< ReturnMode mask supported
+  uint8_t product_id;                   ///< factory byte, 0 if none
+
+  /** @returns time covered by one data block [us] */
+  constexpr float block_duration() const
+  {
+    return firing_seq_duration * firing_seqs_per_block;
+  }
+};
+
+constexpr ModelSpec MODELS[N_MODELS] =
+  {
+    // HDL-64E S2 and S2.1 generate 1333312 points per second,
+    // 1 packet holds 384 points
+    { "64E_S2", "HDL-64E_S2", 64, 1, 1, 0.0f, 0.0f, 0.002f, 3472.17,
+      RETURN_STRONGEST | RETURN_LAST | RETURN_DUAL, 0 },
+    { "64E_S2.1", "HDL-64E_S2.1", 64, 1, 1, 0.0f, 0.0f, 0.002f, 3472.17,
+      RETURN_STRONGEST | RETURN_LAST | RETURN_DUAL, 0 },
+    { "64E", "HDL-64E", 64, 1, 1, 0.0f, 0.0f, 0.002f, 2600.0,
+      RETURN_STRONGEST, 0 },
+    { "32E", "HDL-32E", 32, 1, 1, 1.152f, 46.08f, 0.002f, 1808.0,
+      RETURN_STRONGEST | RETURN_LAST | RETURN_DUAL, 0x21 },
+    // 754 packets/second for last or strongest mode, 1508 for dual
+    // (VLP-16 User Manual)
+    { "VLP16", "VLP-16", 16, 2, 1, 2.304f, 55.296f, 0.002f, 754.0,
+      RETURN_STRONGEST | RETURN_LAST | RETURN_DUAL, 0x22 },
+    { "VLP32", "VLP-32", 32, 1, 2, 2.304f, 55.296f, 0.004f, 1507.0,
+      RETURN_STRONGEST | RETURN_LAST | RETURN_DUAL, 0x28 },
+  };
+
+/** @returns ModelId named by a model parameter, -1 if unknown */
+inline int findModel(const std::string &name)
+{
+  for (int i = 0; i < N_MODELS; ++i)
+    if (name == MODELS[i].name)
+      return i;
+  return -1;
+}
+
+/** @returns true if packets of the detected model decode like the
+ *           configured one (the HDL-64E variants cannot be told apart)
+ */
+inline bool modelMatches(int configured, int detected)
+{
+  return configured == detected
+    || (MODELS[configured].product_id == 0
+        && MODELS[detected].product_id == 0);
+}
+
+inline const char *returnModeName(int mode)
+{
+  switch (mode)
+    {
+    case RETURN_STRONGEST: return "strongest return";
+    case RETURN_LAST: return "last return";
+    case RETURN_DUAL: return "dual return";
+    default: return "unknown return mode";
+    }
+}
+
+/** Tell the model and return mode from the packets themselves. */
+class ModelDetector
+{
+public:
+
+  ModelDetector():
+    done_(false),
+    model_(-1),
+    return_mode_(0),
+    checked_(0),
+    factory_(0),
+    varied_(false)
+  {}
+
+  /** @brief Look at the factory bytes of the next packet.
+   *
+   *  The factory bytes must be the same in the first packets; an
+   *  HDL-64E has status bytes cycling through several values there.
+   *  Bytes that stay zero tell nothing, the model is then unknown.
+   *
+   *  @param data packet contents
+   *  @returns true once the model is known
+   */
+  bool check(const uint8_t *data)
+  {
+    if (done_)
+      return true;
+
+    const uint16_t factory = data[1204] | (data[1205] << 8);
+    if (checked_ == 0)
+      factory_ = factory;
+    else if (factory != factory_)
+      varied_ = true;
+    if (++checked_ < PACKETS_TO_CHECK)
+      return false;
+
+    done_ = true;
+    if (varied_)
+      {
+        factory_ = 0;
+        model_ = MODEL_64E;
+        return true;
+      }
+    for (int i = 0; factory_ != 0 && i < N_MODELS; ++i)
+      if (MODELS[i].product_id == productId()
+          || (i == MODEL_VLP16 && productId() == PUCK_HI_RES))
+        model_ = i;
+    switch (factory_ & 0xff)
+      {
+      case 0x37: return_mode_ = RETURN_STRONGEST; break;
+      case 0x38: return_mode_ = RETURN_LAST; break;
+      case 0x39: return_mode_ = RETURN_DUAL; break;
+      }
+    return true;
+  }
+
+  /** @returns true once enough packets were checked */
+  bool done() const
+  {
+    return done_;
+  }
+
+  /** @returns ModelId, -1 until done or if the product is unknown or
+   *           not told at all (see productId())
+   */
+  int model() const
+  {
+    return model_;
+  }
+
+  /** @returns product ID factory byte, 0 if none or varying */
+  uint8_t productId() const
+  {
+    return factory_ >> 8;
+  }
+
+  /** @returns ReturnMode, 0 if unknown */
+  int returnMode() const
+  {
+    return return_mode_;
+  }
+
+  /** @brief Start over, e.g. after reconnecting. */
+  void reset()
+  {
+    done_ = false;
+    model_ = -1;
+    return_mode_ = 0;
+    checked_ = 0;
+    factory_ = 0;
+    varied_ = false;
+  }
+
+private:
+
+  static const int PACKETS_TO_CHECK = 16;
+  static const uint8_t PUCK_HI_RES = 0x24; ///< decoded as a VLP-16
+
+  bool done_;
+  int model_;
+  int return_mode_;
+  int checked_;                         ///< packets looked at
+  uint16_t factory_;                    ///< factory bytes, 0 if they vary
+  bool varied_;                         ///< factory bytes not constant
+};
+
+} // namespace velodyne_driver
+
+#endif // _VELODYNE_MODEL_H_
@@ -0,0 +1,120 @@
+/* -*- mode: C++ -*- */
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Single-producer, single-consumer ring of Velodyne packets.
+ *
+ *  The ring decouples the thread reading the device from the thread
+ *  publishing scans.  All slots are allocated up front; the producer
+ *  asks for a run of contiguous free slots, fills them in place and
+ *  commits them, the consumer does the same with filled slots.  No
+ *  locks are taken on either side.
+ */
+
+#ifndef _VELODYNE_PACKET_RING_H_
+#define _VELODYNE_PACKET_RING_H_ 1
+
+#include <stddef.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <velodyne_msgs/VelodynePacket.h>
+
+namespace velodyne_driver
+{
+
+class PacketRing
+{
+public:
+
+  /** @param capacity number of packet slots, rounded up to a power of two */
+  explicit PacketRing(size_t capacity):
+    head_(0),
+    tail_(0)
+  {
+    size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    slots_.resize(size);
+    mask_ = size - 1;
+  }
+
+  size_t capacity() const
+  {
+    return slots_.size();
+  }
+
+  /** number of filled slots (exact only when called by one of the sides) */
+  size_t size() const
+  {
+    return head_.load(std::memory_order_acquire)
+      - tail_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const
+  {
+    return size() == 0;
+  }
+
+  /** @brief Producer: get contiguous free slots.
+   *
+   *  @param n returns the number of slots available at the pointer,
+   *           zero when the ring is full
+   */
+  velodyne_msgs::VelodynePacket *writeSlots(size_t *n)
+  {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    const size_t index = head & mask_;
+    *n = std::min(slots_.size() - (head - tail), slots_.size() - index);
+    return &slots_[index];
+  }
+
+  /** @brief Producer: publish n slots obtained from writeSlots(). */
+  void commit(size_t n)
+  {
+    head_.store(head_.load(std::memory_order_relaxed) + n,
+                std::memory_order_seq_cst);
+  }
+
+  /** @brief Consumer: get contiguous filled slots.
+   *
+   *  @param n returns the number of packets available at the
+   *           pointer, zero when the ring is empty
+   */
+  const velodyne_msgs::VelodynePacket *readSlots(size_t *n) const
+  {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t head = head_.load(std::memory_order_acquire);
+    const size_t index = tail & mask_;
+    *n = std::min(head - tail, slots_.size() - index);
+    return &slots_[index];
+  }
+
+  /** @brief Consumer: hand n slots obtained from readSlots() back. */
+  void release(size_t n)
+  {
+    tail_.store(tail_.load(std::memory_order_relaxed) + n,
+                std::memory_order_release);
+  }
+
+private:
+
+  std::vector<velodyne_msgs::VelodynePacket> slots_;
+  size_t mask_;
+
+  // keep the two indices on separate cache lines
+  std::atomic<size_t> head_;            ///< total packets written
+  char pad_[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> tail_;            ///< total packets read
+};
+
+} // namespace velodyne_driver
+
+#endif // _VELODYNE_PACKET_RING_H_
@@ -0,0 +1,102 @@
+/* -*- mode: C++ -*-
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Time and revolution index of a Velodyne capture file.
+ *
+ *    Every N-th Velodyne packet of the file is entered with its
+ *    record offset, capture time, azimuth and revolution number, so
+ *    a reader can seek to a time or a revolution with a binary
+ *    search, then read forward at most N packets.
+ *
+ *    The index is built by reading the whole file once, and saved
+ *    next to it as <file>.vidx.  It is rebuilt whenever the file
+ *    size, modification time or packet filter changed.
+ */
+
+#ifndef __VELODYNE_PCAP_INDEX_H
+#define __VELODYNE_PCAP_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace velodyne_driver
+{
+  class PcapIndex
+  {
+  public:
+    /** one indexed packet */
+    struct Entry
+    {
+      uint64_t offset;                  ///< PcapRecord::offset
+      uint64_t section;                 ///< PcapRecord::section
+      uint64_t time_ns;                 ///< capture time
+      uint32_t revolution;              ///< revolutions since the start
+      uint16_t azimuth;                 ///< azimuth of the first block
+      uint16_t reserved;
+    };
+
+    /** packets indexed, stored in the index file header */
+    struct Filter
+    {
+      uint16_t port;                    ///< UDP destination port
+      uint32_t src_addr;                ///< IPv4 source, 0 for any
+      uint32_t packet_size;             ///< UDP payload size
+      uint32_t interval;                ///< packets between entries
+    };
+
+    PcapIndex();
+
+    /** @brief Load the index of a capture file, building it if needed.
+     *
+     *  @returns false if the capture file cannot be read
+     */
+    bool open(const std::string &filename, const Filter &filter);
+
+    bool empty() const { return entries_.empty(); }
+
+    /** capture time of the first packet */
+    uint64_t startTime() const { return start_ns_; }
+
+    /** capture time of the last packet */
+    uint64_t endTime() const { return end_ns_; }
+
+    /** number of the last revolution */
+    uint32_t lastRevolution() const { return last_revolution_; }
+
+    /** @brief Last entry at or before time_ns (or the first entry). */
+    const Entry *findTime(uint64_t time_ns) const;
+
+    /** @brief Last entry at or before the start of a revolution. */
+    const Entry *findRevolution(uint32_t revolution) const;
+
+    /** @returns azimuth of a Velodyne packet's first block */
+    static uint16_t packetAzimuth(const uint8_t *data)
+    {
+      return data[2] | (data[3] << 8);
+    }
+
+  private:
+    bool build(const std::string &filename);
+    bool load(const std::string &path);
+    bool save(const std::string &path) const;
+
+    Filter filter_;
+    uint64_t file_size_;                ///< of the indexed capture
+    uint64_t file_mtime_ns_;
+    uint64_t start_ns_;
+    uint64_t end_ns_;
+    uint32_t last_revolution_;
+    std::vector<Entry> entries_;
+  };
+
+} // velodyne_driver namespace
+
+#endif // __VELODYNE_PCAP_INDEX_H
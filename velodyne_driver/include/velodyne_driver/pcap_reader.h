@@ -0,0 +1,191 @@
+/* -*- mode: C++ -*-
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Memory-mapped reader for pcap and pcapng capture files.
+ *
+ *    The whole file is mapped read-only, and each record is returned
+ *    as a pointer to its UDP payload inside the mapping, so reading
+ *    copies nothing.  The link layer, IPv4 and UDP headers are parsed
+ *    according to the capture link type instead of assuming a fixed
+ *    42 byte Ethernet header.
+ *
+ *    Supported link types: Ethernet (with VLAN tags), Linux cooked
+ *    capture v1 and v2, raw IP, BSD loopback.
+ *
+ *    PcapFileSet reads a series of rolled capture files, such as
+ *    those written by vdump, as if they were one.
+ */
+
+#ifndef __VELODYNE_PCAP_READER_H
+#define __VELODYNE_PCAP_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+namespace velodyne_driver
+{
+  /** one UDP datagram read from a capture file */
+  struct PcapRecord
+  {
+    const uint8_t *data;                ///< UDP payload (in the mapping)
+    size_t length;                      ///< UDP payload length
+    uint64_t time_ns;                   ///< capture time (ns since epoch)
+    uint32_t src_addr;                  ///< IPv4 source (network order)
+    uint16_t dst_port;                  ///< UDP destination port
+    size_t offset;                      ///< file offset of the record
+    size_t section;                     ///< offset of its pcapng section
+  };
+
+  class PcapReader
+  {
+  public:
+    PcapReader();
+    ~PcapReader();
+
+    bool open(const std::string &filename);
+    void close();
+    bool isOpen() const { return map_ != NULL; }
+
+    /** @brief Restart from the first record, without reopening. */
+    void rewind();
+
+    /** @brief Continue reading at a record returned earlier.
+     *
+     *  @param offset PcapRecord::offset of the record
+     *  @param section PcapRecord::section of the record
+     *  @returns false if the offset is outside the file
+     */
+    bool seek(size_t offset, size_t section);
+
+    /** @brief Get the next UDP datagram.
+     *
+     *  Records that are not IPv4/UDP, or are truncated, are skipped.
+     *
+     *  @returns false at end of file
+     */
+    bool next(PcapRecord *rec);
+
+    /** @returns size of the mapped file in bytes */
+    size_t size() const { return size_; }
+
+    /** @brief Read the whole file into the page cache.
+     *
+     *  Blocks until done, so call it from a background thread.
+     */
+    void willNeed();
+
+  private:
+    /** capture interface of a pcapng section */
+    struct Interface
+    {
+      uint16_t linktype;
+      bool tsresol_binary;              ///< resolution is 2^-tsresol
+      uint8_t tsresol;                  ///< otherwise 10^-tsresol
+    };
+
+    bool parseHeader();
+    bool parseSection(size_t offset);
+    bool startSection(const uint8_t *block);
+    void addInterface(const uint8_t *body, size_t body_len);
+    bool nextPcap(PcapRecord *rec);
+    bool nextPcapng(PcapRecord *rec);
+    bool parseFrame(uint16_t linktype, const uint8_t *frame,
+                    size_t caplen, PcapRecord *rec) const;
+    uint16_t get16(const uint8_t *p) const;
+    uint32_t get32(const uint8_t *p) const;
+    static uint64_t toNanoseconds(uint64_t ts, const Interface &iface);
+
+    int fd_;
+    const uint8_t *map_;
+    size_t size_;
+    size_t start_;                      ///< offset of the first record
+    size_t offset_;                     ///< offset of the next record
+    size_t section_;                    ///< offset of the pcapng section
+
+    bool pcapng_;
+    bool swapped_;                      ///< file byte order differs
+    Interface pcap_iface_;              ///< link type of a pcap file
+    std::vector<Interface> interfaces_; ///< of the current pcapng section
+  };
+
+  class PcapFileSet
+  {
+  public:
+    PcapFileSet();
+    ~PcapFileSet();
+
+    /** @brief Open a capture file, a glob pattern or a directory.
+     *
+     *  The files are read in the order of their first record time
+     *  stamp, so the numbering of a rolling capture that wrapped
+     *  around does not matter.
+     *
+     *  @returns false if no capture file was found
+     */
+    bool open(const std::string &pattern);
+
+    size_t size() const { return files_.size(); }
+    const std::string &name(size_t file) const { return files_[file].name; }
+    uint64_t startTime(size_t file) const { return files_[file].start_ns; }
+
+    /** @returns last file starting at or before time_ns (or the first) */
+    size_t findTime(uint64_t time_ns) const;
+
+    /** @returns index of the file being read */
+    size_t current() const { return current_; }
+
+    /** @brief Get the next UDP datagram, continuing with the next file.
+     *
+     *  @returns false at end of the last file
+     */
+    bool next(PcapRecord *rec);
+
+    /** @brief Restart from the first record of the first file. */
+    void rewind();
+
+    /** @brief Continue reading at a record of one of the files. */
+    bool seek(size_t file, size_t offset, size_t section);
+
+  private:
+    struct File
+    {
+      std::string name;
+      uint64_t start_ns;                ///< time stamp of the first record
+
+      bool operator<(const File &other) const
+      {
+        return start_ns < other.start_ns;
+      }
+    };
+
+    bool openFile(size_t file);
+    void prefetch(size_t file);
+    void prefetchLoop();
+
+    std::vector<File> files_;
+    size_t current_;
+    boost::shared_ptr<PcapReader> reader_;
+
+    /** background thread mapping and reading ahead the next file */
+    boost::shared_ptr<boost::thread> prefetch_thread_;
+    boost::mutex prefetch_mutex_;
+    boost::condition_variable prefetch_cond_;
+    bool prefetch_stop_;
+    size_t prefetch_file_;              ///< file requested
+    size_t prefetched_file_;            ///< file in prefetched_
+    boost::shared_ptr<PcapReader> prefetched_;
+  };
+
+} // velodyne_driver namespace
+
+#endif // __VELODYNE_PCAP_READER_H
@@ -0,0 +1,127 @@
+/* -*- mode: C++ -*-
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Background writer of Velodyne packets to rolling pcap files.
+ *
+ *    Packets are appended, with a synthesized Ethernet, IPv4 and UDP
+ *    header, to large page-aligned buffers.  Full buffers are handed
+ *    to a writer thread, so the caller never waits for the disk.  If
+ *    the disk falls behind and no buffer is free, packets are
+ *    dropped and counted instead.
+ *
+ *    Files are named <prefix>NNN like those of vdump, and a new one
+ *    is started whenever the current one would exceed the file size.
+ *    After the last file number, the oldest file is overwritten.
+ */
+
+#ifndef __VELODYNE_PCAP_WRITER_H
+#define __VELODYNE_PCAP_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <velodyne_msgs/VelodynePacket.h>
+
+namespace velodyne_driver
+{
+  class PcapWriter
+  {
+  public:
+    PcapWriter();
+    ~PcapWriter();
+
+    /** @brief Start writing.
+     *
+     *  @param prefix file name prefix, completed with a file number
+     *  @param file_size maximum file size in bytes, 0 for no limit
+     *  @param file_count number of files before wrapping around,
+     *         0 for no limit; 1 writes a single file named prefix
+     *  @param port UDP destination port in the packet headers
+     *  @param device_ip source address in the packet headers
+     *  @param buffer_size size of each buffer in bytes
+     *  @param buffer_count number of buffers
+     *  @returns false if the first file cannot be created
+     */
+    bool open(const std::string &prefix, size_t file_size, int file_count,
+              uint16_t port, const std::string &device_ip,
+              size_t buffer_size = 4 << 20, int buffer_count = 8);
+
+    /** @brief Write the buffered packets and stop. */
+    void close();
+
+    bool isOpen() const { return writer_thread_.get() != NULL; }
+
+    /** @brief Queue packets for writing.
+     *
+     *  Never waits for the disk unless setBlocking() was called.
+     *  Call from one thread only.
+     */
+    void write(const velodyne_msgs::VelodynePacket *pkts, int npkts);
+
+    /** @brief Wait for a free buffer instead of dropping packets.
+     *
+     *  For writing packets already held in memory, where waiting
+     *  for the disk does no harm.
+     */
+    void setBlocking(bool blocking) { blocking_ = blocking; }
+
+    /** @brief Hand the partly filled buffer to the writer thread. */
+    void flush();
+
+    uint64_t written() const { return written_; }
+    uint64_t dropped() const { return dropped_; }
+
+  private:
+    struct Buffer
+    {
+      uint8_t *data;
+      size_t used;
+    };
+
+    void writerLoop();
+    void writeBuffer(const Buffer &buf);
+    bool nextFile();
+    std::string fileName(int number) const;
+
+    std::string prefix_;
+    size_t file_size_;
+    int file_count_;
+    size_t buffer_size_;
+    uint8_t frame_header_[42];          ///< Ethernet, IPv4 and UDP
+
+    std::vector<Buffer> buffers_;
+    Buffer *current_;                   ///< being filled by write()
+    std::deque<Buffer *> full_;         ///< waiting for the writer
+    std::vector<Buffer *> free_;
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    boost::condition_variable free_cond_; ///< a buffer was freed
+    bool stop_;
+    bool blocking_;
+    boost::shared_ptr<boost::thread> writer_thread_;
+
+    // writer thread only
+    int fd_;
+    int file_number_;
+    size_t file_bytes_;
+    size_t flushed_bytes_;              ///< already dropped from the cache
+
+    std::atomic<uint64_t> written_;     ///< packets written to disk
+    std::atomic<uint64_t> dropped_;     ///< packets lost, no buffer free
+  };
+
+} // velodyne_driver namespace
+
+#endif // __VELODYNE_PCAP_WRITER_H
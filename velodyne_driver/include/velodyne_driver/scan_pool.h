@@ -0,0 +1,126 @@
+/* -*- mode: C++ -*- */
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Pool of reusable Velodyne scan messages.
+ *
+ *  A published scan is shared with the subscribers in the same
+ *  process, and nobody knows when the last of them is done with it.
+ *  The pool hands out scans whose shared pointer, instead of deleting
+ *  the scan, gives it back to the pool when the last holder drops it.
+ *  The next scan then fills the packets already allocated and touched
+ *  by an earlier one, rather than a fresh, zeroed heap block.
+ */
+
+#ifndef _VELODYNE_SCAN_POOL_H_
+#define _VELODYNE_SCAN_POOL_H_ 1
+
+#include <stddef.h>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <velodyne_msgs/VelodyneScan.h>
+
+namespace velodyne_driver
+{
+
+class ScanPool
+{
+public:
+
+  /** @param max_free largest number of released scans kept for reuse */
+  explicit ScanPool(size_t max_free):
+    free_(new FreeList(max_free))
+  {}
+
+  /** @brief Get a scan with room for npackets packets.
+   *
+   *  The header and packets of a reused scan keep their old contents,
+   *  to be overwritten by the caller.
+   */
+  velodyne_msgs::VelodyneScanPtr get(size_t npackets)
+  {
+    velodyne_msgs::VelodyneScan *scan = free_->take();
+    if (scan == NULL)
+      scan = new velodyne_msgs::VelodyneScan;
+    scan->packets.resize(npackets);
+    return velodyne_msgs::VelodyneScanPtr(scan, Recycle(free_));
+  }
+
+private:
+
+  /** released scans, shared with the scans still in use, so they can
+   *  come back after the pool is gone */
+  class FreeList
+  {
+  public:
+
+    explicit FreeList(size_t max_free):
+      max_free_(max_free)
+    {
+      scans_.reserve(max_free);
+    }
+
+    ~FreeList()
+    {
+      for (size_t i = 0; i < scans_.size(); ++i)
+        delete scans_[i];
+    }
+
+    velodyne_msgs::VelodyneScan *take()
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      if (scans_.empty())
+        return NULL;
+      velodyne_msgs::VelodyneScan *scan = scans_.back();
+      scans_.pop_back();
+      return scan;
+    }
+
+    void give(velodyne_msgs::VelodyneScan *scan)
+    {
+      {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        if (scans_.size() < max_free_)
+          {
+            scans_.push_back(scan);
+            return;
+          }
+      }
+      delete scan;                      // pool full
+    }
+
+  private:
+    boost::mutex mutex_;
+    std::vector<velodyne_msgs::VelodyneScan *> scans_;
+    const size_t max_free_;
+  };
+
+  /** shared pointer deleter returning the scan to the free list */
+  struct Recycle
+  {
+    explicit Recycle(const boost::shared_ptr<FreeList> &free):
+      free(free)
+    {}
+
+    void operator()(velodyne_msgs::VelodyneScan *scan) const
+    {
+      free->give(scan);
+    }
+
+    boost::shared_ptr<FreeList> free;
+  };
+
+  boost::shared_ptr<FreeList> free_;
+};
+
+} // namespace velodyne_driver
+
+#endif // _VELODYNE_SCAN_POOL_H_
@@ -0,0 +1,136 @@
+/* -*- mode: C++ -*- */
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Detect packets missing from the Velodyne packet stream.
+ *
+ *  The device does not number its packets, but every packet carries
+ *  the microseconds since the top of the hour (offset 1200) and the
+ *  rotation of its first block (offset 2).  Consecutive packets are
+ *  one packet period and roughly one azimuth step apart, so a larger
+ *  advance reveals packets lost on the way.
+ */
+
+#ifndef _VELODYNE_SEQUENCE_CHECK_H_
+#define _VELODYNE_SEQUENCE_CHECK_H_ 1
+
+#include <stdint.h>
+#include <cmath>
+
+#include <velodyne_msgs/VelodynePacket.h>
+
+namespace velodyne_driver
+{
+
+class SequenceCheck
+{
+public:
+
+  SequenceCheck():
+    period_usec_(0.0),
+    azimuth_step_(0.0),
+    started_(false),
+    last_usec_(0),
+    last_azimuth_(0),
+    gaps_(0),
+    missing_(0)
+  {}
+
+  /** @param packet_rate expected device packet frequency (Hz) */
+  void setPacketRate(double packet_rate)
+  {
+    period_usec_ = 1e6 / packet_rate;
+  }
+
+  /** @brief Check the next packet of the stream.
+   *
+   *  The time stamps decide whether packets are missing.  If they do
+   *  not advance (for example on a device without a running clock),
+   *  the azimuth advance is used instead, compared with the average
+   *  step learned from consecutive packets.
+   *
+   *  @returns number of packets missing right before pkt
+   */
+  unsigned check(const velodyne_msgs::VelodynePacket &pkt)
+  {
+    const uint8_t *data = &pkt.data[0];
+    const uint32_t usec = data[1200] | (data[1201] << 8)
+      | (data[1202] << 16) | ((uint32_t) data[1203] << 24);
+    const uint16_t azimuth = data[2] | (data[3] << 8);
+
+    if (!started_ || period_usec_ <= 0.0)
+      {
+        started_ = true;
+        last_usec_ = usec;
+        last_azimuth_ = azimuth;
+        return 0;
+      }
+
+    const uint32_t dt =
+      ((uint64_t) usec + USEC_PER_HOUR - last_usec_) % USEC_PER_HOUR;
+    const uint16_t dazimuth = (azimuth + 36000 - last_azimuth_) % 36000;
+    last_usec_ = usec;
+    last_azimuth_ = azimuth;
+
+    double steps;
+    if (dt > 0 && dt < MAX_DT_USEC)
+      steps = dt / period_usec_;
+    else if (azimuth_step_ > 0.0)
+      steps = dazimuth / azimuth_step_;
+    else
+      steps = 1.0;                      // nothing to judge by yet
+
+    if (steps < 1.5)
+      {
+        // learn the azimuth advance of one packet
+        if (azimuth_step_ == 0.0)
+          azimuth_step_ = dazimuth;
+        else
+          azimuth_step_ += (dazimuth - azimuth_step_) / 64.0;
+        return 0;
+      }
+
+    unsigned lost = (unsigned) lrint(steps) - 1;
+    ++gaps_;
+    missing_ += lost;
+    return lost;
+  }
+
+  /** @brief Start over, e.g. when the input is rewound. */
+  void reset()
+  {
+    started_ = false;
+  }
+
+  uint64_t gaps() const
+  {
+    return gaps_;
+  }
+
+  uint64_t missing() const
+  {
+    return missing_;
+  }
+
+private:
+
+  static const uint32_t USEC_PER_HOUR = 3600u * 1000000u;
+  static const uint32_t MAX_DT_USEC = 1000000u; ///< larger means clock jump
+
+  double period_usec_;                  ///< expected packet period
+  double azimuth_step_;                 ///< average azimuth advance
+  bool started_;
+  uint32_t last_usec_;
+  uint16_t last_azimuth_;
+  uint64_t gaps_;                       ///< number of gaps seen
+  uint64_t missing_;                    ///< packets missing in them
+};
+
+} // namespace velodyne_driver
+
+#endif // _VELODYNE_SEQUENCE_CHECK_H_
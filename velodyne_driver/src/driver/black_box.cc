@@ -0,0 +1,134 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  In-memory black box of the most recent Velodyne packets.
+ */
+
+#include <algorithm>
+
+#include <ros/ros.h>
+#include <velodyne_driver/pcap_writer.h>
+
+#include <velodyne_driver/black_box.h>
+
+namespace velodyne_driver
+{
+
+BlackBox::BlackBox(size_t capacity, uint16_t port,
+                   const std::string &device_ip):
+  head_(0),
+  port_(port),
+  device_ip_(device_ip),
+  dumping_(false)
+{
+  const size_t nchunks = std::max((capacity + CHUNK_SIZE - 1) / CHUNK_SIZE,
+                                  (size_t) 1);
+  capacity_ = nchunks * CHUNK_SIZE;
+  slots_.resize(capacity_);
+  chunk_locks_.reset(new boost::mutex[nchunks]);
+}
+
+BlackBox::~BlackBox()
+{
+  if (dump_thread_)
+    dump_thread_->join();
+}
+
+void BlackBox::add(const velodyne_msgs::VelodynePacket *pkts, int npkts)
+{
+  while (npkts > 0)
+    {
+      // copy the packets that fit in the current chunk
+      const uint64_t head = head_.load(std::memory_order_relaxed);
+      const size_t index = head % capacity_;
+      const size_t chunk = index / CHUNK_SIZE;
+      const size_t n = std::min((size_t) npkts,
+                                (chunk + 1) * CHUNK_SIZE - index);
+
+      boost::lock_guard<boost::mutex> lock(chunk_locks_[chunk]);
+      std::copy(pkts, pkts + n, &slots_[index]);
+      head_.store(head + n, std::memory_order_release);
+
+      pkts += n;
+      npkts -= n;
+    }
+}
+
+bool BlackBox::dump(const std::string &filename, size_t npkts)
+{
+  if (dumping_)
+    return false;
+  if (dump_thread_)
+    dump_thread_->join();
+
+  const uint64_t end = head_;
+  const uint64_t kept = std::min(end, (uint64_t) capacity_);
+  const uint64_t count = (npkts == 0)? kept: std::min(kept, (uint64_t) npkts);
+
+  dumping_ = true;
+  dump_thread_.reset
+    (new boost::thread(boost::bind(&BlackBox::dumpLoop, this, filename,
+                                   end - count, end)));
+  return true;
+}
+
+/** @brief Dump thread: write packets begin to end (exclusive).
+ *
+ *  Starts with the oldest packets, which are the next ones to be
+ *  overwritten.  Each chunk is copied out under its lock, so packets
+ *  overwritten meanwhile are detected and skipped.
+ */
+void BlackBox::dumpLoop(std::string filename, uint64_t begin, uint64_t end)
+{
+  PcapWriter writer;
+  if (!writer.open(filename, 0, 1, port_, device_ip_))
+    {
+      dumping_ = false;
+      return;
+    }
+  writer.setBlocking(true);
+
+  std::vector<velodyne_msgs::VelodynePacket> copy;
+  copy.reserve(CHUNK_SIZE);
+  uint64_t lost = 0;
+  uint64_t next = begin;
+  while (next < end)
+    {
+      const size_t index = next % capacity_;
+      const size_t chunk = index / CHUNK_SIZE;
+      const uint64_t run_end =
+        std::min(end, next + ((chunk + 1) * CHUNK_SIZE - index));
+
+      copy.clear();
+      {
+        boost::lock_guard<boost::mutex> lock(chunk_locks_[chunk]);
+        // packets older than head - capacity were overwritten
+        const uint64_t head = head_.load(std::memory_order_acquire);
+        const uint64_t valid = (head > capacity_)? head - capacity_: 0;
+        const uint64_t first = std::max(next, valid);
+        if (first < run_end)
+          copy.insert(copy.end(), &slots_[first % capacity_],
+                      &slots_[first % capacity_] + (run_end - first));
+        lost += std::min(first, run_end) - next;
+      }
+
+      // write without holding the lock
+      writer.write(copy.data(), copy.size());
+      next = run_end;
+    }
+
+  writer.close();
+  if (lost > 0)
+    ROS_WARN("%llu black box packets overwritten before dumping",
+             (unsigned long long) lost);
+  ROS_INFO("wrote %llu black box packets to %s",
+           (unsigned long long) writer.written(), filename.c_str());
+  dumping_ = false;
+}
+
+} // namespace velodyne_driver
@@ -14,18 +14,43 @@
 
 #include <string>
 #include <cmath>
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <unistd.h>
 
 #include <ros/ros.h>
 #include <tf/transform_listener.h>
+#include <velodyne_driver/model.h>
 #include <velodyne_msgs/VelodyneScan.h>
 
-#include "driver.h"
+#include <velodyne_driver/driver.h>
 
 namespace velodyne_driver
 {
 
 VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
-                               ros::NodeHandle private_nh)
+                               ros::NodeHandle private_nh,
+                               const PacketHandler &packet_handler):
+  publish_packets_(true),
+  packet_handler_(packet_handler),
+  model_(MODEL_64E),
+  npackets_read_(0),
+  scan_pool_(SCAN_POOL_SIZE),
+  receiving_(false),
+  input_done_(false),
+  ring_overflows_(0),
+  ring_high_water_(0),
+  ring_overflows_reported_(0),
+  ring_waiting_(false),
+  ring_restarted_(false),
+  ring_draining_(false),
+  kernel_drops_reported_(0),
+  missing_reported_(0),
+  recorder_dropped_reported_(0),
+  epoll_fd_(-1)
 {
   // use private node handle to get parameters
   private_nh.param("frame_id", config_.frame_id, std::string("velodyne"));
@@ -35,40 +60,16 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
 
   // get model name, validate string, determine packet rate
   private_nh.param("model", config_.model, std::string("64E"));
-  double packet_rate;                   // packet frequency (Hz)
-  std::string model_full_name;
-  if ((config_.model == "64E_S2") || 
-      (config_.model == "64E_S2.1"))    // generates 1333312 points per second
-    {                                   // 1 packet holds 384 points
-      packet_rate = 3472.17;            // 1333312 / 384
-      model_full_name = std::string("HDL-") + config_.model;
-    }
-  else if (config_.model == "64E")
-    {
-      packet_rate = 2600.0;
-      model_full_name = std::string("HDL-") + config_.model;
-    }
-  else if (config_.model == "32E")
-    {
-      packet_rate = 1808.0;
-      model_full_name = std::string("HDL-") + config_.model;
-    }
-  else if (config_.model == "VLP16")
-    {
-      packet_rate = 754;             // 754 Packets/Second for Last or Strongest mode 1508 for dual (VLP-16 User Manual)
-      model_full_name = "VLP-16";
-    }
-  else if (config_.model == "VLP32")
-    {
-      packet_rate = 1507;
-      model_full_name = "VLP-32";
-    }
-  else
+  model_ = findModel(config_.model);
+  if (model_ < 0)
     {
       ROS_ERROR_STREAM("unknown Velodyne LIDAR model: " << config_.model);
-      packet_rate = 2600.0;
+      model_ = MODEL_64E;
     }
+  double packet_rate = MODELS[model_].packet_rate; // packet frequency (Hz)
+  std::string model_full_name(MODELS[model_].full_name);
   std::string deviceName(std::string("Velodyne ") + model_full_name);
+  config_.packet_rate = packet_rate;
 
   private_nh.param("rpm", config_.rpm, 600.0);
   ROS_INFO_STREAM(deviceName << " rotating at " << config_.rpm << " RPM");
@@ -77,8 +78,42 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
   // default number of packets for each scan is a single revolution
   // (fractions rounded up)
   config_.npackets = (int) ceil(packet_rate / frequency);
-  private_nh.getParam("npackets", config_.npackets);
-  ROS_INFO_STREAM("publishing " << config_.npackets << " packets per scan");
+  config_.max_packets = config_.npackets;
+
+  // cut scans where the device passes an azimuth, instead of after a
+  // fixed number of packets?
+  private_nh.param("cut_angle", config_.cut_angle, -0.01);
+  private_nh.param("sector_angle", config_.sector_angle, 0.0);
+  if (config_.cut_angle >= 2 * M_PI)
+    {
+      ROS_WARN("cut_angle %.3f not below 2*pi, disabled", config_.cut_angle);
+      config_.cut_angle = -0.01;
+    }
+  if (config_.sector_angle > 0.0 && config_.cut_angle < 0.0)
+    config_.cut_angle = 0.0;            // sectors start at azimuth 0
+  double scans_per_revolution = 0.0;
+  if (config_.cut_angle >= 0.0)
+    {
+      cut_.setCutAngle(config_.cut_angle, config_.sector_angle);
+      scans_per_revolution = cut_.sectors();
+      config_.npackets = (int) ceil(config_.npackets / scans_per_revolution);
+
+      // leave room for a rotation somewhat slower than rpm says
+      config_.max_packets = config_.npackets + config_.npackets / 4 + 1;
+      if (scans_per_revolution > 1)
+        ROS_INFO("publishing %d sectors per revolution, starting at %.3f rad",
+                 cut_.sectors(), config_.cut_angle);
+      else
+        ROS_INFO("publishing one revolution per scan, cut at %.3f rad",
+                 config_.cut_angle);
+    }
+  else
+    {
+      private_nh.getParam("npackets", config_.npackets);
+      config_.max_packets = config_.npackets;
+      ROS_INFO_STREAM("publishing " << config_.npackets
+                      << " packets per scan");
+    }
 
   std::string dump_file;
   private_nh.param("pcap", dump_file, std::string(""));
@@ -86,6 +121,9 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
   int udp_port;
   private_nh.param("port", udp_port, (int) DATA_PORT_NUMBER);
 
+  std::string capture_interface;
+  private_nh.param("capture_interface", capture_interface, std::string(""));
+
   // Initialize dynamic reconfigure
   srv_ = boost::make_shared <dynamic_reconfigure::Server<velodyne_driver::
     VelodyneNodeConfig> > (private_nh);
@@ -96,17 +134,84 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
 
   // initialize diagnostics
   diagnostics_.setHardwareID(deviceName);
-  const double diag_freq = packet_rate/config_.npackets;
-  diag_max_freq_ = diag_freq;
-  diag_min_freq_ = diag_freq;
+  const double diag_freq = (scans_per_revolution > 0.0?
+                             frequency * scans_per_revolution:
+                             packet_rate/config_.npackets);
+  returns_.dual = false;
+  returns_.max_packets = config_.max_packets;
+  returns_.diag_max_freq = diag_freq;
+  returns_.diag_min_freq = diag_freq;
   ROS_INFO("expected frequency: %.3f (Hz)", diag_freq);
 
+  // compare the model with the one the packets come from
+  diagnostics_.add("Device model", this, &VelodyneDriver::modelDiagnostics);
+
+  // record the packets read?
+  std::string record;
+  private_nh.param("record", record, std::string(""));
+
+  // keep the most recent packets in memory?
+  double black_box_seconds;
+  private_nh.param("black_box_seconds", black_box_seconds, 0.0);
+  private_nh.param("black_box_prefix", black_box_prefix_,
+                   std::string("velodyne-black-box-"));
+  const size_t black_box_size = (size_t) (black_box_seconds * packet_rate);
+  if (black_box_size > 0)
+    {
+      ROS_INFO("keeping the last %.1f seconds of packets in memory",
+               black_box_seconds);
+      black_box_service_ =
+        private_nh.advertiseService("dump_black_box",
+                                    &VelodyneDriver::dumpBlackBox, this);
+    }
+
+  // serve several devices from this driver?
+  std::vector<std::string> sensor_names;
+  private_nh.getParam("sensors", sensor_names);
+  if (!sensor_names.empty())
+    {
+      if (dump_file != "" || capture_interface != "")
+        ROS_ERROR("pcap and capture_interface not supported with sensors,"
+                  " reading UDP sockets");
+      if (packet_handler_)
+        {
+          ROS_ERROR("decoding in the driver not supported with sensors,"
+                    " publishing packets");
+          packet_handler_.clear();
+        }
+      openSensors(node, private_nh, sensor_names, packet_rate);
+      if (!record.empty())
+        {
+          for (size_t i = 0; i < sensors_.size(); ++i)
+            sensors_[i]->recorder =
+              openRecorder(ros::NodeHandle(private_nh, sensors_[i]->name),
+                           record + sensors_[i]->name + "-",
+                           sensors_[i]->port);
+          diagnostics_.add("Packet recorder", this,
+                           &VelodyneDriver::recorderDiagnostics);
+        }
+      if (black_box_size > 0)
+        {
+          for (size_t i = 0; i < sensors_.size(); ++i)
+            {
+              std::string device_ip;
+              ros::NodeHandle(private_nh, sensors_[i]->name)
+                .param("device_ip", device_ip, std::string(""));
+              sensors_[i]->black_box.reset
+                (new BlackBox(black_box_size, sensors_[i]->port, device_ip));
+            }
+        }
+      return;
+    }
+
   using namespace diagnostic_updater;
   diag_topic_.reset(new TopicDiagnostic("velodyne_packets", diagnostics_,
-                                        FrequencyStatusParam(&diag_min_freq_,
-                                                             &diag_max_freq_,
+                                        FrequencyStatusParam(&returns_.diag_min_freq,
+                                                             &returns_.diag_max_freq,
                                                              0.1, 10),
                                         TimeStampStatusParam(-0.2, 0.2)));
+  sequence_.setPacketRate(packet_rate);
+  diagnostics_.add("Packet loss", this, &VelodyneDriver::lossDiagnostics);
 
   // open Velodyne input device or file
   if (dump_file != "")                  // have PCAP file?
@@ -114,6 +219,15 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
       // read data from packet capture file
       input_.reset(new velodyne_driver::InputPCAP(private_nh, udp_port,
                                                   packet_rate, dump_file));
+      seek_service_ = private_nh.advertiseService("seek",
+                                                  &VelodyneDriver::seek,
+                                                  this);
+    }
+  else if (capture_interface != "")     // have dedicated interface?
+    {
+      // read data from memory-mapped packet ring
+      input_.reset(new velodyne_driver::InputPacketMmap(private_nh, udp_port,
+                                                        capture_interface));
     }
   else
     {
@@ -121,9 +235,442 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
       input_.reset(new velodyne_driver::InputSocket(private_nh, udp_port));
     }
 
-  // raw packet output topic
-  output_ =
-    node.advertise<velodyne_msgs::VelodyneScan>("velodyne_packets", 10);
+  if (black_box_size > 0)
+    {
+      std::string device_ip;
+      private_nh.param("device_ip", device_ip, std::string(""));
+      black_box_.reset(new BlackBox(black_box_size, udp_port, device_ip));
+    }
+
+  if (!record.empty())
+    {
+      recorder_ = openRecorder(private_nh, record, udp_port);
+      diagnostics_.add("Packet recorder", this,
+                       &VelodyneDriver::recorderDiagnostics);
+    }
+
+  // raw packet output topic; optional when the packets are decoded
+  // here, then only needed for recording them
+  if (packet_handler_)
+    private_nh.param("publish_packets", publish_packets_, false);
+  if (publish_packets_)
+    output_ =
+      node.advertise<velodyne_msgs::VelodyneScan>("velodyne_packets", 10);
+
+  // optionally read the device on a dedicated thread, so publishing
+  // never keeps the socket waiting
+  bool receive_thread;
+  private_nh.param("receive_thread", receive_thread, false);
+  if (receive_thread)
+    {
+      int ring_size;
+      private_nh.param("ring_size", ring_size, 8192);
+      ring_.reset(new PacketRing(std::max(ring_size, config_.max_packets)));
+      ROS_INFO_STREAM("receiving on a separate thread, ring holds "
+                      << ring_->capacity() << " packets");
+      diagnostics_.add("Packet ring", this,
+                       &VelodyneDriver::ringDiagnostics);
+
+      receiving_ = true;
+      receive_thread_.reset
+        (new boost::thread(boost::bind(&VelodyneDriver::receiveLoop, this)));
+    }
+}
+
+VelodyneDriver::~VelodyneDriver()
+{
+  if (receive_thread_)
+    {
+      receiving_ = false;
+      {
+        boost::lock_guard<boost::mutex> lock(ring_mutex_);
+        ring_drained_.notify_one();
+      }
+      receive_thread_->join();
+    }
+  if (recorder_)
+    recorder_->close();
+  for (size_t i = 0; i < sensors_.size(); ++i)
+    if (sensors_[i]->recorder)
+      sensors_[i]->recorder->close();
+  if (epoll_fd_ >= 0)
+    (void) close(epoll_fd_);
+}
+
+/** @brief Open a socket for each of several devices.
+ *
+ *  Each name in the sensors list has its own parameter namespace
+ *  holding its port, device_ip, frame_id and socket options, and its
+ *  own <name>/velodyne_packets topic.  All sockets are multiplexed
+ *  on one epoll descriptor and served by the thread calling poll().
+ *  The devices share model, rpm, npackets, cut_angle and sector_angle.
+ */
+void VelodyneDriver::openSensors(ros::NodeHandle node,
+                                 ros::NodeHandle private_nh,
+                                 const std::vector<std::string> &names,
+                                 double packet_rate)
+{
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0)
+    {
+      ROS_FATAL("epoll_create1() failed: %s", strerror(errno));
+      return;
+    }
+
+  std::string tf_prefix = tf::getPrefixParam(private_nh);
+  for (size_t i = 0; i < names.size(); ++i)
+    {
+      ros::NodeHandle sensor_nh(private_nh, names[i]);
+      boost::shared_ptr<Sensor> sensor(new Sensor);
+      sensor->name = names[i];
+      sensor_nh.param("frame_id", sensor->frame_id, names[i]);
+      sensor->frame_id = tf::resolve(tf_prefix, sensor->frame_id);
+
+      int udp_port;
+      sensor_nh.param("port", udp_port, (int) DATA_PORT_NUMBER);
+      sensor->port = udp_port;
+      sensor->input.reset(new velodyne_driver::InputSocket(sensor_nh,
+                                                           udp_port));
+      sensor->returns = returns_;
+      sensor->scan = newScan(sensor->returns.max_packets);
+      sensor->npackets_read = 0;
+      sensor->npackets_checked = 0;
+      sensor->sequence.setPacketRate(packet_rate);
+      sensor->cut.setCutAngle(config_.cut_angle, config_.sector_angle);
+      sensor->kernel_drops_reported = 0;
+      sensor->missing_reported = 0;
+
+      const std::string topic = names[i] + "/velodyne_packets";
+      sensor->output =
+        node.advertise<velodyne_msgs::VelodyneScan>(topic, 10);
+
+      using namespace diagnostic_updater;
+      sensor->diag_topic.reset
+        (new TopicDiagnostic(topic, diagnostics_,
+                             FrequencyStatusParam(&sensor->returns.diag_min_freq,
+                                                  &sensor->returns.diag_max_freq,
+                                                  0.1, 10),
+                             TimeStampStatusParam(-0.2, 0.2)));
+      diagnostics_.add(names[i] + " packet loss",
+                       boost::bind(&VelodyneDriver::sensorDiagnostics,
+                                   this, sensor.get(), _1));
+
+      epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.ptr = sensor.get();
+      if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD,
+                    sensor->input->descriptor(), &event) < 0)
+        {
+          ROS_ERROR_STREAM("cannot poll sensor " << names[i] << ": "
+                           << strerror(errno));
+          continue;
+        }
+
+      ROS_INFO_STREAM("sensor " << names[i] << " on port " << udp_port
+                      << " publishing " << topic);
+      sensors_.push_back(sensor);
+    }
+}
+
+/** @brief Wait for any of the sensors, then read the ready ones.
+ *
+ *  @returns true unless shut down
+ */
+bool VelodyneDriver::pollSensors(void)
+{
+  if (sensors_.empty())
+    return false;
+
+  static const int MAX_EVENTS = 16;
+  static const int POLL_TIMEOUT = 1000; // one second (in msec)
+  epoll_event events[MAX_EVENTS];
+
+  int nready = epoll_wait(epoll_fd_, events, MAX_EVENTS, POLL_TIMEOUT);
+  if (nready < 0)
+    {
+      if (errno != EINTR)
+        ROS_ERROR("epoll_wait() error: %s", strerror(errno));
+    }
+  else if (nready == 0)
+    {
+      ROS_WARN("Velodyne epoll() timeout");
+    }
+
+  for (int i = 0; i < nready; ++i)
+    readSensor(*static_cast<Sensor *>(events[i].data.ptr));
+
+  diagnostics_.update();
+  return ros::ok();
+}
+
+/** @brief Read the packets queued for one sensor.
+ *
+ *  Stops after publishing a scan, so a busy sensor cannot starve
+ *  the others; epoll reports it again while packets remain.
+ */
+void VelodyneDriver::readSensor(Sensor &sensor)
+{
+  for (;;)
+    {
+      if (checkPackets(*sensor.scan, &sensor.npackets_checked,
+                       sensor.npackets_read, sensor.sequence, sensor.cut,
+                       sensor.detector, sensor.returns))
+        {
+          velodyne_msgs::VelodyneScanPtr scan =
+            closeScan(sensor.scan, sensor.npackets_checked,
+                      &sensor.npackets_read, sensor.returns.max_packets);
+          sensor.npackets_checked = 0;
+          scan->header.stamp = scan->packets.back().stamp;
+          scan->header.frame_id = sensor.frame_id;
+          sensor.output.publish(scan);
+          sensor.diag_topic->tick(scan->header.stamp);
+          return;
+        }
+
+      int &i = sensor.npackets_read;
+      int rc = sensor.input->getAvailablePackets(&sensor.scan->packets[i],
+                                                 sensor.scan->packets.size() - i,
+                                                 config_.time_offset);
+      if (rc <= 0)
+        return;
+      if (sensor.recorder)
+        sensor.recorder->write(&sensor.scan->packets[i], rc);
+      if (sensor.black_box)
+        sensor.black_box->add(&sensor.scan->packets[i], rc);
+      i += rc;
+    }
+}
+
+/** @brief Receive thread main loop.
+ *
+ *  Reads packets from the input directly into free ring slots.  When
+ *  the ring is full the packets are still read, so the socket keeps
+ *  draining, but they are dropped and counted as overflows.
+ */
+void VelodyneDriver::receiveLoop(void)
+{
+  std::vector<velodyne_msgs::VelodynePacket> discard(64);
+  bool restart_pending = false;         ///< the next packets start over
+
+  while (receiving_ && ros::ok())
+    {
+      size_t nfree;
+      velodyne_msgs::VelodynePacket *slots = ring_->writeSlots(&nfree);
+
+      int rc;
+      if (nfree == 0)                   // ring full?
+        {
+          rc = input_->getPackets(&discard[0], discard.size(),
+                                  config_.time_offset);
+          if (rc > 0)
+            ring_overflows_ += rc;
+          restart_pending |= input_->restarted();
+        }
+      else
+        {
+          rc = input_->getPackets(slots, nfree, config_.time_offset);
+          restart_pending |= input_->restarted();
+          if (rc > 0)
+            {
+              if (restart_pending)
+                {
+                  // let poll() check the packets before the jump
+                  // first, so it knows where the new ones start
+                  boost::unique_lock<boost::mutex> lock(ring_mutex_);
+                  ring_draining_ = true;
+                  while (!ring_->empty() && receiving_ && ros::ok())
+                    ring_drained_.timed_wait(lock,
+                                             boost::posix_time::milliseconds(100));
+                  ring_draining_ = false;
+                  ring_restarted_ = true;
+                  restart_pending = false;
+                }
+              ring_->commit(rc);
+              if (ring_waiting_)
+                {
+                  boost::lock_guard<boost::mutex> lock(ring_mutex_);
+                  ring_cond_.notify_one();
+                }
+            }
+        }
+
+      if (rc < 0)                       // end of file reached?
+        break;
+    }
+
+  input_done_ = true;
+  boost::lock_guard<boost::mutex> lock(ring_mutex_);
+  ring_cond_.notify_one();
+}
+
+/** @brief Read packets, either from the ring or from the input.
+ *
+ *  @param restarted set if the packets do not follow the ones read
+ *                   before, because the input started over or seeked
+ *  @returns number of packets read, -1 if end of file
+ */
+int VelodyneDriver::readPackets(velodyne_msgs::VelodynePacket *pkts,
+                                int max_pkts, bool *restarted)
+{
+  *restarted = false;
+  if (!ring_)
+    {
+      int rc = input_->getPackets(pkts, max_pkts, config_.time_offset);
+      *restarted = input_->restarted();
+      return rc;
+    }
+
+  size_t navail;
+  const velodyne_msgs::VelodynePacket *slots = ring_->readSlots(&navail);
+  if (navail == 0)
+    {
+      if (input_done_ && ring_->empty())
+        return -1;
+
+      // wait a little for the receive thread to deliver
+      boost::unique_lock<boost::mutex> lock(ring_mutex_);
+      ring_waiting_ = true;
+      if (ring_->empty() && !input_done_)
+        ring_cond_.timed_wait(lock, boost::posix_time::milliseconds(100));
+      ring_waiting_ = false;
+      return 0;
+    }
+
+  ring_high_water_ = std::max(ring_high_water_, ring_->size());
+
+  // the receive thread only marks a jump once the ring is empty, so
+  // packets seen together with the mark all come after it
+  *restarted = ring_restarted_.exchange(false);
+
+  const size_t n = std::min(navail, (size_t) max_pkts);
+  std::copy(slots, slots + n, pkts);
+  ring_->release(n);
+  if (ring_draining_ && ring_->empty())
+    {
+      boost::lock_guard<boost::mutex> lock(ring_mutex_);
+      ring_drained_.notify_one();
+    }
+  return n;
+}
+
+/** @brief Get a new scan, with room for the most packets it can hold.
+ *
+ *  A new shared pointer for every scan allows zero-copy sharing with
+ *  other nodelets.  The scan comes from the pool, which reuses scans
+ *  once all subscribers have dropped them.
+ */
+velodyne_msgs::VelodyneScanPtr VelodyneDriver::newScan(int max_packets)
+{
+  return scan_pool_.get(max_packets);
+}
+
+/** @brief Check the packets read into a scan not checked yet.
+ *
+ *  Stops at the packet completing a revolution or sector, if scans
+ *  are cut at an azimuth.  Each packet checked also goes to the
+ *  packet handler, if any, so it is decoded while still in cache.
+ *
+ *  @param scan grown to returns.max_packets if that grows
+ *  @param checked number of packets of scan already checked, updated
+ *  @param nread number of packets read into scan
+ *  @returns true if the first checked packets make a complete scan
+ */
+bool VelodyneDriver::checkPackets(velodyne_msgs::VelodyneScan &scan,
+                                  int *checked, int nread,
+                                  SequenceCheck &sequence, AzimuthCut &cut,
+                                  ModelDetector &detector, ReturnMode &returns)
+{
+  while (*checked < nread)
+    {
+      const int i = (*checked)++;
+      if (!detector.done() && detector.check(&scan.packets[i].data[0]))
+        {
+          modelDetected(detector, sequence, returns);
+          if ((int) scan.packets.size() < returns.max_packets)
+            scan.packets.resize(returns.max_packets);
+        }
+      const velodyne_msgs::VelodynePacket &pkt = scan.packets[i];
+      sequence.check(pkt);
+      if (packet_handler_)
+        packet_handler_(pkt, config_.frame_id);
+      if (cut.check(pkt))
+        return true;
+    }
+
+  // without a cut, or a revolution or sector too long for the scan
+  return *checked == (int) scan.packets.size();
+}
+
+/** @brief Act on the model and return mode told by the packets.
+ *
+ *  A model other than the configured one is reported as an error,
+ *  since its packets would be decoded wrongly.  Dual return devices
+ *  send twice the packets for the same rotation, so their scans get
+ *  twice the room, or come twice as often.
+ *
+ *  @param returns scan size and rate of the device, updated
+ */
+void VelodyneDriver::modelDetected(const ModelDetector &detector,
+                                   SequenceCheck &sequence,
+                                   ReturnMode &returns)
+{
+  const int detected = detector.model();
+  if (detected < 0 && detector.productId() == 0)
+    ROS_INFO("packets do not tell the device model, assuming %s",
+             MODELS[model_].full_name);
+  else if (detected < 0)
+    ROS_WARN("unknown Velodyne product ID 0x%02x", detector.productId());
+  else if (!modelMatches(model_, detected))
+    ROS_ERROR_STREAM("model is " << config_.model << ", but packets come from "
+                     << MODELS[detected].full_name);
+  else
+    ROS_INFO_STREAM("packets come from " << MODELS[detected].full_name
+                    << ", " << returnModeName(detector.returnMode()));
+
+  if (detector.returnMode() != RETURN_DUAL)
+    return;
+  sequence.setPacketRate(2 * config_.packet_rate);
+  if (returns.dual)
+    return;
+  returns.dual = true;
+  if (config_.cut_angle >= 0.0)
+    {
+      // a revolution or sector takes twice the packets
+      returns.max_packets *= 2;
+    }
+  else
+    {
+      // scans of npackets come twice as often
+      returns.diag_min_freq *= 2;
+      returns.diag_max_freq *= 2;
+    }
+}
+
+/** @brief Take a complete scan, starting the next one.
+ *
+ *  Packets read past the end of the complete scan are moved to the
+ *  next scan, to be checked again there.
+ *
+ *  @param scan complete scan, replaced by the next one
+ *  @param checked number of packets in the complete scan
+ *  @param nread number of packets read into scan, replaced by the
+ *               number moved to the next one
+ *  @param max_packets room of the next scan
+ *  @returns the complete scan
+ */
+velodyne_msgs::VelodyneScanPtr
+VelodyneDriver::closeScan(velodyne_msgs::VelodyneScanPtr &scan,
+                          int checked, int *nread, int max_packets)
+{
+  velodyne_msgs::VelodyneScanPtr done = scan;
+  scan = newScan(max_packets);
+  std::copy(done->packets.begin() + checked,
+            done->packets.begin() + *nread,
+            scan->packets.begin());
+  *nread -= checked;
+  done->packets.resize(checked);
+  return done;
 }
 
 /** poll the device
@@ -132,32 +679,52 @@ VelodyneDriver::VelodyneDriver(ros::NodeHandle node,
  */
 bool VelodyneDriver::poll(void)
 {
-  // Allocate a new shared pointer for zero-copy sharing with other nodelets.
-  velodyne_msgs::VelodyneScanPtr scan(new velodyne_msgs::VelodyneScan);
-  scan->packets.resize(config_.npackets);
+  if (epoll_fd_ >= 0)
+    return pollSensors();
+
+  if (!scan_)
+    scan_ = newScan(returns_.max_packets);
 
   // Since the velodyne delivers data at a very high rate, keep
-  // reading and publishing scans as fast as possible.
-  for (int i = 0; i < config_.npackets; ++i)
+  // reading and publishing scans as fast as possible.  The input may
+  // fill several consecutive packets with each call.  Packets read
+  // past the end of the previous scan already start this one.
+  int checked = 0;
+  while (!checkPackets(*scan_, &checked, npackets_read_, sequence_, cut_,
+                       detector_, returns_))
     {
-      while (true)
+      // if ros shutsdown, stop polling()
+      if (!ros::ok())
+        return false;
+
+      // keep reading until all packets of the scan are received
+      int &i = npackets_read_;
+      bool restarted;
+      int rc = readPackets(&scan_->packets[i], scan_->packets.size() - i,
+                           &restarted);
+      if (rc < 0) return false;     // end of file reached?
+      if (restarted)
         {
-	  // if ros shutsdown, stop polling()
-	  if (!ros::ok())
-	    return false;
-
-          // keep reading until full packet received
-          int rc = input_->getPacket(&scan->packets[i], config_.time_offset);
-          if (rc == 0) break;       // got a full packet?
-          if (rc < 0) return false; // end of file reached?
+          // the file started over or seeked: time stamps and azimuths
+          // jump, without any packets lost
+          sequence_.reset();
+          cut_.reset();
         }
+      if (recorder_)
+        recorder_->write(&scan_->packets[i], rc);
+      if (black_box_)
+        black_box_->add(&scan_->packets[i], rc);
+      i += rc;
     }
+  velodyne_msgs::VelodyneScanPtr scan =
+    closeScan(scan_, checked, &npackets_read_, returns_.max_packets);
 
   // publish message using time of last packet read
   ROS_DEBUG("Publishing a full Velodyne scan.");
-  scan->header.stamp = scan->packets[config_.npackets - 1].stamp;
+  scan->header.stamp = scan->packets.back().stamp;
   scan->header.frame_id = config_.frame_id;
-  output_.publish(scan);
+  if (publish_packets_)
+    output_.publish(scan);
 
   // notify diagnostics that a message has been published, updating
   // its status
@@ -167,6 +734,241 @@ bool VelodyneDriver::poll(void)
   return true;
 }
 
+/** @brief Start recording packets to rolling pcap files.
+ *
+ *  @returns the recorder, NULL if it could not be started
+ */
+boost::shared_ptr<PcapWriter>
+VelodyneDriver::openRecorder(ros::NodeHandle nh, const std::string &prefix,
+                             int udp_port)
+{
+  int file_size_mb, file_count, buffer_size_mb;
+  nh.param("record_file_size", file_size_mb, 100);
+  nh.param("record_file_count", file_count, 999);
+  nh.param("record_buffer_size", buffer_size_mb, 4);
+  std::string device_ip;
+  nh.param("device_ip", device_ip, std::string(""));
+
+  boost::shared_ptr<PcapWriter> recorder(new PcapWriter);
+  if (!recorder->open(prefix, (size_t) file_size_mb << 20, file_count,
+                      udp_port, device_ip, (size_t) buffer_size_mb << 20))
+    {
+      ROS_ERROR_STREAM("not recording to " << prefix);
+      recorder.reset();
+      return recorder;
+    }
+  return recorder;
+}
+
+/** @brief Report packets written, or lost because the disk is slow. */
+void VelodyneDriver::recorderDiagnostics
+  (diagnostic_updater::DiagnosticStatusWrapper &stat)
+{
+  uint64_t written = 0;
+  uint64_t dropped = 0;
+  if (recorder_)
+    {
+      written += recorder_->written();
+      dropped += recorder_->dropped();
+    }
+  for (size_t i = 0; i < sensors_.size(); ++i)
+    if (sensors_[i]->recorder)
+      {
+        written += sensors_[i]->recorder->written();
+        dropped += sensors_[i]->recorder->dropped();
+      }
+
+  if (dropped > recorder_dropped_reported_)
+    stat.summaryf(diagnostic_msgs::DiagnosticStatus::WARN,
+                  "%llu packets not recorded, disk too slow",
+                  (unsigned long long) (dropped - recorder_dropped_reported_));
+  else
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Recording");
+
+  stat.add("Packets written", written);
+  stat.add("Packets dropped", dropped);
+  recorder_dropped_reported_ = dropped;
+}
+
+/** @brief Seek service callback.
+ *
+ *  The input applies the request when it next reads, so this
+ *  returns at once.
+ */
+bool VelodyneDriver::seek(velodyne_msgs::Seek::Request &req,
+                          velodyne_msgs::Seek::Response &res)
+{
+  switch (req.mode)
+    {
+    case velodyne_msgs::Seek::Request::TIME:
+      res.success = input_->seekTime(req.time);
+      break;
+    case velodyne_msgs::Seek::Request::REVOLUTION:
+      res.success = input_->seekRevolution(req.revolution);
+      break;
+    default:
+      ROS_WARN("unknown seek mode %d", req.mode);
+      res.success = false;
+      break;
+    }
+  return true;
+}
+
+/** @brief Black box dump service callback.
+ *
+ *  Starts writing one file per sensor, named after the prefix and
+ *  the current local time, and returns at once.
+ */
+bool VelodyneDriver::dumpBlackBox(velodyne_msgs::DumpBlackBox::Request &req,
+                                  velodyne_msgs::DumpBlackBox::Response &res)
+{
+  char stamp[32];
+  const time_t now = time(NULL);
+  struct tm local;
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S",
+           localtime_r(&now, &local));
+  const std::string prefix =
+    (req.prefix.empty()? black_box_prefix_: req.prefix) + stamp;
+  const size_t npkts = (size_t) (std::max(req.seconds, 0.0)
+                                 * config_.packet_rate);
+
+  res.success = false;
+  if (black_box_)
+    {
+      const std::string filename = prefix + ".pcap";
+      if (black_box_->dump(filename, npkts))
+        res.files.push_back(filename);
+    }
+  for (size_t i = 0; i < sensors_.size(); ++i)
+    {
+      if (!sensors_[i]->black_box)
+        continue;
+      const std::string filename = prefix + "-" + sensors_[i]->name + ".pcap";
+      if (sensors_[i]->black_box->dump(filename, npkts))
+        res.files.push_back(filename);
+    }
+
+  if (res.files.empty())
+    ROS_WARN("black box dump already running");
+  res.success = !res.files.empty();
+  return true;
+}
+
+/** @brief Report receive ring occupancy and overflows. */
+void VelodyneDriver::ringDiagnostics
+  (diagnostic_updater::DiagnosticStatusWrapper &stat)
+{
+  const size_t occupancy = ring_->size();
+  const uint64_t overflows = ring_overflows_;
+
+  if (overflows > ring_overflows_reported_)
+    stat.summaryf(diagnostic_msgs::DiagnosticStatus::WARN,
+                  "%llu packets dropped, ring full",
+                  (unsigned long long) (overflows - ring_overflows_reported_));
+  else if (occupancy > ring_->capacity() * 3 / 4)
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+                 "Ring nearly full");
+  else
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Ring OK");
+
+  stat.add("Capacity", ring_->capacity());
+  stat.add("Occupancy", occupancy);
+  stat.add("High water mark", ring_high_water_);
+  stat.add("Overflows", overflows);
+
+  ring_overflows_reported_ = overflows;
+  ring_high_water_ = occupancy;
+}
+
+/** @brief Report the model the packets come from. */
+void VelodyneDriver::modelDiagnostics
+  (diagnostic_updater::DiagnosticStatusWrapper &stat)
+{
+  stat.summaryf(diagnostic_msgs::DiagnosticStatus::OK, "Model %s",
+                MODELS[model_].full_name);
+  if (sensors_.empty())
+    reportModel(stat, "Detected model", detector_);
+  for (size_t i = 0; i < sensors_.size(); ++i)
+    reportModel(stat, sensors_[i]->name + " detected model",
+                sensors_[i]->detector);
+}
+
+void VelodyneDriver::reportModel
+  (diagnostic_updater::DiagnosticStatusWrapper &stat,
+   const std::string &name, const ModelDetector &detector)
+{
+  if (!detector.done())
+    {
+      stat.add(name, "waiting for packets");
+      return;
+    }
+
+  const int detected = detector.model();
+  if (detected < 0 && detector.productId() == 0)
+    {
+      stat.add(name, "not told by the packets");
+      return;
+    }
+  if (detected < 0)
+    {
+      stat.mergeSummaryf(diagnostic_msgs::DiagnosticStatus::WARN,
+                         "Unknown product ID 0x%02x", detector.productId());
+      stat.add(name, "unknown");
+      return;
+    }
+
+  stat.add(name, std::string(MODELS[detected].full_name) + ", "
+           + returnModeName(detector.returnMode()));
+  if (!modelMatches(model_, detected))
+    stat.mergeSummaryf(diagnostic_msgs::DiagnosticStatus::ERROR,
+                       "Model %s configured, packets come from %s",
+                       MODELS[model_].full_name, MODELS[detected].full_name);
+}
+
+/** @brief Report packets lost by the kernel or on the network. */
+void VelodyneDriver::lossDiagnostics
+  (diagnostic_updater::DiagnosticStatusWrapper &stat)
+{
+  reportLoss(stat, *input_, sequence_,
+             &kernel_drops_reported_, &missing_reported_);
+}
+
+/** @brief Report packet loss of one of several sensors. */
+void VelodyneDriver::sensorDiagnostics
+  (Sensor *sensor, diagnostic_updater::DiagnosticStatusWrapper &stat)
+{
+  reportLoss(stat, *sensor->input, sensor->sequence,
+             &sensor->kernel_drops_reported, &sensor->missing_reported);
+}
+
+void VelodyneDriver::reportLoss
+  (diagnostic_updater::DiagnosticStatusWrapper &stat,
+   const Input &input, const SequenceCheck &sequence,
+   uint64_t *kernel_drops_reported, uint64_t *missing_reported)
+{
+  const uint64_t kernel_drops = input.droppedPackets();
+  const uint64_t missing = sequence.missing();
+
+  if (kernel_drops > *kernel_drops_reported)
+    stat.summaryf(diagnostic_msgs::DiagnosticStatus::WARN,
+                  "%llu packets dropped by the kernel",
+                  (unsigned long long) (kernel_drops - *kernel_drops_reported));
+  else if (missing > *missing_reported)
+    stat.summaryf(diagnostic_msgs::DiagnosticStatus::WARN,
+                  "%llu packets missing from the stream",
+                  (unsigned long long) (missing - *missing_reported));
+  else
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "No packet loss");
+
+  stat.add("Receive buffer (bytes)", input.receiveBufferSize());
+  stat.add("Kernel drops", kernel_drops);
+  stat.add("Sequence gaps", sequence.gaps());
+  stat.add("Missing packets", missing);
+
+  *kernel_drops_reported = kernel_drops;
+  *missing_reported = missing;
+}
+
 void VelodyneDriver::callback(velodyne_driver::VelodyneNodeConfig &config,
               uint32_t level)
 {
@@ -20,9 +20,13 @@
  *
  *     InputPCAP -- derived class provides a similar interface from a
  *              PCAP dump
+ *
+ *     InputPacketMmap -- derived class reads live data from a
+ *              memory-mapped AF_PACKET ring on a network interface
  */
 
 #include <unistd.h>
+#include <algorithm>
 #include <string>
 #include <sstream>
 #include <sys/socket.h>
@@ -31,6 +35,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 #include "velodyne_driver/input.h"
 #include "velodyne_driver/time_conversion.h"
 
@@ -39,6 +51,10 @@ namespace velodyne_driver
   static const size_t packet_size =
     sizeof(velodyne_msgs::VelodynePacket().data);
 
+  /** ancillary data space reserved for each received datagram */
+  static const size_t control_size = CMSG_SPACE(sizeof(struct timespec))
+    + CMSG_SPACE(sizeof(uint32_t));
+
   ////////////////////////////////////////////////////////////////////////
   // Input base class implementation
   ////////////////////////////////////////////////////////////////////////
@@ -59,6 +75,19 @@ namespace velodyne_driver
                       << devip_str_);
   }
 
+  /** @brief Get up to max_pkts velodyne packets (one at a time). */
+  int Input::getPackets(velodyne_msgs::VelodynePacket *pkts,
+                        int max_pkts, const double time_offset)
+  {
+    if (max_pkts <= 0)
+      return 0;
+
+    int rc = getPacket(&pkts[0], time_offset);
+    if (rc < 0)
+      return -1;                        // end of file
+    return (rc == 0)? 1: 0;
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // InputSocket class implementation
   ////////////////////////////////////////////////////////////////////////
@@ -69,7 +98,10 @@ namespace velodyne_driver
    *  @param port UDP port number
    */
   InputSocket::InputSocket(ros::NodeHandle private_nh, uint16_t port):
-    Input(private_nh, port)
+    Input(private_nh, port),
+    rcvbuf_size_(0),
+    kernel_drops_(0),
+    last_drop_count_(0)
   {
     sockfd_ = -1;
     
@@ -77,6 +109,23 @@ namespace velodyne_driver
       inet_aton(devip_str_.c_str(),&devip_);
     }    
 
+    // number of datagrams drained by each recvmmsg() call
+    private_nh.param("batch_size", batch_size_, 1);
+    if (batch_size_ < 1)
+      batch_size_ = 1;
+    if (batch_size_ > 1)
+      ROS_INFO_STREAM("Receiving up to " << batch_size_
+                      << " packets per system call");
+    msgs_.resize(batch_size_);
+    iovecs_.resize(batch_size_);
+    sender_addrs_.resize(batch_size_);
+
+    // stamp packets with the time the kernel received them
+    private_nh.param("kernel_time", kernel_time_, false);
+    if (kernel_time_ && gps_time_)
+      ROS_WARN("gps_time is set, ignoring kernel_time");
+    control_.resize(batch_size_ * control_size);
+
     // connect to Velodyne UDP port
     ROS_INFO_STREAM("Opening UDP socket: port " << port);
     sockfd_ = socket(PF_INET, SOCK_DGRAM, 0);
@@ -104,29 +153,218 @@ namespace velodyne_driver
         return;
       }
 
+    // size the receive buffer, so bursts do not overflow it
+    int rcvbuf_size;
+    private_nh.param("rcvbuf_size", rcvbuf_size, 0);
+    setReceiveBuffer(rcvbuf_size);
+
+    // have the kernel report how many datagrams it dropped
+    int enable = 1;
+    if (setsockopt(sockfd_, SOL_SOCKET, SO_RXQ_OVFL,
+                   &enable, sizeof(enable)) < 0)
+      ROS_WARN("SO_RXQ_OVFL not supported: %s, "
+               "kernel packet drops will not be reported", strerror(errno));
+
+    if (kernel_time_)
+      {
+        if (setsockopt(sockfd_, SOL_SOCKET, SO_TIMESTAMPNS,
+                       &enable, sizeof(enable)) < 0)
+          {
+            ROS_WARN("SO_TIMESTAMPNS not supported: %s, "
+                     "using system time stamps", strerror(errno));
+            kernel_time_ = false;
+          }
+        else
+          ROS_INFO("Stamping packets with kernel receive time");
+      }
+
+    // optionally receive through io_uring, else with recvmmsg()
+    bool use_io_uring;
+    private_nh.param("io_uring", use_io_uring, false);
+    if (use_io_uring)
+      {
+        if (initUring())
+          ROS_INFO("Receiving through io_uring multishot recvmsg");
+        else
+          ROS_WARN("io_uring input not available, using recvmmsg()");
+      }
+
     ROS_DEBUG("Velodyne socket fd is %d\n", sockfd_);
   }
 
   /** @brief destructor */
   InputSocket::~InputSocket(void)
   {
+    uring_.reset();                     // cancels pending receives
     (void) close(sockfd_);
   }
 
+  /** @brief Set the socket receive buffer size.
+   *
+   *  @param size requested size in bytes, 0 keeps the system default
+   */
+  void InputSocket::setReceiveBuffer(int size)
+  {
+    if (size > 0)
+      {
+        // SO_RCVBUF is capped by net.core.rmem_max, SO_RCVBUFFORCE
+        // is not, but needs CAP_NET_ADMIN.
+        if (setsockopt(sockfd_, SOL_SOCKET, SO_RCVBUFFORCE,
+                       &size, sizeof(size)) < 0
+            && setsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF,
+                          &size, sizeof(size)) < 0)
+          ROS_WARN("cannot set receive buffer size: %s", strerror(errno));
+      }
+
+    // the kernel doubles the value to account for its bookkeeping
+    socklen_t len = sizeof(rcvbuf_size_);
+    if (getsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF, &rcvbuf_size_, &len) < 0)
+      rcvbuf_size_ = 0;
+    else if (size > 0 && rcvbuf_size_ < size)
+      ROS_WARN("receive buffer limited to %d bytes, %d requested "
+               "(raise net.core.rmem_max)", rcvbuf_size_, size);
+    ROS_INFO("Velodyne socket receive buffer is %d bytes", rcvbuf_size_);
+  }
+
+  /** @brief Handle one ancillary data message of a datagram.
+   *
+   *  SO_RXQ_OVFL reports the socket's total (wrapping 32-bit) number
+   *  of dropped datagrams with each datagram received after a drop,
+   *  SCM_TIMESTAMPNS the time the kernel received the datagram.
+   *
+   *  @returns true if stamp was set
+   */
+  bool InputSocket::parseControl(const cmsghdr *cmsg, ros::Time *stamp)
+  {
+    if (cmsg->cmsg_level != SOL_SOCKET)
+      return false;
+
+    if (cmsg->cmsg_type == SO_RXQ_OVFL)
+      {
+        uint32_t count;
+        memcpy(&count, CMSG_DATA(cmsg), sizeof(count));
+        kernel_drops_ += (uint32_t) (count - last_drop_count_);
+        last_drop_count_ = count;
+      }
+    else if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+      {
+        struct timespec ts;
+        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+        *stamp = ros::Time(ts.tv_sec, ts.tv_nsec);
+        return true;
+      }
+    return false;
+  }
+
   /** @brief Get one velodyne packet. */
   int InputSocket::getPacket(velodyne_msgs::VelodynePacket *pkt, const double time_offset)
   {
-    const ros::Time time_start = ros::Time::now();
+    return (getPackets(pkt, 1, time_offset) == 1)? 0: 1;
+  }
+
+  /** @brief Get up to max_pkts velodyne packets.
+   *
+   *  Waits until at least one packet is available, then returns all
+   *  queued packets that fit in a batch, in arrival order.
+   */
+  int InputSocket::getPackets(velodyne_msgs::VelodynePacket *pkts,
+                              int max_pkts, const double time_offset)
+  {
+    // Read the clock only when the stamp comes from it.
+    const bool kernel_time = kernel_time_ && !gps_time_;
+    const ros::Time time_start =
+      (gps_time_ || kernel_time)? ros::Time(): ros::Time::now();
+
+    // io_uring completions are reaped in batches regardless
+    const int batch = uring_? max_pkts: std::min(max_pkts, batch_size_);
+    if (batch <= 0)
+      return 0;
+
+    int nread;
+    if (uring_)
+      nread = receiveUring(pkts, batch, kernel_time);
+    else
+      nread = receiveBatch(pkts, batch, kernel_time);
+
+    stampPackets(pkts, nread, time_start, kernel_time, time_offset);
+    return nread;
+  }
+
+  /** @brief Get the packets already queued on the socket.
+   *
+   *  Does not wait, so the caller can multiplex several sockets on
+   *  descriptor().  Always receives with recvmmsg().
+   *
+   *  @returns number of packets read, 0 if none was queued
+   */
+  int InputSocket::getAvailablePackets(velodyne_msgs::VelodynePacket *pkts,
+                                       int max_pkts, const double time_offset)
+  {
+    if (uring_)
+      {
+        ROS_WARN("io_uring input not used when multiplexing sockets");
+        uring_.reset();
+      }
+
+    const bool kernel_time = kernel_time_ && !gps_time_;
+    const ros::Time time_start =
+      (gps_time_ || kernel_time)? ros::Time(): ros::Time::now();
+
+    const int batch = std::min(max_pkts, batch_size_);
+    if (batch <= 0)
+      return 0;
+
+    int nread = recvBatch(pkts, batch, kernel_time);
+    if (nread < 0)
+      return 0;
+
+    stampPackets(pkts, nread, time_start, kernel_time, time_offset);
+    return nread;
+  }
+
+  /** @brief Set the stamps of freshly received packets.
+   *
+   *  @param time_start system time when receiving started
+   *  @param kernel_time packets already hold their kernel receive time
+   */
+  void InputSocket::stampPackets(velodyne_msgs::VelodynePacket *pkts,
+                                 int npkts, const ros::Time &time_start,
+                                 bool kernel_time, const double time_offset)
+  {
+    for (int i = 0; i < npkts; ++i)
+      {
+        if (kernel_time) {
+          // The packet already holds the time the kernel received
+          // it, which does not depend on when this thread got to run.
+          pkts[i].stamp = pkts[i].stamp + ros::Duration(time_offset);
+        } else if (!gps_time_) {
+          // Set the packet stamp to the (ros-system) time when we started receiving the packet.
+          // At this point we also add the configurable time offset which account for network delay.
+          // The individual return's time stamps are adjusted further later to account for the difference
+          // between the packet stamp and their actual time (based on firing speed & points / packet).
+          pkts[i].stamp = time_start + ros::Duration(time_offset);
+        } else {
+          // time for each packet is a 4 byte uint located starting at offset 1200 in
+          // the data packet
+          pkts[i].stamp = rosTimeFromGpsTimestamp(&(pkts[i].data[1200]));
+        }
+      }
+  }
 
+  /** @brief Wait for packets, then receive a batch with recvmmsg().
+   *
+   *  @returns number of packets read, 0 on timeout or error
+   */
+  int InputSocket::receiveBatch(velodyne_msgs::VelodynePacket *pkts,
+                                int batch, bool kernel_time)
+  {
     struct pollfd fds[1];
     fds[0].fd = sockfd_;
     fds[0].events = POLLIN;
     static const int POLL_TIMEOUT = 1000; // one second (in msec)
 
-    sockaddr_in sender_address;
-    socklen_t sender_address_len = sizeof(sender_address);
-
-    while (true)
+    int nread = 0;
+    while (nread == 0)
       {
         // Unfortunately, the Linux kernel recvfrom() implementation
         // uses a non-interruptible sleep() when waiting for data,
@@ -153,67 +391,597 @@ namespace velodyne_driver
               {
                 if (errno != EINTR)
                   ROS_ERROR("poll() error: %s", strerror(errno));
-                return 1;
+                return 0;
               }
             if (retval == 0)            // poll() timeout?
               {
                 ROS_WARN("Velodyne poll() timeout");
-                return 1;
+                return 0;
               }
             if ((fds[0].revents & POLLERR)
                 || (fds[0].revents & POLLHUP)
                 || (fds[0].revents & POLLNVAL)) // device error?
               {
                 ROS_ERROR("poll() reports Velodyne error");
-                return 1;
+                return 0;
               }
           } while ((fds[0].revents & POLLIN) == 0);
 
-        // Receive packets that should now be available from the
-        // socket using a blocking read.
-        ssize_t nbytes = recvfrom(sockfd_, &pkt->data[0],
-                                  packet_size,  0,
-                                  (sockaddr*) &sender_address,
-                                  &sender_address_len);
+        nread = recvBatch(pkts, batch, kernel_time);
+        if (nread < 0)
+          return 0;
+      }
+
+    return nread;
+  }
+
+  /** @brief Receive a batch of packets with recvmmsg(), without waiting.
+   *
+   *  Drains as many queued datagrams as fit in the batch with a
+   *  single call, writing them directly into consecutive pkts slots.
+   *  Datagrams of the wrong size or from another device are squeezed
+   *  out, so the slots returned stay in arrival order.
+   *
+   *  @returns number of packets read, -1 on error
+   */
+  int InputSocket::recvBatch(velodyne_msgs::VelodynePacket *pkts,
+                             int batch, bool kernel_time)
+  {
+    // Point each message of the batch at its packet slot.
+    for (int i = 0; i < batch; ++i)
+      {
+        iovecs_[i].iov_base = &pkts[i].data[0];
+        iovecs_[i].iov_len = packet_size;
+        memset(&msgs_[i].msg_hdr, 0, sizeof(msgs_[i].msg_hdr));
+        msgs_[i].msg_hdr.msg_name = &sender_addrs_[i];
+        msgs_[i].msg_hdr.msg_namelen = sizeof(sender_addrs_[i]);
+        msgs_[i].msg_hdr.msg_iov = &iovecs_[i];
+        msgs_[i].msg_hdr.msg_iovlen = 1;
+        msgs_[i].msg_hdr.msg_control = &control_[i * control_size];
+        msgs_[i].msg_hdr.msg_controllen = control_size;
+        msgs_[i].msg_len = 0;
+      }
+
+    // Receive all packets that are now available from the
+    // socket, without blocking for more.
+    int nmsgs = recvmmsg(sockfd_, &msgs_[0], batch, MSG_DONTWAIT, NULL);
+
+    if (nmsgs < 0)
+      {
+        if (errno != EWOULDBLOCK)
+          {
+            perror("recvfail");
+            ROS_INFO("recvfail");
+            return -1;
+          }
+        return 0;
+      }
+
+    int nread = 0;
+    for (int i = 0; i < nmsgs; ++i)
+      {
+        msghdr *msg = &msgs_[i].msg_hdr;
+        ros::Time stamp;
+        bool stamped = false;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(msg, cmsg))
+          stamped |= parseControl(cmsg, &stamp);
+
+        if ((size_t) msgs_[i].msg_len != packet_size)
+          {
+            ROS_INFO_STREAM("incomplete Velodyne packet read: "
+                            << msgs_[i].msg_len << " bytes");
+            continue;
+          }
+
+        // if packet is not from the lidar scanner we selected by
+        // IP, skip it
+        if (devip_str_ != ""
+            && sender_addrs_[i].sin_addr.s_addr != devip_.s_addr)
+          continue;
+
+        // keep accepted packets contiguous and in arrival order
+        if (nread != i)
+          pkts[nread].data = pkts[i].data;
+        if (kernel_time)
+          pkts[nread].stamp = stamped? stamp: ros::Time::now();
+        ++nread;
+      }
+
+    return nread;
+  }
+
+#ifdef HAVE_LIBURING
+
+  /** buffer group of the provided receive buffers */
+  static const int URING_BUF_GROUP = 0;
+
+  /** @brief io_uring state of an InputSocket. */
+  struct InputSocket::Uring
+  {
+    Uring():
+      queue_ok(false),
+      buf_ring(NULL),
+      buf_count(1024),
+      buf_size(2048),
+      armed(false),
+      completed(false)
+    {
+      memset(&msg, 0, sizeof(msg));
+    }
+
+    ~Uring()
+    {
+      if (buf_ring != NULL)
+        io_uring_free_buf_ring(&ring, buf_ring, buf_count, URING_BUF_GROUP);
+      if (queue_ok)
+        io_uring_queue_exit(&ring);
+    }
+
+    io_uring ring;
+    bool queue_ok;                      ///< ring was set up
+    io_uring_buf_ring *buf_ring;        ///< provided buffer ring
+    std::vector<uint8_t> buffers;       ///< storage of provided buffers
+    unsigned buf_count;
+    unsigned buf_size;
+    msghdr msg;                         ///< layout of each buffer
+    bool armed;                         ///< multishot receive pending
+    bool completed;                     ///< a receive ever succeeded
+  };
+
+  /** @brief Set up io_uring for receiving.
+   *
+   *  A single multishot recvmsg request, once submitted, keeps
+   *  completing with one datagram per kernel-selected buffer from the
+   *  provided buffer ring.
+   *
+   *  @returns false if the kernel does not support it
+   */
+  bool InputSocket::initUring(void)
+  {
+    boost::shared_ptr<Uring> uring(new Uring());
+
+    int rc = io_uring_queue_init(64, &uring->ring, 0);
+    if (rc < 0)
+      {
+        ROS_WARN("io_uring not available: %s", strerror(-rc));
+        return false;
+      }
+    uring->queue_ok = true;
+
+    uring->buf_ring = io_uring_setup_buf_ring(&uring->ring, uring->buf_count,
+                                              URING_BUF_GROUP, 0, &rc);
+    if (uring->buf_ring == NULL)
+      {
+        ROS_WARN("io_uring provided buffer rings not available: %s",
+                 strerror(-rc));
+        return false;
+      }
+
+    uring->buffers.resize(uring->buf_count * uring->buf_size);
+    const int mask = io_uring_buf_ring_mask(uring->buf_count);
+    for (unsigned i = 0; i < uring->buf_count; ++i)
+      io_uring_buf_ring_add(uring->buf_ring,
+                            &uring->buffers[i * uring->buf_size],
+                            uring->buf_size, i, mask, i);
+    io_uring_buf_ring_advance(uring->buf_ring, uring->buf_count);
+
+    // each buffer receives the sender address and ancillary data
+    // ahead of the payload
+    uring->msg.msg_namelen = sizeof(sockaddr_in);
+    uring->msg.msg_controllen = control_size;
+
+    uring_ = uring;
+    return true;
+  }
+
+  /** @brief Receive a batch of packets from io_uring completions.
+   *
+   *  Reaps up to batch completions of the multishot receive at once
+   *  and returns their buffers to the kernel right away.  If the
+   *  kernel rejects multishot recvmsg, falls back to recvmmsg().
+   *
+   *  @returns number of packets read, 0 on timeout or error
+   */
+  int InputSocket::receiveUring(velodyne_msgs::VelodynePacket *pkts,
+                                int batch, bool kernel_time)
+  {
+    Uring &u = *uring_;
+    static const int MAX_CQES = 64;
+    io_uring_cqe *cqes[MAX_CQES];
+    const int mask = io_uring_buf_ring_mask(u.buf_count);
+
+    int nread = 0;
+    while (nread == 0)
+      {
+        if (!u.armed)
+          {
+            io_uring_sqe *sqe = io_uring_get_sqe(&u.ring);
+            io_uring_prep_recvmsg_multishot(sqe, sockfd_, &u.msg, 0);
+            sqe->flags |= IOSQE_BUFFER_SELECT;
+            sqe->buf_group = URING_BUF_GROUP;
+            io_uring_submit(&u.ring);
+            u.armed = true;
+          }
+
+        io_uring_cqe *cqe;
+        __kernel_timespec timeout;
+        timeout.tv_sec = 1;             // one second
+        timeout.tv_nsec = 0;
+        int rc = io_uring_wait_cqe_timeout(&u.ring, &cqe, &timeout);
+        if (rc == -ETIME)
+          {
+            ROS_WARN("Velodyne io_uring timeout");
+            return 0;
+          }
+        if (rc < 0)
+          {
+            if (rc != -EINTR)
+              ROS_ERROR("io_uring wait error: %s", strerror(-rc));
+            return 0;
+          }
+
+        bool unsupported = false;
+        unsigned count = io_uring_peek_batch_cqe(&u.ring, cqes,
+                                                 std::min(batch, MAX_CQES));
+        for (unsigned c = 0; c < count; ++c)
+          {
+            cqe = cqes[c];
+            if ((cqe->flags & IORING_CQE_F_MORE) == 0)
+              u.armed = false;          // resubmit next time
+
+            if (cqe->res < 0)
+              {
+                if (!u.completed && cqe->res == -EINVAL)
+                  unsupported = true;
+                else if (cqe->res != -ENOBUFS)
+                  ROS_ERROR("io_uring receive error: %s",
+                            strerror(-cqe->res));
+                continue;
+              }
+            u.completed = true;
+            if ((cqe->flags & IORING_CQE_F_BUFFER) == 0)
+              continue;
+
+            unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            uint8_t *buf = &u.buffers[bid * u.buf_size];
+            io_uring_recvmsg_out *out =
+              io_uring_recvmsg_validate(buf, cqe->res, &u.msg);
+            if (out != NULL)
+              {
+                ros::Time stamp;
+                bool stamped = false;
+                for (cmsghdr *cmsg = io_uring_recvmsg_cmsg_firsthdr(out, &u.msg);
+                     cmsg != NULL;
+                     cmsg = io_uring_recvmsg_cmsg_nexthdr(out, &u.msg, cmsg))
+                  stamped |= parseControl(cmsg, &stamp);
+
+                const sockaddr_in *sender =
+                  (const sockaddr_in *) io_uring_recvmsg_name(out);
+                unsigned len =
+                  io_uring_recvmsg_payload_length(out, cqe->res, &u.msg);
+
+                if (len != packet_size)
+                  ROS_INFO_STREAM("incomplete Velodyne packet read: "
+                                  << len << " bytes");
+                else if (devip_str_ != ""
+                         && sender->sin_addr.s_addr != devip_.s_addr)
+                  ;                     // not from the selected device
+                else
+                  {
+                    memcpy(&pkts[nread].data[0],
+                           io_uring_recvmsg_payload(out, &u.msg),
+                           packet_size);
+                    if (kernel_time)
+                      pkts[nread].stamp = stamped? stamp: ros::Time::now();
+                    ++nread;
+                  }
+              }
+
+            // hand the buffer back to the kernel
+            io_uring_buf_ring_add(u.buf_ring, buf, u.buf_size, bid, mask, 0);
+            io_uring_buf_ring_advance(u.buf_ring, 1);
+          }
+        io_uring_cq_advance(&u.ring, count);
+
+        if (unsupported)
+          {
+            ROS_WARN("multishot recvmsg not supported by this kernel, "
+                     "falling back to recvmmsg()");
+            uring_.reset();
+            return receiveBatch(pkts, batch, kernel_time);
+          }
+      }
+
+    return nread;
+  }
+
+#else // HAVE_LIBURING
+
+  struct InputSocket::Uring {};
+
+  bool InputSocket::initUring(void)
+  {
+    ROS_WARN("built without liburing, io_uring input not available");
+    return false;
+  }
+
+  int InputSocket::receiveUring(velodyne_msgs::VelodynePacket *pkts,
+                                int batch, bool kernel_time)
+  {
+    return receiveBatch(pkts, batch, kernel_time);
+  }
+
+#endif // HAVE_LIBURING
+
+  ////////////////////////////////////////////////////////////////////////
+  // InputPacketMmap class implementation
+  ////////////////////////////////////////////////////////////////////////
+
+  /** @brief constructor
+   *
+   *  @param private_nh ROS private handle for calling node.
+   *  @param port UDP port number
+   *  @param interface network interface receiving the device packets
+   */
+  InputPacketMmap::InputPacketMmap(ros::NodeHandle private_nh, uint16_t port,
+                                   std::string interface):
+    Input(private_nh, port),
+    fd_(-1),
+    interface_(interface),
+    ring_(NULL),
+    ring_size_(0),
+    current_block_(0),
+    frame_(NULL),
+    frames_left_(0),
+    drops_(0)
+  {
+    // ring geometry: blocks are retired to user space when full or
+    // after the timeout, whichever comes first
+    int block_timeout;
+    private_nh.param("ring_block_size", block_size_, 1 << 20);
+    private_nh.param("ring_block_count", block_count_, 64);
+    private_nh.param("ring_block_timeout", block_timeout, 10); // msec
+    const int frame_size = 2048;        // one Ethernet frame
+
+    ROS_INFO_STREAM("Opening packet ring on " << interface_
+                    << ": port " << port);
+    fd_ = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+    if (fd_ == -1)
+      {
+        ROS_ERROR("packet socket: %s (needs CAP_NET_RAW)", strerror(errno));
+        return;
+      }
+
+    int version = TPACKET_V3;
+    if (setsockopt(fd_, SOL_PACKET, PACKET_VERSION,
+                   &version, sizeof(version)) < 0)
+      {
+        ROS_ERROR("TPACKET_V3 not supported: %s", strerror(errno));
+        return;
+      }
+
+    // filter before binding, so no other traffic enters the ring
+    if (!attachFilter())
+      return;
+
+    tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_size_;
+    req.tp_block_nr = block_count_;
+    req.tp_frame_size = frame_size;
+    req.tp_frame_nr = (block_size_ / frame_size) * block_count_;
+    req.tp_retire_blk_tov = block_timeout;
+    if (setsockopt(fd_, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+      {
+        ROS_ERROR("PACKET_RX_RING: %s", strerror(errno));
+        return;
+      }
+
+    ring_size_ = block_size_ * block_count_;
+    void *ring = mmap(NULL, ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd_, 0);
+    if (ring == MAP_FAILED)
+      {
+        ROS_ERROR("mmap packet ring: %s", strerror(errno));
+        ring_size_ = 0;
+        return;
+      }
+    ring_ = (uint8_t *) ring;
+
+    sockaddr_ll ll;
+    memset(&ll, 0, sizeof(ll));
+    ll.sll_family = AF_PACKET;
+    ll.sll_protocol = htons(ETH_P_IP);
+    ll.sll_ifindex = if_nametoindex(interface_.c_str());
+    if (ll.sll_ifindex == 0)
+      {
+        ROS_ERROR_STREAM("unknown network interface: " << interface_);
+        return;
+      }
+    if (bind(fd_, (sockaddr *) &ll, sizeof(ll)) == -1)
+      {
+        ROS_ERROR("bind packet socket: %s", strerror(errno));
+        return;
+      }
+
+    ROS_INFO("Velodyne packet ring: %d blocks of %d bytes",
+             block_count_, block_size_);
+  }
+
+  /** @brief destructor */
+  InputPacketMmap::~InputPacketMmap(void)
+  {
+    if (ring_ != NULL)
+      munmap(ring_, ring_size_);
+    (void) close(fd_);
+  }
+
+  /** @brief Attach a BPF program selecting the device packets.
+   *
+   *  The program is compiled by libpcap from the same filter
+   *  expression InputPCAP uses.
+   */
+  bool InputPacketMmap::attachFilter(void)
+  {
+    std::stringstream filter;
+    if( devip_str_ != "" )              // using specific IP?
+      {
+        filter << "src host " << devip_str_ << " && ";
+      }
+    filter << "udp dst port " << port_;
+
+    bpf_program program;
+    if (pcap_compile_nopcap(65535, DLT_EN10MB, &program,
+                            filter.str().c_str(), 1,
+                            PCAP_NETMASK_UNKNOWN) < 0)
+      {
+        ROS_ERROR_STREAM("cannot compile packet filter: " << filter.str());
+        return false;
+      }
+
+    sock_fprog fprog;
+    fprog.len = program.bf_len;
+    fprog.filter = (sock_filter *) program.bf_insns;
+    int rc = setsockopt(fd_, SOL_SOCKET, SO_ATTACH_FILTER,
+                        &fprog, sizeof(fprog));
+    pcap_freecode(&program);
+    if (rc < 0)
+      {
+        ROS_ERROR("SO_ATTACH_FILTER: %s", strerror(errno));
+        return false;
+      }
+    return true;
+  }
+
+  /** @brief Hand the current block back to the kernel. */
+  void InputPacketMmap::releaseBlock(void)
+  {
+    tpacket_block_desc *block =
+      (tpacket_block_desc *) (ring_ + current_block_ * block_size_);
+    __sync_synchronize();               // finish reading before release
+    block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    current_block_ = (current_block_ + 1) % block_count_;
+    frame_ = NULL;
+  }
+
+  /** @brief Get one velodyne packet. */
+  int InputPacketMmap::getPacket(velodyne_msgs::VelodynePacket *pkt,
+                                 const double time_offset)
+  {
+    return (getPackets(pkt, 1, time_offset) == 1)? 0: 1;
+  }
+
+  /** @brief Get up to max_pkts velodyne packets.
+   *
+   *  Walks the frames of the current ring block, which stays owned
+   *  by user space until all its frames were read.  Only waits in
+   *  poll() when the kernel has not retired the next block yet.
+   */
+  int InputPacketMmap::getPackets(velodyne_msgs::VelodynePacket *pkts,
+                                  int max_pkts, const double time_offset)
+  {
+    if (ring_ == NULL)
+      {
+        usleep(100000);                 // device never opened
+        return 0;
+      }
+
+    static const int POLL_TIMEOUT = 1000; // one second (in msec)
+    int nread = 0;
 
-        if (nbytes < 0)
+    while (nread < max_pkts)
+      {
+        tpacket_block_desc *block =
+          (tpacket_block_desc *) (ring_ + current_block_ * block_size_);
+
+        if (frame_ == NULL)
           {
-            if (errno != EWOULDBLOCK)
+            if ((block->hdr.bh1.block_status & TP_STATUS_USER) == 0)
               {
-                perror("recvfail");
-                ROS_INFO("recvfail");
-                return 1;
+                if (nread > 0)
+                  break;                // return what we have
+
+                struct pollfd fds[1];
+                fds[0].fd = fd_;
+                fds[0].events = POLLIN | POLLERR;
+                int retval = poll(fds, 1, POLL_TIMEOUT);
+                if (retval < 0)
+                  {
+                    if (errno != EINTR)
+                      ROS_ERROR("poll() error: %s", strerror(errno));
+                    return 0;
+                  }
+                if (retval == 0)
+                  {
+                    ROS_WARN("Velodyne poll() timeout");
+                    return 0;
+                  }
+                continue;
               }
+            __sync_synchronize();       // block status before contents
+            frame_ = (uint8_t *) block + block->hdr.bh1.offset_to_first_pkt;
+            frames_left_ = block->hdr.bh1.num_pkts;
           }
-        else if ((size_t) nbytes == packet_size)
+
+        while (frames_left_ > 0 && nread < max_pkts)
           {
-            // read successful,
-            // if packet is not from the lidar scanner we selected by IP,
-            // continue otherwise we are done
-            if(devip_str_ != ""
-               && sender_address.sin_addr.s_addr != devip_.s_addr)
+            const tpacket3_hdr *hdr = (const tpacket3_hdr *) frame_;
+            const uint8_t *data = frame_ + hdr->tp_mac;
+            const uint8_t *end = data + hdr->tp_snaplen;
+            frame_ += hdr->tp_next_offset;
+            --frames_left_;
+
+            // find the UDP payload: Ethernet, optional VLAN tag, IPv4
+            // header of variable length, UDP header
+            size_t offset = 12;
+            if (data + offset + 2 > end)
+              continue;
+            if (data[offset] == 0x81 && data[offset + 1] == 0x00)
+              offset += 4;
+            offset += 2;
+            if (data + offset + 1 > end)
               continue;
+            offset += (data[offset] & 0x0f) * 4 + 8;
+            if (data + offset + packet_size != end)
+              {
+                ROS_INFO_STREAM("incomplete Velodyne packet read: "
+                                << (end - data - (long) offset) << " bytes");
+                continue;
+              }
+
+            memcpy(&pkts[nread].data[0], data + offset, packet_size);
+            if (!gps_time_)
+              {
+                // the kernel stamped the frame when it arrived
+                pkts[nread].stamp = ros::Time(hdr->tp_sec, hdr->tp_nsec)
+                  + ros::Duration(time_offset);
+              }
             else
-              break; //done
+              {
+                pkts[nread].stamp =
+                  rosTimeFromGpsTimestamp(&(pkts[nread].data[1200]));
+              }
+            ++nread;
           }
 
-        ROS_INFO_STREAM("incomplete Velodyne packet read: "
-                         << nbytes << " bytes");
+        if (frames_left_ == 0)
+          releaseBlock();
       }
 
-    if (!gps_time_) {
-      // Set the packet stamp to the (ros-system) time when we started receiving the packet.
-      // At this point we also add the configurable time offset which account for network delay.
-      // The individual return's time stamps are adjusted further later to account for the difference
-      // between the packet stamp and their actual time (based on firing speed & points / packet).
-      pkt->stamp = time_start + ros::Duration(time_offset);
-    } else {
-      // time for each packet is a 4 byte uint located starting at offset 1200 in
-      // the data packet
-      pkt->stamp = rosTimeFromGpsTimestamp(&(pkt->data[1200]));
-    }
+    return nread;
+  }
 
-    return 0;
+  /** @brief Frames dropped because the ring was full. */
+  uint64_t InputPacketMmap::droppedPackets() const
+  {
+    // reading the statistics resets the kernel counters
+    tpacket_stats_v3 stats;
+    socklen_t len = sizeof(stats);
+    if (fd_ >= 0
+        && getsockopt(fd_, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == 0)
+      drops_ += stats.tp_drops;
+    return drops_;
   }
 
   ////////////////////////////////////////////////////////////////////////
@@ -232,105 +1000,373 @@ namespace velodyne_driver
                        bool read_once, bool read_fast, double repeat_delay):
     Input(private_nh, port),
     packet_rate_(packet_rate),
-    filename_(filename)
+    filename_(filename),
+    anchored_(false),
+    anchor_ns_(0),
+    last_ns_(0),
+    synthetic_ns_(0),
+    pending_ns_(0),
+    have_pending_(false),
+    restarted_(false),
+    seek_pending_(false),
+    seek_by_time_(false),
+    seek_file_(0),
+    seek_time_ns_(0),
+    seek_revolution_(0)
   {
-    pcap_ = NULL;  
     empty_ = true;
 
     // get parameters using private node handle
     private_nh.param("read_once", read_once_, false);
     private_nh.param("read_fast", read_fast_, false);
     private_nh.param("repeat_delay", repeat_delay_, 0.0);
+    private_nh.param("replay_speed", replay_speed_, 1.0);
+    private_nh.param("pcap_time", pcap_time_, false);
+    private_nh.param("index_interval", index_interval_, 1000);
 
     if (read_once_)
       ROS_INFO("Read input file only once.");
     if (read_fast_)
+      replay_speed_ = 0.0;
+    if (replay_speed_ < 0.0)
+      {
+        ROS_WARN("negative replay_speed %.3f, using 1.0", replay_speed_);
+        replay_speed_ = 1.0;
+      }
+    if (replay_speed_ == 0.0)
       ROS_INFO("Read input file as quickly as possible.");
+    else if (replay_speed_ != 1.0)
+      ROS_INFO("Replay input file at %.3f times its recorded rate.",
+               replay_speed_);
+    if (pcap_time_)
+      ROS_INFO("Stamp packets with their capture time.");
     if (repeat_delay_ > 0.0)
       ROS_INFO("Delay %.3f seconds before repeating input file.",
                repeat_delay_);
 
-    // Open the PCAP dump file
+    if (!devip_str_.empty())
+      inet_aton(devip_str_.c_str(), &devip_);
+
+    // Map the PCAP dump file, or the first of several
     ROS_INFO("Opening PCAP file \"%s\"", filename_.c_str());
-    if ((pcap_ = pcap_open_offline(filename_.c_str(), errbuf_) ) == NULL)
+    if (!files_.open(filename_))
       {
         ROS_FATAL("Error opening Velodyne socket dump file.");
         return;
       }
+    indexes_.resize(files_.size());
 
-    std::stringstream filter;
-    if( devip_str_ != "" )              // using specific IP?
-      {
-        filter << "src host " << devip_str_ << " && ";
-      }
-    filter << "udp dst port " << port;
-    pcap_compile(pcap_, &pcap_packet_filter_,
-                 filter.str().c_str(), 1, PCAP_NETMASK_UNKNOWN);
+    // optionally start somewhere later in the file
+    double seek_time;
+    int seek_revolution;
+    private_nh.param("seek_time", seek_time, 0.0);
+    private_nh.param("seek_revolution", seek_revolution, 0);
+    if (seek_revolution > 0)
+      seekRevolution(seek_revolution);
+    else if (seek_time > 0.0)
+      seekTime(seek_time);
   }
 
   /** destructor */
   InputPCAP::~InputPCAP(void)
   {
-    pcap_close(pcap_);
   }
 
   /** @brief Get one velodyne packet. */
   int InputPCAP::getPacket(velodyne_msgs::VelodynePacket *pkt, const double time_offset)
   {
-    struct pcap_pkthdr *header;
-    const u_char *pkt_data;
+    return (getPackets(pkt, 1, time_offset) < 0)? -1: 0;
+  }
+
+  /** @brief Get the velodyne packets that are due.
+   *
+   *  Replay follows the record time stamps: the first packet waits
+   *  until it is due, then all following packets already due are
+   *  returned with it.  Packets are stamped with the time they are
+   *  due, which is the system time the device would have sent them,
+   *  or with their capture time if pcap_time is set.
+   *
+   *  @returns number of packets read, -1 if end of file
+   */
+  int InputPCAP::getPackets(velodyne_msgs::VelodynePacket *pkts,
+                            int max_pkts, const double time_offset)
+  {
+    if (seek_pending_)
+      applySeek();
 
-    while (true)
+    int npkts = 0;
+    while (npkts < max_pkts)
       {
-        int res;
-        if ((res = pcap_next_ex(pcap_, &header, &pkt_data)) >= 0)
+        if (!have_pending_)
           {
-            // Skip packets not for the correct port and from the
-            // selected IP address.
-            if (!devip_str_.empty() &&
-                (0 == pcap_offline_filter(&pcap_packet_filter_,
-                                          header, pkt_data)))
-              continue;
+            if (!nextRecord(&pending_))
+              {
+                if (npkts > 0)          // deliver what we have first
+                  break;
+                if (!restart())
+                  return -1;
+                continue;
+              }
+            // time it once, it may be checked again before it is due
+            pending_ns_ = recordTime(pending_);
+            have_pending_ = true;
+          }
 
-            // Keep the reader from blowing through the file.
-            if (read_fast_ == false)
-              packet_rate_.sleep();
-            
-            memcpy(&pkt->data[0], pkt_data+42, packet_size);
-            pkt->stamp = ros::Time::now(); // time_offset not considered here, as no synchronization required
-            empty_ = false;
-            return 0;                   // success
+        const uint64_t record_ns = pending_ns_;
+        if (!anchored_ || record_ns < last_ns_)
+          {
+            // start of replay, or time went backwards
+            anchored_ = true;
+            anchor_ns_ = record_ns;
+            anchor_wall_ = ros::WallTime::now();
+            anchor_stamp_ = ros::Time::now();
           }
+        last_ns_ = record_ns;
 
-        if (empty_)                 // no data in file?
+        ros::Time stamp;
+        if (replay_speed_ > 0.0)
           {
-            ROS_WARN("Error %d reading Velodyne packet: %s", 
-                     res, pcap_geterr(pcap_));
-            return -1;
+            const double elapsed =
+              (record_ns - anchor_ns_) * 1e-9 / replay_speed_;
+            const ros::WallTime due =
+              anchor_wall_ + ros::WallDuration(elapsed);
+            const ros::WallTime now = ros::WallTime::now();
+            if (due > now)
+              {
+                if (npkts > 0)          // not due yet, return others
+                  break;
+                (due - now).sleep();
+              }
+            stamp = anchor_stamp_ + ros::Duration(elapsed);
+          }
+        else
+          {
+            stamp = ros::Time::now();
           }
 
-        if (read_once_)
+        if (pcap_time_)
           {
-            ROS_INFO("end of file reached -- done reading.");
-            return -1;
+            stamp.fromNSec(record_ns);
+            stamp += ros::Duration(time_offset);
+          }
+
+        memcpy(&pkts[npkts].data[0], pending_.data, packet_size);
+        pkts[npkts].stamp = stamp;
+        have_pending_ = false;
+        ++npkts;
+      }
+
+    return npkts;
+  }
+
+  /** @brief Load or build the index of the file, once.
+   *
+   *  Must be called with seek_mutex_ held.
+   */
+  bool InputPCAP::openIndex(size_t file)
+  {
+    boost::shared_ptr<PcapIndex> &index = indexes_[file];
+    if (index)
+      return !index->empty();
+
+    PcapIndex::Filter filter;
+    filter.port = port_;
+    filter.src_addr = devip_str_.empty()? 0: devip_.s_addr;
+    filter.packet_size = packet_size;
+    filter.interval = std::max(index_interval_, 1);
+
+    // the index reads the file through its own mapping
+    index.reset(new PcapIndex);
+    if (!index->open(files_.name(file), filter))
+      return false;
+    return !index->empty();
+  }
+
+  bool InputPCAP::seekTime(double seconds)
+  {
+    boost::lock_guard<boost::mutex> lock(seek_mutex_);
+    if (files_.size() == 0 || seconds < 0.0)
+      return false;
+
+    // the file holding that time, from the start of the first file
+    const uint64_t time_ns = files_.startTime(0) + (uint64_t) (seconds * 1e9);
+    const size_t file = files_.findTime(time_ns);
+    if (!openIndex(file))
+      return false;
+
+    if (file + 1 == files_.size() && time_ns > indexes_[file]->endTime())
+      {
+        ROS_WARN("cannot seek to %.3f s, capture lasts %.3f s", seconds,
+                 (indexes_[file]->endTime() - files_.startTime(0)) * 1e-9);
+        return false;
+      }
+
+    ROS_INFO("seeking to %.3f s", seconds);
+    seek_by_time_ = true;
+    seek_file_ = file;
+    seek_time_ns_ = time_ns;
+    seek_pending_ = true;
+    return true;
+  }
+
+  bool InputPCAP::seekRevolution(uint32_t revolution)
+  {
+    boost::lock_guard<boost::mutex> lock(seek_mutex_);
+    if (files_.size() != 1)
+      {
+        ROS_WARN("seeking by revolution needs a single input file");
+        return false;
+      }
+    if (!openIndex(0))
+      return false;
+
+    if (revolution > indexes_[0]->lastRevolution())
+      {
+        ROS_WARN("cannot seek to revolution %u, capture has %u",
+                 revolution, indexes_[0]->lastRevolution() + 1);
+        return false;
+      }
+
+    ROS_INFO("seeking to revolution %u", revolution);
+    seek_by_time_ = false;
+    seek_file_ = 0;
+    seek_revolution_ = revolution;
+    seek_pending_ = true;
+    return true;
+  }
+
+  /** @brief Move the reader to the requested position.
+   *
+   *  Jumps to the closest index entry before it, then reads forward
+   *  to the first packet at or after the requested time, or to the
+   *  azimuth wrap starting the requested revolution.
+   */
+  void InputPCAP::applySeek()
+  {
+    boost::lock_guard<boost::mutex> lock(seek_mutex_);
+    seek_pending_ = false;
+
+    const PcapIndex &index = *indexes_[seek_file_];
+    const PcapIndex::Entry *entry = seek_by_time_?
+      index.findTime(seek_time_ns_):
+      index.findRevolution(seek_revolution_);
+    if (entry == NULL
+        || !files_.seek(seek_file_, entry->offset, entry->section))
+      {
+        ROS_WARN("seek failed, continuing where we were");
+        return;
+      }
+
+    uint32_t revolution = entry->revolution;
+    bool started = false;
+    uint16_t last_azimuth = 0;
+    have_pending_ = false;
+    while (nextRecord(&pending_))
+      {
+        if (seek_by_time_)
+          {
+            if (pending_.time_ns >= seek_time_ns_)
+              {
+                have_pending_ = true;
+                break;
+              }
+            continue;
           }
-        
-        if (repeat_delay_ > 0.0)
+
+        const uint16_t azimuth = PcapIndex::packetAzimuth(pending_.data);
+        if (started && azimuth < last_azimuth)
+          ++revolution;
+        started = true;
+        last_azimuth = azimuth;
+        if (revolution >= seek_revolution_)
           {
-            ROS_INFO("end of file reached -- delaying %.3f seconds.",
-                     repeat_delay_);
-            usleep(rint(repeat_delay_ * 1000000.0));
+            have_pending_ = true;
+            break;
           }
+      }
+    if (have_pending_)
+      pending_ns_ = recordTime(pending_);
+
+    // pace the replay from the new position
+    anchored_ = false;
+    restarted_ = true;
+  }
+
+  /** @brief Tell whether the last packets read started over. */
+  bool InputPCAP::restarted()
+  {
+    const bool restarted = restarted_;
+    restarted_ = false;
+    return restarted;
+  }
+
+  /** @brief Read the next record of a Velodyne packet.
+   *
+   *  @returns false at end of file
+   */
+  bool InputPCAP::nextRecord(PcapRecord *rec)
+  {
+    while (files_.next(rec))
+      {
+        // Skip packets not for the correct port, of the wrong
+        // size, or not from the selected IP address.
+        if (rec->dst_port != port_ || rec->length != packet_size)
+          continue;
+        if (!devip_str_.empty() && rec->src_addr != devip_.s_addr)
+          continue;
+        empty_ = false;
+        return true;
+      }
+    return false;
+  }
+
+  /** @brief Record time in nanoseconds.
+   *
+   *  Records without a time stamp are spaced by the nominal packet
+   *  rate instead.
+   */
+  uint64_t InputPCAP::recordTime(const PcapRecord &rec)
+  {
+    if (rec.time_ns != 0 || packet_rate_ <= 0.0)
+      return rec.time_ns;
+    synthetic_ns_ += (uint64_t) (1e9 / packet_rate_);
+    return synthetic_ns_;
+  }
+
+  /** @brief Start the file over at end of file.
+   *
+   *  @returns false if done reading
+   */
+  bool InputPCAP::restart()
+  {
+    if (empty_)                 // no data in file?
+      {
+        ROS_WARN("No Velodyne packets in %s", filename_.c_str());
+        return false;
+      }
 
-        ROS_DEBUG("replaying Velodyne dump file");
+    if (read_once_)
+      {
+        ROS_INFO("end of file reached -- done reading.");
+        return false;
+      }
 
-        // I can't figure out how to rewind the file, because it
-        // starts with some kind of header.  So, close the file
-        // and reopen it with pcap.
-        pcap_close(pcap_);
-        pcap_ = pcap_open_offline(filename_.c_str(), errbuf_);
-        empty_ = true;              // maybe the file disappeared?
-      } // loop back and try again
+    if (repeat_delay_ > 0.0)
+      {
+        ROS_INFO("end of file reached -- delaying %.3f seconds.",
+                 repeat_delay_);
+        usleep(rint(repeat_delay_ * 1000000.0));
+      }
+
+    ROS_DEBUG("replaying Velodyne dump file");
+
+    // The file stays mapped, so start over from its first record,
+    // and pace the replay from there.
+    files_.rewind();
+    anchored_ = false;
+    empty_ = true;
+    restarted_ = true;
+    return true;
   }
 
 } // velodyne namespace
@@ -0,0 +1,241 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Sidecar time and revolution index of Velodyne capture files.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include <ros/ros.h>
+#include "velodyne_driver/pcap_index.h"
+#include "velodyne_driver/pcap_reader.h"
+
+namespace velodyne_driver
+{
+  static const char INDEX_MAGIC[4] = {'V', 'I', 'D', 'X'};
+  static const uint32_t INDEX_VERSION = 1;
+
+  /** index file header, in host byte order */
+  struct IndexHeader
+  {
+    char magic[4];
+    uint32_t version;
+    uint64_t file_size;
+    uint64_t file_mtime_ns;
+    uint16_t port;
+    uint16_t reserved;
+    uint32_t src_addr;
+    uint32_t packet_size;
+    uint32_t interval;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint32_t last_revolution;
+    uint32_t reserved2;
+    uint64_t count;
+  };
+
+  PcapIndex::PcapIndex():
+    file_size_(0),
+    file_mtime_ns_(0),
+    start_ns_(0),
+    end_ns_(0),
+    last_revolution_(0)
+  {
+    memset(&filter_, 0, sizeof(filter_));
+  }
+
+  bool PcapIndex::open(const std::string &filename, const Filter &filter)
+  {
+    struct stat st;
+    if (stat(filename.c_str(), &st) < 0)
+      {
+        ROS_ERROR("cannot index %s: %s", filename.c_str(), strerror(errno));
+        return false;
+      }
+    filter_ = filter;
+    if (filter_.interval == 0)
+      filter_.interval = 1;
+    file_size_ = st.st_size;
+    file_mtime_ns_ = st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+
+    const std::string path = filename + ".vidx";
+    if (load(path))
+      {
+        ROS_INFO("loaded index %s, %zu entries", path.c_str(),
+                 entries_.size());
+        return true;
+      }
+
+    ROS_INFO("indexing %s", filename.c_str());
+    if (!build(filename))
+      return false;
+    if (!save(path))
+      ROS_WARN("cannot save index %s, keeping it in memory", path.c_str());
+    ROS_INFO("indexed %u revolutions, %.1f seconds",
+             last_revolution_ + 1, (end_ns_ - start_ns_) * 1e-9);
+    return true;
+  }
+
+  /** @brief Read the whole capture file, entering every N-th packet. */
+  bool PcapIndex::build(const std::string &filename)
+  {
+    PcapReader reader;
+    if (!reader.open(filename))
+      return false;
+
+    entries_.clear();
+    uint64_t npackets = 0;
+    uint32_t revolution = 0;
+    uint16_t last_azimuth = 0;
+    PcapRecord rec;
+    while (reader.next(&rec))
+      {
+        if (rec.dst_port != filter_.port
+            || rec.length != filter_.packet_size)
+          continue;
+        if (filter_.src_addr != 0 && rec.src_addr != filter_.src_addr)
+          continue;
+
+        const uint16_t azimuth = packetAzimuth(rec.data);
+        if (npackets == 0)
+          start_ns_ = rec.time_ns;
+        else if (azimuth < last_azimuth)
+          ++revolution;
+        last_azimuth = azimuth;
+        end_ns_ = rec.time_ns;
+
+        if (npackets % filter_.interval == 0)
+          {
+            Entry entry;
+            entry.offset = rec.offset;
+            entry.section = rec.section;
+            entry.time_ns = rec.time_ns;
+            entry.revolution = revolution;
+            entry.azimuth = azimuth;
+            entry.reserved = 0;
+            entries_.push_back(entry);
+          }
+        ++npackets;
+      }
+    last_revolution_ = revolution;
+    return true;
+  }
+
+  /** @returns true if the index file matches the capture file */
+  bool PcapIndex::load(const std::string &path)
+  {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+      return false;
+
+    IndexHeader header;
+    bool ok = (fread(&header, sizeof(header), 1, file) == 1
+               && memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0
+               && header.version == INDEX_VERSION
+               && header.file_size == file_size_
+               && header.file_mtime_ns == file_mtime_ns_
+               && header.port == filter_.port
+               && header.src_addr == filter_.src_addr
+               && header.packet_size == filter_.packet_size
+               && header.interval == filter_.interval);
+    if (ok)
+      {
+        entries_.resize(header.count);
+        ok = (header.count == 0
+              || fread(&entries_[0], sizeof(Entry), header.count, file)
+                 == header.count);
+      }
+    fclose(file);
+
+    if (!ok)
+      {
+        entries_.clear();
+        return false;
+      }
+    start_ns_ = header.start_ns;
+    end_ns_ = header.end_ns;
+    last_revolution_ = header.last_revolution;
+    return true;
+  }
+
+  bool PcapIndex::save(const std::string &path) const
+  {
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.file_size = file_size_;
+    header.file_mtime_ns = file_mtime_ns_;
+    header.port = filter_.port;
+    header.src_addr = filter_.src_addr;
+    header.packet_size = filter_.packet_size;
+    header.interval = filter_.interval;
+    header.start_ns = start_ns_;
+    header.end_ns = end_ns_;
+    header.last_revolution = last_revolution_;
+    header.count = entries_.size();
+
+    // write a temporary file, so readers never see a partial index
+    const std::string tmp = path + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if (file == NULL)
+      return false;
+    bool ok = (fwrite(&header, sizeof(header), 1, file) == 1
+               && (entries_.empty()
+                   || fwrite(&entries_[0], sizeof(Entry), entries_.size(),
+                             file) == entries_.size()));
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) < 0)
+      {
+        (void) remove(tmp.c_str());
+        return false;
+      }
+    return true;
+  }
+
+  static bool entryTimeLess(uint64_t time_ns, const PcapIndex::Entry &entry)
+  {
+    return time_ns < entry.time_ns;
+  }
+
+  static bool entryRevolutionLess(const PcapIndex::Entry &entry,
+                                  uint32_t revolution)
+  {
+    return entry.revolution < revolution;
+  }
+
+  const PcapIndex::Entry *PcapIndex::findTime(uint64_t time_ns) const
+  {
+    if (entries_.empty())
+      return NULL;
+    std::vector<Entry>::const_iterator it =
+      std::upper_bound(entries_.begin(), entries_.end(), time_ns,
+                       entryTimeLess);
+    if (it != entries_.begin())
+      --it;
+    return &*it;
+  }
+
+  const PcapIndex::Entry *PcapIndex::findRevolution(uint32_t revolution) const
+  {
+    if (entries_.empty())
+      return NULL;
+    // the last entry of an earlier revolution precedes its start
+    std::vector<Entry>::const_iterator it =
+      std::lower_bound(entries_.begin(), entries_.end(), revolution,
+                       entryRevolutionLess);
+    if (it != entries_.begin())
+      --it;
+    return &*it;
+  }
+
+} // velodyne_driver namespace
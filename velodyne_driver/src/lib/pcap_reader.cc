@@ -0,0 +1,721 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Memory-mapped pcap and pcapng reader, and sets of rolled
+ *  capture files.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include <ros/ros.h>
+#include "velodyne_driver/pcap_reader.h"
+
+namespace velodyne_driver
+{
+  // pcap file magic numbers, as read in native byte order
+  static const uint32_t PCAP_MAGIC_USEC = 0xa1b2c3d4;
+  static const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+  static const size_t PCAP_FILE_HEADER = 24;
+  static const size_t PCAP_RECORD_HEADER = 16;
+
+  // pcapng block types, read in the byte order of their section; that
+  // of the section header block is the same in either order
+  static const uint32_t PCAPNG_SHB = 0x0a0d0d0a;
+  static const uint32_t PCAPNG_IDB = 0x00000001;
+  static const uint32_t PCAPNG_SPB = 0x00000003;
+  static const uint32_t PCAPNG_EPB = 0x00000006;
+  static const uint32_t PCAPNG_BYTE_ORDER = 0x1a2b3c4d;
+  static const uint16_t PCAPNG_OPT_TSRESOL = 9;
+
+  // link types
+  static const uint16_t LINKTYPE_NULL = 0;
+  static const uint16_t LINKTYPE_ETHERNET = 1;
+  static const uint16_t LINKTYPE_RAW = 101;
+  static const uint16_t LINKTYPE_LOOP = 108;
+  static const uint16_t LINKTYPE_LINUX_SLL = 113;
+  static const uint16_t LINKTYPE_IPV4 = 228;
+  static const uint16_t LINKTYPE_LINUX_SLL2 = 276;
+
+  static const uint16_t ETHERTYPE_IPV4 = 0x0800;
+  static const uint16_t ETHERTYPE_VLAN = 0x8100;
+  static const uint16_t ETHERTYPE_QINQ = 0x88a8;
+  static const uint8_t IPPROTO_UDP_NUMBER = 17;
+  static const uint32_t BSD_AF_INET = 2;
+
+  /** read big-endian (network order) values */
+  static inline uint16_t net16(const uint8_t *p)
+  {
+    return (p[0] << 8) | p[1];
+  }
+
+  PcapReader::PcapReader():
+    fd_(-1),
+    map_(NULL),
+    size_(0),
+    start_(0),
+    offset_(0),
+    section_(0),
+    pcapng_(false),
+    swapped_(false)
+  {
+    pcap_iface_.linktype = LINKTYPE_ETHERNET;
+    pcap_iface_.tsresol_binary = false;
+    pcap_iface_.tsresol = 6;
+  }
+
+  PcapReader::~PcapReader()
+  {
+    close();
+  }
+
+  /** @brief Map a capture file and parse its header.
+   *
+   *  @returns true if the file is a readable pcap or pcapng file
+   */
+  bool PcapReader::open(const std::string &filename)
+  {
+    close();
+
+    fd_ = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0)
+      {
+        ROS_ERROR("cannot open %s: %s", filename.c_str(), strerror(errno));
+        return false;
+      }
+
+    struct stat st;
+    if (fstat(fd_, &st) < 0 || st.st_size == 0)
+      {
+        ROS_ERROR("cannot read %s: empty or unreadable", filename.c_str());
+        close();
+        return false;
+      }
+    size_ = st.st_size;
+
+    void *map = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (map == MAP_FAILED)
+      {
+        ROS_ERROR("cannot map %s: %s", filename.c_str(), strerror(errno));
+        size_ = 0;
+        close();
+        return false;
+      }
+    map_ = static_cast<const uint8_t *>(map);
+    (void) madvise(map, size_, MADV_SEQUENTIAL);
+
+    if (!parseHeader())
+      {
+        ROS_ERROR("%s is not a pcap or pcapng file", filename.c_str());
+        close();
+        return false;
+      }
+
+    rewind();
+    return true;
+  }
+
+  void PcapReader::close()
+  {
+    if (map_ != NULL)
+      (void) munmap(const_cast<uint8_t *>(map_), size_);
+    map_ = NULL;
+    size_ = 0;
+    if (fd_ >= 0)
+      (void) ::close(fd_);
+    fd_ = -1;
+  }
+
+  void PcapReader::rewind()
+  {
+    offset_ = start_;
+    section_ = start_;
+    interfaces_.clear();
+  }
+
+  bool PcapReader::seek(size_t offset, size_t section)
+  {
+    if (map_ == NULL || offset < start_ || offset >= size_)
+      return false;
+
+    if (pcapng_ && (section != section_ || interfaces_.empty()))
+      {
+        // restore byte order and interfaces of the section
+        if (section > offset || !parseSection(section))
+          return false;
+      }
+    offset_ = offset;
+    return true;
+  }
+
+  /** @brief Read the header and interfaces of a pcapng section.
+   *
+   *  Only the interface blocks before the first packet are read,
+   *  which is where capture tools write them.
+   */
+  bool PcapReader::parseSection(size_t offset)
+  {
+    if (offset + 12 > size_)
+      return false;
+    uint32_t type = get32(map_ + offset);
+    if (type != PCAPNG_SHB || !startSection(map_ + offset))
+      return false;
+    section_ = offset;
+    interfaces_.clear();
+
+    size_t block_offset = offset;
+    while (block_offset + 12 <= size_)
+      {
+        const uint8_t *block = map_ + block_offset;
+        const uint32_t length = get32(block + 4);
+        if (length < 12 || (length & 3) || length > size_ - block_offset)
+          return false;
+        type = get32(block);
+        if (type == PCAPNG_IDB)
+          addInterface(block + 8, length - 12);
+        else if (block_offset != offset
+                 && (type == PCAPNG_SHB || type == PCAPNG_EPB
+                     || type == PCAPNG_SPB))
+          break;
+        block_offset += length;
+      }
+    return true;
+  }
+
+  /** @brief Set the byte order of the section header block. */
+  bool PcapReader::startSection(const uint8_t *block)
+  {
+    uint32_t order;
+    memcpy(&order, block + 8, sizeof(order));
+    if (order == PCAPNG_BYTE_ORDER)
+      swapped_ = false;
+    else if (order == __builtin_bswap32(PCAPNG_BYTE_ORDER))
+      swapped_ = true;
+    else
+      return false;
+    return true;
+  }
+
+  /** @brief Add the interface of an interface description block. */
+  void PcapReader::addInterface(const uint8_t *body, size_t body_len)
+  {
+    if (body_len < 8)
+      return;
+
+    Interface iface;
+    iface.linktype = get16(body);
+    iface.tsresol_binary = false;
+    iface.tsresol = 6;
+
+    // look for the if_tsresol option
+    size_t opt = 8;
+    while (opt + 4 <= body_len)
+      {
+        const uint16_t code = get16(body + opt);
+        const uint16_t len = get16(body + opt + 2);
+        if (code == 0 || opt + 4 + len > body_len)
+          break;
+        if (code == PCAPNG_OPT_TSRESOL && len >= 1)
+          {
+            const uint8_t value = body[opt + 4];
+            iface.tsresol_binary = (value & 0x80) != 0;
+            iface.tsresol = value & 0x7f;
+          }
+        opt += 4 + ((len + 3) & ~3);
+      }
+    interfaces_.push_back(iface);
+  }
+
+  void PcapReader::willNeed()
+  {
+    if (map_ == NULL)
+      return;
+    (void) madvise(const_cast<uint8_t *>(map_), size_, MADV_WILLNEED);
+    (void) readahead(fd_, 0, size_);
+  }
+
+  bool PcapReader::next(PcapRecord *rec)
+  {
+    if (map_ == NULL)
+      return false;
+    return pcapng_? nextPcapng(rec): nextPcap(rec);
+  }
+
+  uint16_t PcapReader::get16(const uint8_t *p) const
+  {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return swapped_? __builtin_bswap16(v): v;
+  }
+
+  uint32_t PcapReader::get32(const uint8_t *p) const
+  {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return swapped_? __builtin_bswap32(v): v;
+  }
+
+  /** @brief Identify the file format and byte order. */
+  bool PcapReader::parseHeader()
+  {
+    if (size_ < PCAP_FILE_HEADER)
+      return false;
+
+    uint32_t magic;
+    memcpy(&magic, map_, sizeof(magic));
+
+    if (magic == PCAPNG_SHB)
+      {
+        // byte order is decided by each section header block
+        pcapng_ = true;
+        start_ = 0;
+        return true;
+      }
+
+    pcapng_ = false;
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC)
+      swapped_ = false;
+    else if (magic == __builtin_bswap32(PCAP_MAGIC_USEC)
+             || magic == __builtin_bswap32(PCAP_MAGIC_NSEC))
+      swapped_ = true;
+    else
+      return false;
+
+    pcap_iface_.tsresol_binary = false;
+    pcap_iface_.tsresol = (get32(map_) == PCAP_MAGIC_NSEC)? 9: 6;
+    // upper bits of the link type field may hold FCS information
+    pcap_iface_.linktype = get32(map_ + 20) & 0xffff;
+    start_ = PCAP_FILE_HEADER;
+    return true;
+  }
+
+  /** @brief Convert a time stamp of the interface resolution. */
+  uint64_t PcapReader::toNanoseconds(uint64_t ts, const Interface &iface)
+  {
+    if (iface.tsresol_binary)
+      {
+        const unsigned bits = iface.tsresol;
+        if (bits >= 64)
+          return 0;
+        const uint64_t sec = ts >> bits;
+        const uint64_t frac = ts & ((UINT64_C(1) << bits) - 1);
+        return sec * 1000000000ull
+          + (uint64_t) (frac * (1e9 / (double) (UINT64_C(1) << bits)));
+      }
+
+    uint64_t units = 1;                 // time stamp units per second
+    for (unsigned i = 0; i < iface.tsresol && i < 19; ++i)
+      units *= 10;
+    const uint64_t sec = ts / units;
+    const uint64_t frac = ts % units;
+    if (units <= 1000000000ull)
+      return sec * 1000000000ull + frac * (1000000000ull / units);
+    return sec * 1000000000ull + frac / (units / 1000000000ull);
+  }
+
+  bool PcapReader::nextPcap(PcapRecord *rec)
+  {
+    while (offset_ + PCAP_RECORD_HEADER <= size_)
+      {
+        const uint8_t *hdr = map_ + offset_;
+        const uint32_t caplen = get32(hdr + 8);
+        if (caplen > size_ - offset_ - PCAP_RECORD_HEADER)
+          {
+            ROS_WARN("truncated record at end of capture file");
+            offset_ = size_;
+            return false;
+          }
+
+        rec->offset = offset_;
+        rec->section = section_;
+        offset_ += PCAP_RECORD_HEADER + caplen;
+        if (!parseFrame(pcap_iface_.linktype, hdr + PCAP_RECORD_HEADER,
+                        caplen, rec))
+          continue;
+
+        const uint64_t sec = get32(hdr);
+        const uint64_t frac = get32(hdr + 4);
+        rec->time_ns = sec * 1000000000ull
+          + frac * (pcap_iface_.tsresol == 9? 1: 1000);
+        return true;
+      }
+    return false;
+  }
+
+  bool PcapReader::nextPcapng(PcapRecord *rec)
+  {
+    while (offset_ + 12 <= size_)
+      {
+        const uint8_t *block = map_ + offset_;
+        const uint32_t type = get32(block);
+
+        if (type == PCAPNG_SHB)
+          {
+            // a new section, possibly of another byte order
+            if (!startSection(block))
+              {
+                ROS_WARN("bad pcapng section header");
+                offset_ = size_;
+                return false;
+              }
+            section_ = offset_;
+            interfaces_.clear();
+          }
+
+        const uint32_t length = get32(block + 4);
+        if (length < 12 || (length & 3) || length > size_ - offset_)
+          {
+            ROS_WARN("truncated block at end of capture file");
+            offset_ = size_;
+            return false;
+          }
+        const size_t block_offset = offset_;
+        offset_ += length;
+        const uint8_t *body = block + 8;
+        const size_t body_len = length - 12;
+
+        if (type == PCAPNG_IDB)
+          {
+            addInterface(body, body_len);
+          }
+        else if (type == PCAPNG_EPB && body_len >= 20)
+          {
+            const uint32_t id = get32(body);
+            const uint32_t caplen = get32(body + 12);
+            if (id >= interfaces_.size() || caplen > body_len - 20)
+              continue;
+            rec->offset = block_offset;
+            rec->section = section_;
+            if (!parseFrame(interfaces_[id].linktype, body + 20,
+                            caplen, rec))
+              continue;
+            const uint64_t ts = ((uint64_t) get32(body + 4) << 32)
+              | get32(body + 8);
+            rec->time_ns = toNanoseconds(ts, interfaces_[id]);
+            return true;
+          }
+        else if (type == PCAPNG_SPB && body_len >= 4)
+          {
+            // simple packets have no time stamp and no captured length
+            if (interfaces_.empty())
+              continue;
+            const uint32_t len = get32(body);
+            rec->offset = block_offset;
+            rec->section = section_;
+            if (!parseFrame(interfaces_[0].linktype, body + 4,
+                            std::min((size_t) len, body_len - 4), rec))
+              continue;
+            rec->time_ns = 0;
+            return true;
+          }
+        // other blocks are skipped
+      }
+    return false;
+  }
+
+  /** @brief Find the UDP payload of a captured frame.
+   *
+   *  @returns true for an unfragmented IPv4 UDP datagram
+   */
+  bool PcapReader::parseFrame(uint16_t linktype, const uint8_t *frame,
+                              size_t caplen, PcapRecord *rec) const
+  {
+    size_t ip = 0;                      // offset of the IP header
+    uint16_t ethertype = ETHERTYPE_IPV4;
+
+    switch (linktype)
+      {
+      case LINKTYPE_ETHERNET:
+        if (caplen < 14)
+          return false;
+        ethertype = net16(frame + 12);
+        ip = 14;
+        while ((ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ)
+               && caplen >= ip + 4)
+          {
+            ethertype = net16(frame + ip + 2);
+            ip += 4;
+          }
+        break;
+      case LINKTYPE_LINUX_SLL:
+        if (caplen < 16)
+          return false;
+        ethertype = net16(frame + 14);
+        ip = 16;
+        break;
+      case LINKTYPE_LINUX_SLL2:
+        if (caplen < 20)
+          return false;
+        ethertype = net16(frame);
+        ip = 20;
+        break;
+      case LINKTYPE_RAW:
+      case LINKTYPE_IPV4:
+        break;
+      case LINKTYPE_NULL:
+      case LINKTYPE_LOOP:
+        {
+          if (caplen < 4)
+            return false;
+          uint32_t family;
+          memcpy(&family, frame, sizeof(family));
+          // NULL uses the byte order of the capturing host, LOOP
+          // network order; AF_INET is 2 everywhere
+          if (family != BSD_AF_INET
+              && family != __builtin_bswap32(BSD_AF_INET))
+            return false;
+          ip = 4;
+          break;
+        }
+      default:
+        return false;
+      }
+
+    if (ethertype != ETHERTYPE_IPV4 || caplen < ip + 20)
+      return false;
+
+    const uint8_t *iph = frame + ip;
+    const size_t ihl = (iph[0] & 0x0f) * 4;
+    if ((iph[0] >> 4) != 4 || ihl < 20 || caplen < ip + ihl + 8)
+      return false;
+    if (iph[9] != IPPROTO_UDP_NUMBER)
+      return false;
+    if (net16(iph + 6) & 0x3fff)        // fragment?
+      return false;
+
+    const uint8_t *udp = iph + ihl;
+    const size_t udp_len = net16(udp + 4);
+    if (udp_len < 8)
+      return false;
+
+    memcpy(&rec->src_addr, iph + 12, sizeof(rec->src_addr));
+    rec->dst_port = net16(udp + 2);
+    rec->data = udp + 8;
+    rec->length = std::min(udp_len - 8, caplen - (ip + ihl + 8));
+    return true;
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // PcapFileSet class implementation
+  ////////////////////////////////////////////////////////////////////////
+
+  static const size_t NO_FILE = (size_t) -1;
+
+  PcapFileSet::PcapFileSet():
+    current_(0),
+    prefetch_stop_(false),
+    prefetch_file_(NO_FILE),
+    prefetched_file_(NO_FILE)
+  {}
+
+  PcapFileSet::~PcapFileSet()
+  {
+    if (prefetch_thread_)
+      {
+        {
+          boost::lock_guard<boost::mutex> lock(prefetch_mutex_);
+          prefetch_stop_ = true;
+          prefetch_cond_.notify_one();
+        }
+        prefetch_thread_->join();
+      }
+  }
+
+  /** @returns true if a file starts like a pcap or pcapng file */
+  static bool isCaptureFile(const std::string &name)
+  {
+    const int fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return false;
+    uint32_t magic = 0;
+    const bool read_magic = read(fd, &magic, sizeof(magic)) == sizeof(magic);
+    ::close(fd);
+    return read_magic
+      && (magic == PCAPNG_SHB
+          || magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC
+          || magic == __builtin_bswap32(PCAP_MAGIC_USEC)
+          || magic == __builtin_bswap32(PCAP_MAGIC_NSEC));
+  }
+
+  bool PcapFileSet::open(const std::string &pattern)
+  {
+    // a directory stands for all the files in it
+    std::string expression = pattern;
+    struct stat st;
+    if (stat(pattern.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+      expression = pattern + "/*";
+
+    glob_t matches;
+    if (glob(expression.c_str(), 0, NULL, &matches) != 0)
+      {
+        ROS_ERROR("no capture file matches %s", pattern.c_str());
+        return false;
+      }
+
+    for (size_t i = 0; i < matches.gl_pathc; ++i)
+      {
+        const std::string name = matches.gl_pathv[i];
+        if (stat(name.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+          continue;
+        // quietly skip whatever else is among the files matched, such
+        // as our own index files; a file named alone is still opened,
+        // to report what is wrong with it
+        if (name != pattern && !isCaptureFile(name))
+          {
+            ROS_DEBUG("%s is not a capture file, skipped", name.c_str());
+            continue;
+          }
+
+        PcapReader reader;
+        PcapRecord rec;
+        if (!reader.open(name))
+          continue;
+        if (!reader.next(&rec))
+          {
+            ROS_WARN("no UDP packets in %s, skipped", name.c_str());
+            continue;
+          }
+        File file;
+        file.name = name;
+        file.start_ns = rec.time_ns;
+        files_.push_back(file);
+      }
+    globfree(&matches);
+
+    if (files_.empty())
+      {
+        ROS_ERROR("no capture file found in %s", pattern.c_str());
+        return false;
+      }
+
+    // order by first time stamp, then by name
+    std::stable_sort(files_.begin(), files_.end());
+
+    if (files_.size() > 1)
+      {
+        ROS_INFO("reading %zu capture files, starting with %s",
+                 files_.size(), files_[0].name.c_str());
+        prefetch_thread_.reset
+          (new boost::thread(boost::bind(&PcapFileSet::prefetchLoop, this)));
+      }
+
+    return openFile(0);
+  }
+
+  size_t PcapFileSet::findTime(uint64_t time_ns) const
+  {
+    size_t file = 0;
+    while (file + 1 < files_.size() && files_[file + 1].start_ns <= time_ns)
+      ++file;
+    return file;
+  }
+
+  bool PcapFileSet::next(PcapRecord *rec)
+  {
+    while (true)
+      {
+        if (reader_ && reader_->next(rec))
+          return true;
+        if (current_ + 1 >= files_.size())
+          return false;
+        ROS_DEBUG("continuing with %s", files_[current_ + 1].name.c_str());
+        (void) openFile(current_ + 1);
+      }
+  }
+
+  void PcapFileSet::rewind()
+  {
+    if (current_ == 0 && reader_)
+      reader_->rewind();
+    else
+      (void) openFile(0);
+  }
+
+  bool PcapFileSet::seek(size_t file, size_t offset, size_t section)
+  {
+    if (file >= files_.size())
+      return false;
+    if (file != current_ || !reader_)
+      if (!openFile(file))
+        return false;
+    return reader_->seek(offset, section);
+  }
+
+  /** @brief Switch to another file, prefetched if possible. */
+  bool PcapFileSet::openFile(size_t file)
+  {
+    boost::shared_ptr<PcapReader> reader;
+    {
+      boost::lock_guard<boost::mutex> lock(prefetch_mutex_);
+      if (prefetched_file_ == file)
+        {
+          reader.swap(prefetched_);
+          prefetched_file_ = NO_FILE;
+        }
+    }
+    if (!reader)
+      {
+        reader.reset(new PcapReader);
+        if (!reader->open(files_[file].name))
+          reader.reset();
+      }
+
+    reader_ = reader;
+    current_ = file;
+    if (files_.size() > 1)
+      prefetch((file + 1) % files_.size());
+    return reader_.get() != NULL;
+  }
+
+  void PcapFileSet::prefetch(size_t file)
+  {
+    boost::lock_guard<boost::mutex> lock(prefetch_mutex_);
+    prefetch_file_ = file;
+    prefetch_cond_.notify_one();
+  }
+
+  /** @brief Prefetch thread main loop.
+   *
+   *  Maps the requested file and reads it into the page cache while
+   *  the current one is replayed, so switching files never waits
+   *  for the disk.
+   */
+  void PcapFileSet::prefetchLoop()
+  {
+    boost::unique_lock<boost::mutex> lock(prefetch_mutex_);
+    while (!prefetch_stop_)
+      {
+        if (prefetch_file_ == NO_FILE || prefetch_file_ == prefetched_file_)
+          {
+            prefetch_cond_.wait(lock);
+            continue;
+          }
+
+        const size_t file = prefetch_file_;
+        prefetch_file_ = NO_FILE;
+        lock.unlock();
+
+        boost::shared_ptr<PcapReader> reader(new PcapReader);
+        if (reader->open(files_[file].name))
+          reader->willNeed();
+        else
+          reader.reset();
+
+        lock.lock();
+        prefetched_ = reader;
+        prefetched_file_ = reader? file: NO_FILE;
+      }
+  }
+
+} // velodyne_driver namespace
@@ -0,0 +1,364 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Background writer of rolling pcap files.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <algorithm>
+
+#include <ros/ros.h>
+#include "velodyne_driver/pcap_writer.h"
+
+namespace velodyne_driver
+{
+  static const size_t packet_size =
+    sizeof(velodyne_msgs::VelodynePacket().data);
+
+  static const size_t FRAME_HEADER = 42;
+  static const size_t RECORD_HEADER = 16;
+  static const size_t RECORD_SIZE = RECORD_HEADER + FRAME_HEADER + packet_size;
+  static const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+  static const size_t PAGE_ALIGN = 4096;
+
+  /** pcap global header, nanosecond time stamps, Ethernet */
+  struct PcapFileHeader
+  {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+  };
+
+  static inline void put16(uint8_t *p, uint16_t v)
+  {
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+  }
+
+  PcapWriter::PcapWriter():
+    file_size_(0),
+    file_count_(0),
+    buffer_size_(0),
+    current_(NULL),
+    stop_(false),
+    blocking_(false),
+    fd_(-1),
+    file_number_(0),
+    file_bytes_(0),
+    flushed_bytes_(0),
+    written_(0),
+    dropped_(0)
+  {
+    memset(frame_header_, 0, sizeof(frame_header_));
+  }
+
+  PcapWriter::~PcapWriter()
+  {
+    close();
+    for (size_t i = 0; i < buffers_.size(); ++i)
+      free(buffers_[i].data);
+  }
+
+  bool PcapWriter::open(const std::string &prefix, size_t file_size,
+                        int file_count, uint16_t port,
+                        const std::string &device_ip,
+                        size_t buffer_size, int buffer_count)
+  {
+    close();
+
+    prefix_ = prefix;
+    file_size_ = file_size;
+    file_count_ = file_count;
+    file_number_ = 0;
+    // every buffer holds whole records
+    buffer_size_ = std::max(buffer_size, RECORD_SIZE);
+    buffer_size_ = (buffer_size_ + PAGE_ALIGN - 1) & ~(PAGE_ALIGN - 1);
+
+    // Ethernet header: broadcast from a Velodyne MAC address
+    uint8_t *eth = frame_header_;
+    memset(eth, 0xff, 6);
+    const uint8_t velodyne_mac[6] = {0x60, 0x76, 0x88, 0x00, 0x00, 0x00};
+    memcpy(eth + 6, velodyne_mac, 6);
+    put16(eth + 12, 0x0800);
+
+    // IPv4 header, the same for all packets
+    uint8_t *ip = frame_header_ + 14;
+    memset(ip, 0, 20);
+    ip[0] = 0x45;
+    put16(ip + 2, 20 + 8 + packet_size);
+    put16(ip + 6, 0x4000);              // don't fragment
+    ip[8] = 64;                         // TTL
+    ip[9] = 17;                         // UDP
+    in_addr src;
+    if (device_ip.empty() || inet_aton(device_ip.c_str(), &src) == 0)
+      inet_aton("192.168.1.201", &src);
+    memcpy(ip + 12, &src.s_addr, 4);
+    memset(ip + 16, 0xff, 4);
+    uint32_t sum = 0;
+    for (int i = 0; i < 20; i += 2)
+      sum += (ip[i] << 8) | ip[i + 1];
+    while (sum >> 16)
+      sum = (sum & 0xffff) + (sum >> 16);
+    put16(ip + 10, ~sum & 0xffff);
+
+    // UDP header, no checksum
+    uint8_t *udp = frame_header_ + 34;
+    put16(udp, port);
+    put16(udp + 2, port);
+    put16(udp + 4, 8 + packet_size);
+    put16(udp + 6, 0);
+
+    if (buffers_.empty())
+      {
+        buffers_.resize(std::max(buffer_count, 2));
+        for (size_t i = 0; i < buffers_.size(); ++i)
+          {
+            void *data = NULL;
+            if (posix_memalign(&data, PAGE_ALIGN, buffer_size_) != 0)
+              {
+                ROS_ERROR("cannot allocate pcap write buffers");
+                buffers_.resize(i);
+                return false;
+              }
+            buffers_[i].data = static_cast<uint8_t *>(data);
+            buffers_[i].used = 0;
+          }
+      }
+    free_.clear();
+    for (size_t i = 0; i < buffers_.size(); ++i)
+      {
+        buffers_[i].used = 0;
+        free_.push_back(&buffers_[i]);
+      }
+    current_ = free_.back();
+    free_.pop_back();
+
+    if (!nextFile())
+      return false;
+
+    stop_ = false;
+    writer_thread_.reset
+      (new boost::thread(boost::bind(&PcapWriter::writerLoop, this)));
+    ROS_INFO("recording packets to %s", fileName(0).c_str());
+    return true;
+  }
+
+  void PcapWriter::close()
+  {
+    if (!writer_thread_)
+      return;
+
+    flush();
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      stop_ = true;
+      cond_.notify_one();
+    }
+    writer_thread_->join();
+    writer_thread_.reset();
+
+    if (fd_ >= 0)
+      (void) ::close(fd_);
+    fd_ = -1;
+    if (dropped_ > 0)
+      ROS_WARN("%llu packets not recorded, disk too slow",
+               (unsigned long long) dropped_);
+  }
+
+  void PcapWriter::write(const velodyne_msgs::VelodynePacket *pkts,
+                         int npkts)
+  {
+    for (int i = 0; i < npkts; ++i)
+      {
+        if (current_ != NULL && current_->used + RECORD_SIZE > buffer_size_)
+          flush();
+        if (current_ == NULL)
+          {
+            // try again to get a buffer back from the writer
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            while (blocking_ && free_.empty())
+              free_cond_.wait(lock);
+            if (!free_.empty())
+              {
+                current_ = free_.back();
+                free_.pop_back();
+              }
+          }
+        if (current_ == NULL)
+          {
+            ++dropped_;
+            continue;
+          }
+
+        uint8_t *rec = current_->data + current_->used;
+        const uint32_t header[4] = {pkts[i].stamp.sec, pkts[i].stamp.nsec,
+                                    FRAME_HEADER + packet_size,
+                                    FRAME_HEADER + packet_size};
+        memcpy(rec, header, RECORD_HEADER);
+        memcpy(rec + RECORD_HEADER, frame_header_, FRAME_HEADER);
+        memcpy(rec + RECORD_HEADER + FRAME_HEADER, &pkts[i].data[0],
+               packet_size);
+        current_->used += RECORD_SIZE;
+      }
+  }
+
+  void PcapWriter::flush()
+  {
+    if (current_ == NULL || current_->used == 0)
+      return;
+
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    full_.push_back(current_);
+    current_ = NULL;
+    if (!free_.empty())
+      {
+        current_ = free_.back();
+        free_.pop_back();
+      }
+    cond_.notify_one();
+  }
+
+  /** @brief Writer thread main loop. */
+  void PcapWriter::writerLoop()
+  {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (true)
+      {
+        if (full_.empty())
+          {
+            if (stop_)
+              break;
+            cond_.wait(lock);
+            continue;
+          }
+
+        Buffer *buf = full_.front();
+        full_.pop_front();
+        lock.unlock();
+
+        writeBuffer(*buf);
+        buf->used = 0;
+
+        lock.lock();
+        free_.push_back(buf);
+        free_cond_.notify_one();
+      }
+  }
+
+  void PcapWriter::writeBuffer(const Buffer &buf)
+  {
+    if (file_size_ > 0 && file_bytes_ > sizeof(PcapFileHeader)
+        && file_bytes_ + buf.used > file_size_)
+      (void) nextFile();
+    if (fd_ < 0)
+      {
+        dropped_ += buf.used / RECORD_SIZE;
+        return;
+      }
+
+    size_t done = 0;
+    while (done < buf.used)
+      {
+        ssize_t rc = ::write(fd_, buf.data + done, buf.used - done);
+        if (rc < 0)
+          {
+            if (errno == EINTR)
+              continue;
+            ROS_ERROR("error writing %s: %s",
+                      fileName(file_number_).c_str(), strerror(errno));
+            dropped_ += (buf.used - done) / RECORD_SIZE;
+            break;
+          }
+        done += rc;
+      }
+    written_ += done / RECORD_SIZE;
+
+    // Start writeback now, and drop what was written before from
+    // the page cache, so recording does not evict everything else.
+    (void) sync_file_range(fd_, file_bytes_, done, SYNC_FILE_RANGE_WRITE);
+    if (file_bytes_ > flushed_bytes_)
+      {
+        (void) sync_file_range(fd_, flushed_bytes_,
+                               file_bytes_ - flushed_bytes_,
+                               SYNC_FILE_RANGE_WAIT_BEFORE
+                               | SYNC_FILE_RANGE_WRITE
+                               | SYNC_FILE_RANGE_WAIT_AFTER);
+        (void) posix_fadvise(fd_, flushed_bytes_,
+                             file_bytes_ - flushed_bytes_,
+                             POSIX_FADV_DONTNEED);
+        flushed_bytes_ = file_bytes_;
+      }
+    file_bytes_ += done;
+  }
+
+  /** @brief Close the current file and start the next one. */
+  bool PcapWriter::nextFile()
+  {
+    if (fd_ >= 0)
+      {
+        (void) ::close(fd_);
+        fd_ = -1;
+        ++file_number_;
+        if (file_count_ > 0 && file_number_ >= file_count_)
+          file_number_ = 0;
+      }
+
+    const std::string name = fileName(file_number_);
+    fd_ = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 0644);
+    if (fd_ < 0)
+      {
+        ROS_ERROR("cannot create %s: %s", name.c_str(), strerror(errno));
+        return false;
+      }
+
+    PcapFileHeader header;
+    header.magic = PCAP_MAGIC_NSEC;
+    header.version_major = 2;
+    header.version_minor = 4;
+    header.thiszone = 0;
+    header.sigfigs = 0;
+    header.snaplen = 65535;
+    header.linktype = 1;                // Ethernet
+    if (::write(fd_, &header, sizeof(header)) != sizeof(header))
+      {
+        ROS_ERROR("error writing %s: %s", name.c_str(), strerror(errno));
+        (void) ::close(fd_);
+        fd_ = -1;
+        return false;
+      }
+    file_bytes_ = sizeof(header);
+    flushed_bytes_ = 0;
+    return true;
+  }
+
+  /** @returns prefix followed by a number of at least three digits */
+  std::string PcapWriter::fileName(int number) const
+  {
+    if (file_count_ == 1)
+      return prefix_;
+
+    int digits = 3;
+    for (int n = file_count_ - 1; n >= 1000; n /= 10)
+      ++digits;
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "%0*d", digits, number);
+    return prefix_ + suffix;
+  }
+
+} // velodyne_driver namespace
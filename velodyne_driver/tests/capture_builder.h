@@ -0,0 +1,163 @@
+//
+// Capture files built in memory, for unit tests of their readers.
+//
+
+#ifndef _VELODYNE_TESTS_CAPTURE_BUILDER_H_
+#define _VELODYNE_TESTS_CAPTURE_BUILDER_H_ 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+/** build a capture file in memory, in either byte order */
+class CaptureBuilder
+{
+public:
+  explicit CaptureBuilder(bool big_endian): big_endian_(big_endian) {}
+
+  void put8(uint8_t v) { bytes_.push_back(v); }
+
+  void put16(uint16_t v)
+  {
+    if (big_endian_)
+      v = __builtin_bswap16(v);
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&v);
+    bytes_.insert(bytes_.end(), p, p + sizeof(v));
+  }
+
+  void put32(uint32_t v)
+  {
+    if (big_endian_)
+      v = __builtin_bswap32(v);
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&v);
+    bytes_.insert(bytes_.end(), p, p + sizeof(v));
+  }
+
+  void pad()
+  {
+    while (bytes_.size() & 3)
+      put8(0);
+  }
+
+  /** pcap file header, Ethernet link type */
+  void pcapHeader(bool nsec)
+  {
+    put32(nsec? 0xa1b23c4d: 0xa1b2c3d4);
+    put16(2);                           // version
+    put16(4);
+    put32(0);                           // time zone
+    put32(0);                           // sigfigs
+    put32(65535);                       // snaplen
+    put32(1);                           // LINKTYPE_ETHERNET
+  }
+
+  void pcapRecord(uint32_t sec, uint32_t frac, uint16_t port,
+                  const std::vector<uint8_t> &payload)
+  {
+    const std::vector<uint8_t> frame = udpFrame(port, payload);
+    put32(sec);
+    put32(frac);
+    put32(frame.size());
+    put32(frame.size());
+    bytes_.insert(bytes_.end(), frame.begin(), frame.end());
+  }
+
+  /** pcapng section header block */
+  void sectionHeader()
+  {
+    put32(0x0a0d0d0a);
+    put32(28);
+    put32(0x1a2b3c4d);                  // byte order magic
+    put16(1);                           // version
+    put16(0);
+    put32(0xffffffff);                  // section length unknown
+    put32(0xffffffff);
+    put32(28);
+  }
+
+  /** pcapng Ethernet interface, with a nanosecond if_tsresol */
+  void interface()
+  {
+    put32(1);
+    put32(32);
+    put16(1);                           // LINKTYPE_ETHERNET
+    put16(0);
+    put32(65535);                       // snaplen
+    put16(9);                           // if_tsresol
+    put16(1);
+    put8(9);
+    pad();
+    put16(0);                           // opt_endofopt
+    put16(0);
+    put32(32);
+  }
+
+  /** pcapng enhanced packet block, time stamp in nanoseconds */
+  void packet(uint64_t time_ns, uint16_t port,
+              const std::vector<uint8_t> &payload)
+  {
+    const std::vector<uint8_t> frame = udpFrame(port, payload);
+    const uint32_t length = 32 + ((frame.size() + 3) & ~3);
+    put32(6);
+    put32(length);
+    put32(0);                           // interface ID
+    put32(time_ns >> 32);
+    put32(time_ns & 0xffffffff);
+    put32(frame.size());
+    put32(frame.size());
+    bytes_.insert(bytes_.end(), frame.begin(), frame.end());
+    pad();
+    put32(length);
+  }
+
+  size_t size() const { return bytes_.size(); }
+
+  /** @returns name of a temporary file holding the capture */
+  std::string write() const
+  {
+    char name[] = "/tmp/velodyne_capture.XXXXXX";
+    const int fd = mkstemp(name);
+    if (fd < 0)
+      return "";
+    const ssize_t n = ::write(fd, &bytes_[0], bytes_.size());
+    ::close(fd);
+    if (n != (ssize_t) bytes_.size())
+      return "";
+    return name;
+  }
+
+private:
+  /** Ethernet, IPv4 and UDP headers (network order) and payload */
+  static std::vector<uint8_t> udpFrame(uint16_t port,
+                                       const std::vector<uint8_t> &payload)
+  {
+    std::vector<uint8_t> frame(14 + 20 + 8, 0);
+    frame[12] = 0x08;                   // IPv4
+    uint8_t *ip = &frame[14];
+    ip[0] = 0x45;
+    ip[2] = (20 + 8 + payload.size()) >> 8;
+    ip[3] = (20 + 8 + payload.size()) & 0xff;
+    ip[8] = 64;                         // TTL
+    ip[9] = 17;                         // UDP
+    ip[12] = 192;                       // source 192.168.1.201
+    ip[13] = 168;
+    ip[14] = 1;
+    ip[15] = 201;
+    uint8_t *udp = ip + 20;
+    udp[0] = 2368 >> 8;
+    udp[1] = 2368 & 0xff;
+    udp[2] = port >> 8;
+    udp[3] = port & 0xff;
+    udp[4] = (8 + payload.size()) >> 8;
+    udp[5] = (8 + payload.size()) & 0xff;
+    frame.insert(frame.end(), payload.begin(), payload.end());
+    return frame;
+  }
+
+  bool big_endian_;
+  std::vector<uint8_t> bytes_;
+};
+
+#endif // _VELODYNE_TESTS_CAPTURE_BUILDER_H_
@@ -0,0 +1,161 @@
+//
+// C++ unit tests for cutting scans at an azimuth, in sectors.
+//
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <velodyne_driver/azimuth_cut.h>
+using namespace velodyne_driver;
+
+///////////////////////////////////////////////////////////////
+// Test data
+///////////////////////////////////////////////////////////////
+
+static const int BLOCK_STEP = 20;       // hundredths of a degree
+static const int PACKET_STEP = 12 * BLOCK_STEP;
+
+/** @returns a packet whose first block fired at the given azimuth */
+static velodyne_msgs::VelodynePacket packet(int azimuth)
+{
+  velodyne_msgs::VelodynePacket pkt;
+  pkt.data.fill(0);
+  for (int block = 0; block < 12; ++block)
+    {
+      const int rotation = (azimuth + block * BLOCK_STEP) % 36000;
+      pkt.data[block * 100] = 0xff;
+      pkt.data[block * 100 + 1] = 0xee;
+      pkt.data[block * 100 + 2] = rotation & 0xff;
+      pkt.data[block * 100 + 3] = rotation >> 8;
+    }
+  return pkt;
+}
+
+/** @returns sector boundaries passed by n packets starting at azimuth */
+static std::vector<int> cuts(AzimuthCut &cut, int azimuth, int n,
+                             int *revolutions = NULL)
+{
+  std::vector<int> passed;
+  if (revolutions)
+    *revolutions = 0;
+  for (int i = 0; i < n; ++i)
+    {
+      if (cut.check(packet((azimuth + i * PACKET_STEP) % 36000)))
+        passed.push_back(cut.passed());
+      if (revolutions && cut.revolution())
+        ++*revolutions;
+    }
+  return passed;
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(AzimuthCut, disabled)
+{
+  AzimuthCut cut;
+  cut.setCutAngle(-0.01);
+  EXPECT_FALSE(cut.enabled());
+  EXPECT_TRUE(cuts(cut, 0, 1000).empty());
+}
+
+TEST(AzimuthCut, revolution)
+{
+  AzimuthCut cut;
+  cut.setCutAngle(M_PI / 2.0);          // 90 degrees
+  EXPECT_TRUE(cut.enabled());
+  EXPECT_EQ(cut.sectors(), 1);
+
+  // 150 packets of 2.4 degrees pass 90 degrees once per 360
+  int revolutions;
+  std::vector<int> passed = cuts(cut, 0, 450, &revolutions);
+  ASSERT_EQ(passed.size(), 3u);
+  EXPECT_EQ(revolutions, 3);
+  for (size_t i = 0; i < passed.size(); ++i)
+    EXPECT_EQ(passed[i], 9000);
+}
+
+TEST(AzimuthCut, cut_at_zero)
+{
+  AzimuthCut cut;
+  cut.setCutAngle(0.0);
+  int revolutions;
+  std::vector<int> passed = cuts(cut, 100, 300, &revolutions);
+  EXPECT_EQ(passed.size(), 2u);
+  EXPECT_EQ(revolutions, 2);
+}
+
+TEST(AzimuthCut, sectors)
+{
+  AzimuthCut cut;
+  cut.setCutAngle(M_PI / 2.0, M_PI / 6.0);  // twelve 30 degree sectors
+  EXPECT_EQ(cut.sectors(), 12);
+
+  // one turn from 0 passes every boundary once, the cut (at 90
+  // degrees) ending the revolution
+  int revolutions;
+  std::vector<int> passed = cuts(cut, 0, 151, &revolutions);
+  ASSERT_EQ(passed.size(), 12u);
+  EXPECT_EQ(revolutions, 1);
+  for (size_t i = 0; i < passed.size(); ++i)
+    EXPECT_EQ(passed[i], (3000 * (i + 1)) % 36000) << "sector " << i;
+}
+
+TEST(AzimuthCut, uneven_sectors)
+{
+  // 70 degrees does not divide 360: the last sector is 10 degrees
+  AzimuthCut cut;
+  cut.setCutAngle(0.0, 70.0 * M_PI / 180.0);
+  EXPECT_EQ(cut.sectors(), 6);
+
+  int revolutions;
+  std::vector<int> passed = cuts(cut, 100, 300, &revolutions);
+  ASSERT_EQ(passed.size(), 12u);
+  EXPECT_EQ(revolutions, 2);
+  const int expected[] = {7000, 14000, 21000, 28000, 35000, 0};
+  for (size_t i = 0; i < passed.size(); ++i)
+    EXPECT_EQ(passed[i], expected[i % 6]) << "sector " << i;
+}
+
+TEST(AzimuthCut, whole_revolution_sector)
+{
+  AzimuthCut cut;
+  cut.setCutAngle(1.0, 2.0 * M_PI);
+  EXPECT_EQ(cut.sectors(), 1);
+  cut.setCutAngle(1.0, 7.0);            // wider than a revolution
+  EXPECT_EQ(cut.sectors(), 1);
+}
+
+TEST(AzimuthCut, reset)
+{
+  // after a reset, the first packet cannot end a sector
+  AzimuthCut cut;
+  cut.setCutAngle(M_PI / 2.0);
+  EXPECT_FALSE(cut.check(packet(8900)));
+  cut.reset();
+  EXPECT_FALSE(cut.check(packet(9100)));
+  EXPECT_FALSE(cut.check(packet(9340)));
+  cut.reset();
+  EXPECT_FALSE(cut.check(packet(0)));
+  EXPECT_TRUE(cut.check(packet(8800)));
+}
+
+TEST(AzimuthCut, not_a_data_packet)
+{
+  AzimuthCut cut;
+  cut.setCutAngle(M_PI / 2.0);
+  velodyne_msgs::VelodynePacket pkt;
+  pkt.data.fill(0xff);
+  EXPECT_FALSE(cut.check(packet(8000)));
+  EXPECT_FALSE(cut.check(pkt));
+  EXPECT_TRUE(cut.check(packet(8800)));
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,132 @@
+//
+// C++ unit tests for the model table and detector.
+//
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <velodyne_driver/model.h>
+using namespace velodyne_driver;
+
+///////////////////////////////////////////////////////////////
+// Test data
+///////////////////////////////////////////////////////////////
+
+/** @returns ModelDetector fed 16 packets with the given factory bytes */
+static ModelDetector detect(uint8_t return_mode, uint8_t product_id)
+{
+  ModelDetector detector;
+  uint8_t data[1206];
+  memset(data, 0, sizeof(data));
+  data[1204] = return_mode;
+  data[1205] = product_id;
+  for (int i = 0; i < 16; ++i)
+    {
+      EXPECT_FALSE(detector.done());
+      detector.check(data);
+    }
+  return detector;
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(Model, find)
+{
+  EXPECT_EQ(findModel("32E"), MODEL_32E);
+  EXPECT_EQ(findModel("VLP16"), MODEL_VLP16);
+  EXPECT_EQ(findModel("64E_S2.1"), MODEL_64E_S21);
+  EXPECT_EQ(findModel("HDL-32E"), -1);
+  EXPECT_EQ(findModel(""), -1);
+}
+
+TEST(Model, matches)
+{
+  EXPECT_TRUE(modelMatches(MODEL_32E, MODEL_32E));
+  EXPECT_FALSE(modelMatches(MODEL_32E, MODEL_VLP16));
+  // the HDL-64E variants cannot be told apart
+  EXPECT_TRUE(modelMatches(MODEL_64E_S2, MODEL_64E));
+  EXPECT_FALSE(modelMatches(MODEL_64E, MODEL_VLP32));
+}
+
+TEST(ModelDetector, products)
+{
+  EXPECT_EQ(detect(0x37, 0x21).model(), MODEL_32E);
+  EXPECT_EQ(detect(0x37, 0x22).model(), MODEL_VLP16);
+  EXPECT_EQ(detect(0x37, 0x24).model(), MODEL_VLP16);  // Puck Hi-Res
+  EXPECT_EQ(detect(0x37, 0x28).model(), MODEL_VLP32);
+
+  ModelDetector unknown = detect(0x37, 0x99);
+  EXPECT_TRUE(unknown.done());
+  EXPECT_EQ(unknown.model(), -1);
+  EXPECT_EQ(unknown.productId(), 0x99);
+}
+
+TEST(ModelDetector, return_modes)
+{
+  EXPECT_EQ(detect(0x37, 0x22).returnMode(), RETURN_STRONGEST);
+  EXPECT_EQ(detect(0x38, 0x22).returnMode(), RETURN_LAST);
+  EXPECT_EQ(detect(0x39, 0x22).returnMode(), RETURN_DUAL);
+  EXPECT_EQ(detect(0x00, 0x22).returnMode(), 0);
+}
+
+TEST(ModelDetector, varying_bytes)
+{
+  // an HDL-64E cycles status bytes through the factory bytes
+  ModelDetector detector;
+  uint8_t data[1206];
+  memset(data, 0, sizeof(data));
+  for (int i = 0; i < 16; ++i)
+    {
+      data[1204] = i * 7;
+      data[1205] = i % 3;
+      detector.check(data);
+    }
+  EXPECT_TRUE(detector.done());
+  EXPECT_EQ(detector.model(), MODEL_64E);
+  EXPECT_EQ(detector.productId(), 0);
+  EXPECT_EQ(detector.returnMode(), 0);
+}
+
+TEST(ModelDetector, constant_zero_bytes)
+{
+  // bytes that stay zero tell nothing about the model
+  ModelDetector detector = detect(0, 0);
+  EXPECT_TRUE(detector.done());
+  EXPECT_EQ(detector.model(), -1);
+  EXPECT_EQ(detector.productId(), 0);
+  EXPECT_EQ(detector.returnMode(), 0);
+}
+
+TEST(ModelDetector, reset)
+{
+  ModelDetector detector;
+  uint8_t data[1206];
+  memset(data, 0, sizeof(data));
+  for (int i = 0; i < 16; ++i)
+    {
+      data[1205] = i;
+      detector.check(data);
+    }
+  EXPECT_EQ(detector.model(), MODEL_64E);
+
+  // after a reset, earlier packets no longer count
+  detector.reset();
+  EXPECT_FALSE(detector.done());
+  EXPECT_EQ(detector.model(), -1);
+  data[1204] = 0x39;
+  data[1205] = 0x21;
+  for (int i = 0; i < 16; ++i)
+    detector.check(data);
+  EXPECT_EQ(detector.model(), MODEL_32E);
+  EXPECT_EQ(detector.returnMode(), RETURN_DUAL);
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
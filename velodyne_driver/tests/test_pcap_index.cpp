@@ -0,0 +1,187 @@
+//
+// C++ unit tests for the capture file seek index.
+//
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include <velodyne_driver/pcap_index.h>
+#include <velodyne_driver/pcap_reader.h>
+#include "capture_builder.h"
+using namespace velodyne_driver;
+
+///////////////////////////////////////////////////////////////
+// Test data
+///////////////////////////////////////////////////////////////
+
+static const uint64_t T0 = 1500000000ull * 1000000000ull;
+static const uint64_t PACKET_NS = 1000000;
+static const int NPACKETS = 300;
+static const int PACKETS_PER_REVOLUTION = 72;   // 5 degrees per packet
+
+/** @returns azimuth of packet i, in hundredths of a degree */
+static uint16_t packetAzimuth(int i)
+{
+  return (i % PACKETS_PER_REVOLUTION) * 500;
+}
+
+/** @returns a pcapng capture of NPACKETS packets, each numbered in
+ *           its first byte, with a few other packets in between
+ */
+static std::string captureFile(void)
+{
+  CaptureBuilder capture(false);
+  capture.sectionHeader();
+  capture.interface();
+  for (int i = 0; i < NPACKETS; ++i)
+    {
+      std::vector<uint8_t> data(1206, 0);
+      data[0] = i & 0xff;
+      data[1] = i >> 8;
+      data[2] = packetAzimuth(i) & 0xff;
+      data[3] = packetAzimuth(i) >> 8;
+      capture.packet(T0 + i * PACKET_NS, 2368, data);
+      if (i % 7 == 0)                   // a position packet
+        capture.packet(T0 + i * PACKET_NS, 8308,
+                       std::vector<uint8_t>(512, 0));
+    }
+  return capture.write();
+}
+
+static PcapIndex::Filter filter(void)
+{
+  PcapIndex::Filter filter;
+  filter.port = 2368;
+  filter.src_addr = 0;
+  filter.packet_size = 1206;
+  filter.interval = 10;
+  return filter;
+}
+
+/** @returns number of the packet at an index entry */
+static int entryPacket(const std::string &name, const PcapIndex::Entry *entry)
+{
+  PcapReader reader;
+  PcapRecord rec;
+  if (!reader.open(name) || !reader.seek(entry->offset, entry->section)
+      || !reader.next(&rec))
+    return -1;
+  return rec.data[0] | (rec.data[1] << 8);
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(PcapIndex, missing_file)
+{
+  PcapIndex index;
+  EXPECT_FALSE(index.open("./no_such_file.pcap", filter()));
+  EXPECT_TRUE(index.empty());
+}
+
+TEST(PcapIndex, build)
+{
+  const std::string name = captureFile();
+  ASSERT_FALSE(name.empty());
+  PcapIndex index;
+  ASSERT_TRUE(index.open(name, filter()));
+  EXPECT_FALSE(index.empty());
+  EXPECT_EQ(index.startTime(), T0);
+  EXPECT_EQ(index.endTime(), T0 + (NPACKETS - 1) * PACKET_NS);
+  EXPECT_EQ(index.lastRevolution(),
+            (uint32_t) (NPACKETS - 1) / PACKETS_PER_REVOLUTION);
+  EXPECT_EQ(access((name + ".vidx").c_str(), R_OK), 0);
+  unlink((name + ".vidx").c_str());
+  unlink(name.c_str());
+}
+
+TEST(PcapIndex, find_time)
+{
+  const std::string name = captureFile();
+  ASSERT_FALSE(name.empty());
+  PcapIndex index;
+  ASSERT_TRUE(index.open(name, filter()));
+
+  // last entry at or before the time
+  const PcapIndex::Entry *entry = index.findTime(T0 + 55 * PACKET_NS + 1);
+  ASSERT_TRUE(entry != NULL);
+  EXPECT_EQ(entry->time_ns, T0 + 50 * PACKET_NS);
+  EXPECT_EQ(entryPacket(name, entry), 50);
+  entry = index.findTime(T0 + 60 * PACKET_NS);
+  EXPECT_EQ(entryPacket(name, entry), 60);
+
+  // before the start and after the end
+  entry = index.findTime(0);
+  EXPECT_EQ(entryPacket(name, entry), 0);
+  entry = index.findTime(T0 + NPACKETS * PACKET_NS);
+  EXPECT_EQ(entryPacket(name, entry), 290);
+
+  unlink((name + ".vidx").c_str());
+  unlink(name.c_str());
+}
+
+TEST(PcapIndex, find_revolution)
+{
+  const std::string name = captureFile();
+  ASSERT_FALSE(name.empty());
+  PcapIndex index;
+  ASSERT_TRUE(index.open(name, filter()));
+
+  for (uint32_t revolution = 0; revolution <= index.lastRevolution();
+       ++revolution)
+    {
+      // the entry precedes the start of the revolution, by less than
+      // the index interval
+      const int start = revolution * PACKETS_PER_REVOLUTION;
+      const PcapIndex::Entry *entry = index.findRevolution(revolution);
+      ASSERT_TRUE(entry != NULL);
+      const int packet = entryPacket(name, entry);
+      EXPECT_LE(packet, start) << "revolution " << revolution;
+      EXPECT_GT(packet + 10, start) << "revolution " << revolution;
+      EXPECT_EQ(entry->revolution, packet / PACKETS_PER_REVOLUTION);
+      EXPECT_EQ(entry->azimuth, packetAzimuth(packet));
+    }
+
+  unlink((name + ".vidx").c_str());
+  unlink(name.c_str());
+}
+
+TEST(PcapIndex, reload)
+{
+  const std::string name = captureFile();
+  ASSERT_FALSE(name.empty());
+  PcapIndex built;
+  ASSERT_TRUE(built.open(name, filter()));
+
+  // the saved index gives the same answers
+  PcapIndex loaded;
+  ASSERT_TRUE(loaded.open(name, filter()));
+  EXPECT_EQ(loaded.startTime(), built.startTime());
+  EXPECT_EQ(loaded.endTime(), built.endTime());
+  EXPECT_EQ(loaded.lastRevolution(), built.lastRevolution());
+  EXPECT_EQ(loaded.findRevolution(3)->offset,
+            built.findRevolution(3)->offset);
+  EXPECT_EQ(loaded.findTime(T0 + 123 * PACKET_NS)->offset,
+            built.findTime(T0 + 123 * PACKET_NS)->offset);
+
+  // another packet filter rebuilds it
+  PcapIndex::Filter other = filter();
+  other.port = 2369;
+  PcapIndex rebuilt;
+  ASSERT_TRUE(rebuilt.open(name, other));
+  EXPECT_TRUE(rebuilt.empty());
+
+  unlink((name + ".vidx").c_str());
+  unlink(name.c_str());
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
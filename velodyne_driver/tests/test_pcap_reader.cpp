@@ -0,0 +1,267 @@
+//
+// C++ unit tests for the pcap and pcapng capture file reader.
+//
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include <velodyne_driver/pcap_reader.h>
+#include "capture_builder.h"
+using namespace velodyne_driver;
+
+///////////////////////////////////////////////////////////////
+// Test data
+///////////////////////////////////////////////////////////////
+
+/** @returns a payload of n bytes filled with a given value */
+static std::vector<uint8_t> payload(size_t n, uint8_t value)
+{
+  return std::vector<uint8_t>(n, value);
+}
+
+static const uint64_t T0 = 1500000000ull * 1000000000ull;
+
+/** @returns a pcapng file of three packets in the given byte order */
+static std::string pcapngFile(bool big_endian)
+{
+  CaptureBuilder capture(big_endian);
+  capture.sectionHeader();
+  capture.interface();
+  for (int i = 0; i < 3; ++i)
+    capture.packet(T0 + i * 1333, 2368, payload(1206, i + 1));
+  return capture.write();
+}
+
+/** check the packets of pcapngFile() */
+static void expectPackets(PcapReader &reader)
+{
+  PcapRecord rec;
+  for (int i = 0; i < 3; ++i)
+    {
+      ASSERT_TRUE(reader.next(&rec)) << "packet " << i;
+      EXPECT_EQ(rec.length, 1206u);
+      EXPECT_EQ(rec.data[0], i + 1);
+      EXPECT_EQ(rec.data[1205], i + 1);
+      EXPECT_EQ(rec.dst_port, 2368);
+      EXPECT_EQ(rec.time_ns, T0 + i * 1333);
+      const uint8_t *src = reinterpret_cast<const uint8_t *>(&rec.src_addr);
+      EXPECT_EQ(src[0], 192);
+      EXPECT_EQ(src[3], 201);
+    }
+  EXPECT_FALSE(reader.next(&rec));
+}
+
+/** write a file that is not a capture */
+static void writeText(const std::string &name, const char *text)
+{
+  FILE *out = fopen(name.c_str(), "w");
+  ASSERT_TRUE(out != NULL);
+  fputs(text, out);
+  fclose(out);
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(PcapReader, missing_file)
+{
+  PcapReader reader;
+  EXPECT_FALSE(reader.open("./no_such_file.pcap"));
+  EXPECT_FALSE(reader.isOpen());
+}
+
+TEST(PcapReader, pcap_usec)
+{
+  for (int big_endian = 0; big_endian < 2; ++big_endian)
+    {
+      CaptureBuilder capture(big_endian);
+      capture.pcapHeader(false);
+      capture.pcapRecord(1500000000, 250, 2368, payload(1206, 7));
+      capture.pcapRecord(1500000000, 251, 8308, payload(512, 8));
+      const std::string name = capture.write();
+      ASSERT_FALSE(name.empty());
+
+      PcapReader reader;
+      ASSERT_TRUE(reader.open(name));
+      PcapRecord rec;
+      ASSERT_TRUE(reader.next(&rec));
+      EXPECT_EQ(rec.length, 1206u);
+      EXPECT_EQ(rec.data[0], 7);
+      EXPECT_EQ(rec.dst_port, 2368);
+      EXPECT_EQ(rec.time_ns, T0 + 250000);
+      ASSERT_TRUE(reader.next(&rec));
+      EXPECT_EQ(rec.length, 512u);
+      EXPECT_EQ(rec.dst_port, 8308);
+      EXPECT_EQ(rec.time_ns, T0 + 251000);
+      EXPECT_FALSE(reader.next(&rec));
+      unlink(name.c_str());
+    }
+}
+
+TEST(PcapReader, pcap_nsec)
+{
+  CaptureBuilder capture(false);
+  capture.pcapHeader(true);
+  capture.pcapRecord(1500000000, 250, 2368, payload(1206, 7));
+  const std::string name = capture.write();
+  ASSERT_FALSE(name.empty());
+
+  PcapReader reader;
+  ASSERT_TRUE(reader.open(name));
+  PcapRecord rec;
+  ASSERT_TRUE(reader.next(&rec));
+  EXPECT_EQ(rec.time_ns, T0 + 250);
+  unlink(name.c_str());
+}
+
+TEST(PcapReader, pcapng_little_endian)
+{
+  const std::string name = pcapngFile(false);
+  ASSERT_FALSE(name.empty());
+  PcapReader reader;
+  ASSERT_TRUE(reader.open(name));
+  expectPackets(reader);
+  unlink(name.c_str());
+}
+
+TEST(PcapReader, pcapng_big_endian)
+{
+  const std::string name = pcapngFile(true);
+  ASSERT_FALSE(name.empty());
+  PcapReader reader;
+  ASSERT_TRUE(reader.open(name));
+  expectPackets(reader);
+  unlink(name.c_str());
+}
+
+TEST(PcapReader, pcapng_sections_of_both_orders)
+{
+  CaptureBuilder big(true);
+  big.sectionHeader();
+  big.interface();
+  big.packet(T0, 2368, payload(1206, 1));
+  const size_t second = big.size();
+
+  CaptureBuilder little(false);
+  little.sectionHeader();
+  little.interface();
+  little.packet(T0 + 1333, 2368, payload(1206, 2));
+  little.packet(T0 + 2666, 2368, payload(1206, 3));
+
+  // append the little-endian section to the big-endian one
+  const std::string first_name = big.write();
+  const std::string second_name = little.write();
+  ASSERT_FALSE(first_name.empty());
+  ASSERT_FALSE(second_name.empty());
+  FILE *out = fopen(first_name.c_str(), "ab");
+  FILE *in = fopen(second_name.c_str(), "rb");
+  ASSERT_TRUE(out != NULL && in != NULL);
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    fwrite(buf, 1, n, out);
+  fclose(in);
+  fclose(out);
+  unlink(second_name.c_str());
+
+  PcapReader reader;
+  ASSERT_TRUE(reader.open(first_name));
+  PcapRecord first;
+  ASSERT_TRUE(reader.next(&first));
+  EXPECT_EQ(first.section, 0u);
+  PcapRecord rec;
+  ASSERT_TRUE(reader.next(&rec));
+  EXPECT_EQ(rec.section, second);
+  EXPECT_EQ(rec.time_ns, T0 + 1333);
+  ASSERT_TRUE(reader.next(&rec));
+  EXPECT_EQ(rec.data[0], 3);
+  EXPECT_FALSE(reader.next(&rec));
+
+  // seeking back restores the byte order of the first section
+  ASSERT_TRUE(reader.seek(first.offset, first.section));
+  ASSERT_TRUE(reader.next(&rec));
+  EXPECT_EQ(rec.data[0], 1);
+  EXPECT_EQ(rec.time_ns, T0);
+  unlink(first_name.c_str());
+}
+
+TEST(PcapReader, rewind)
+{
+  const std::string name = pcapngFile(true);
+  ASSERT_FALSE(name.empty());
+  PcapReader reader;
+  ASSERT_TRUE(reader.open(name));
+  PcapRecord rec;
+  while (reader.next(&rec))
+    continue;
+  reader.rewind();
+  expectPackets(reader);
+  unlink(name.c_str());
+}
+
+TEST(PcapFileSet, directory)
+{
+  char dir[] = "/tmp/velodyne_captures.XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir) != NULL);
+  const std::string prefix = std::string(dir) + "/";
+
+  // the second capture by name is the first in time
+  const char *names[] = {"a.pcap", "b.pcapng"};
+  for (int f = 0; f < 2; ++f)
+    {
+      CaptureBuilder capture(false);
+      capture.sectionHeader();
+      capture.interface();
+      capture.packet(T0 + (1 - f) * 1000000, 2368, payload(1206, f + 1));
+      const std::string name = capture.write();
+      ASSERT_FALSE(name.empty());
+      ASSERT_EQ(rename(name.c_str(), (prefix + names[f]).c_str()), 0);
+    }
+  writeText(prefix + "a.pcap.vidx", "VIDX");
+  writeText(prefix + "README", "not a capture\n");
+  writeText(prefix + "empty", "");
+
+  PcapFileSet files;
+  ASSERT_TRUE(files.open(dir));
+  ASSERT_EQ(files.size(), 2u);
+  EXPECT_EQ(files.name(0), prefix + "b.pcapng");
+  EXPECT_EQ(files.name(1), prefix + "a.pcap");
+  PcapRecord rec;
+  ASSERT_TRUE(files.next(&rec));
+  EXPECT_EQ(rec.data[0], 2);
+  ASSERT_TRUE(files.next(&rec));
+  EXPECT_EQ(rec.data[0], 1);
+  EXPECT_FALSE(files.next(&rec));
+
+  const char *all[] = {"a.pcap", "b.pcapng", "a.pcap.vidx", "README",
+                       "empty"};
+  for (int f = 0; f < 5; ++f)
+    unlink((prefix + all[f]).c_str());
+  rmdir(dir);
+}
+
+TEST(PcapFileSet, directory_without_captures)
+{
+  char dir[] = "/tmp/velodyne_captures.XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir) != NULL);
+  const std::string name = std::string(dir) + "/README";
+  writeText(name, "not a capture\n");
+
+  PcapFileSet files;
+  EXPECT_FALSE(files.open(dir));
+  unlink(name.c_str());
+  rmdir(dir);
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
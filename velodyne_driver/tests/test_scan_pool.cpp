@@ -0,0 +1,103 @@
+//
+// C++ unit tests for the pool of reusable scan messages.
+//
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <velodyne_driver/scan_pool.h>
+using namespace velodyne_driver;
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(ScanPool, new_scan)
+{
+  ScanPool pool(4);
+  velodyne_msgs::VelodyneScanPtr scan = pool.get(78);
+  ASSERT_TRUE(scan);
+  EXPECT_EQ(scan->packets.size(), 78u);
+}
+
+TEST(ScanPool, reuse)
+{
+  ScanPool pool(4);
+  velodyne_msgs::VelodyneScanPtr scan = pool.get(78);
+  const velodyne_msgs::VelodyneScan *first = scan.get();
+  const velodyne_msgs::VelodynePacket *packets = &scan->packets[0];
+  scan->packets[5].data[0] = 42;
+  scan.reset();
+
+  // the released scan comes back, keeping its packets
+  scan = pool.get(78);
+  EXPECT_EQ(scan.get(), first);
+  EXPECT_EQ(&scan->packets[0], packets);
+  EXPECT_EQ(scan->packets[5].data[0], 42);
+}
+
+TEST(ScanPool, resize)
+{
+  ScanPool pool(4);
+  pool.get(78);
+  velodyne_msgs::VelodyneScanPtr scan = pool.get(100);
+  EXPECT_EQ(scan->packets.size(), 100u);
+  scan.reset();
+  scan = pool.get(10);
+  EXPECT_EQ(scan->packets.size(), 10u);
+}
+
+TEST(ScanPool, shared_holders)
+{
+  // the scan only returns when its last holder drops it
+  ScanPool pool(4);
+  velodyne_msgs::VelodyneScanPtr scan = pool.get(78);
+  velodyne_msgs::VelodyneScanConstPtr subscriber = scan;
+  const velodyne_msgs::VelodyneScan *first = scan.get();
+  scan.reset();
+  velodyne_msgs::VelodyneScanPtr other = pool.get(78);
+  EXPECT_NE(other.get(), first);
+  subscriber.reset();
+  other = pool.get(78);
+  EXPECT_EQ(other.get(), first);
+}
+
+TEST(ScanPool, max_free)
+{
+  // scans released beyond the pool size are deleted
+  ScanPool pool(2);
+  std::vector<velodyne_msgs::VelodyneScanPtr> scans;
+  for (int i = 0; i < 5; ++i)
+    scans.push_back(pool.get(78));
+  std::vector<const velodyne_msgs::VelodyneScan *> released;
+  for (int i = 0; i < 5; ++i)
+    released.push_back(scans[i].get());
+  scans.clear();
+
+  // the first two released are reused, then new ones are allocated
+  velodyne_msgs::VelodyneScanPtr a = pool.get(78);
+  velodyne_msgs::VelodyneScanPtr b = pool.get(78);
+  EXPECT_TRUE(a.get() == released[0] || a.get() == released[1]);
+  EXPECT_TRUE(b.get() == released[0] || b.get() == released[1]);
+  EXPECT_NE(a.get(), b.get());
+}
+
+TEST(ScanPool, outlives_pool)
+{
+  // a scan still held when the pool is gone is deleted on release
+  velodyne_msgs::VelodyneScanPtr scan;
+  {
+    ScanPool pool(4);
+    scan = pool.get(78);
+  }
+  scan->packets[0].data[0] = 1;
+  scan.reset();
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,114 @@
+//
+// C++ unit tests for the packet loss check.
+//
+
+#include <gtest/gtest.h>
+
+#include <velodyne_driver/sequence_check.h>
+using namespace velodyne_driver;
+
+///////////////////////////////////////////////////////////////
+// Test data
+///////////////////////////////////////////////////////////////
+
+static const double PACKET_RATE = 754.0;     // 32E packets per second
+static const double PERIOD_USEC = 1e6 / PACKET_RATE;
+static const int AZIMUTH_STEP = 20;     // hundredths of a degree
+
+/** @returns packet number n of the stream, time stamped from usec0 */
+static velodyne_msgs::VelodynePacket packet(int n, uint32_t usec0 = 0,
+                                            bool clock = true)
+{
+  velodyne_msgs::VelodynePacket pkt;
+  pkt.data.fill(0);
+  const uint32_t usec = clock?
+    (usec0 + (uint32_t) lrint(n * PERIOD_USEC)) % 3600000000u: 0;
+  const uint16_t azimuth = (n * AZIMUTH_STEP) % 36000;
+  pkt.data[2] = azimuth & 0xff;
+  pkt.data[3] = azimuth >> 8;
+  pkt.data[1200] = usec & 0xff;
+  pkt.data[1201] = (usec >> 8) & 0xff;
+  pkt.data[1202] = (usec >> 16) & 0xff;
+  pkt.data[1203] = usec >> 24;
+  return pkt;
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(SequenceCheck, no_loss)
+{
+  SequenceCheck sequence;
+  sequence.setPacketRate(PACKET_RATE);
+  for (int n = 0; n < 5000; ++n)
+    EXPECT_EQ(sequence.check(packet(n)), 0u) << "packet " << n;
+  EXPECT_EQ(sequence.gaps(), 0u);
+  EXPECT_EQ(sequence.missing(), 0u);
+}
+
+TEST(SequenceCheck, gaps)
+{
+  SequenceCheck sequence;
+  sequence.setPacketRate(PACKET_RATE);
+  for (int n = 0; n < 100; ++n)
+    sequence.check(packet(n));
+  EXPECT_EQ(sequence.check(packet(101)), 1u);
+  EXPECT_EQ(sequence.check(packet(102)), 0u);
+  EXPECT_EQ(sequence.check(packet(110)), 7u);
+  EXPECT_EQ(sequence.gaps(), 2u);
+  EXPECT_EQ(sequence.missing(), 8u);
+}
+
+TEST(SequenceCheck, top_of_hour)
+{
+  // the time stamps wrap around at the top of the hour
+  SequenceCheck sequence;
+  sequence.setPacketRate(PACKET_RATE);
+  const uint32_t usec0 = 3600000000u - 50 * PERIOD_USEC;
+  for (int n = 0; n < 100; ++n)
+    EXPECT_EQ(sequence.check(packet(n, usec0)), 0u) << "packet " << n;
+  EXPECT_EQ(sequence.check(packet(103, usec0)), 3u);
+}
+
+TEST(SequenceCheck, azimuth_without_clock)
+{
+  // without time stamps, the learned azimuth step tells the loss
+  SequenceCheck sequence;
+  sequence.setPacketRate(PACKET_RATE);
+  for (int n = 0; n < 100; ++n)
+    EXPECT_EQ(sequence.check(packet(n, 0, false)), 0u) << "packet " << n;
+  EXPECT_EQ(sequence.check(packet(104, 0, false)), 4u);
+  EXPECT_EQ(sequence.missing(), 4u);
+}
+
+TEST(SequenceCheck, reset)
+{
+  // a replay starting over is not a loss
+  SequenceCheck sequence;
+  sequence.setPacketRate(PACKET_RATE);
+  for (int n = 0; n < 100; ++n)
+    sequence.check(packet(n));
+  sequence.reset();
+  for (int n = 0; n < 100; ++n)
+    EXPECT_EQ(sequence.check(packet(n)), 0u) << "packet " << n;
+  EXPECT_EQ(sequence.gaps(), 0u);
+}
+
+TEST(SequenceCheck, jump_without_reset)
+{
+  // the same jump, unannounced, is counted
+  SequenceCheck sequence;
+  sequence.setPacketRate(PACKET_RATE);
+  for (int n = 0; n < 100; ++n)
+    sequence.check(packet(n));
+  EXPECT_GT(sequence.check(packet(0)), 0u);
+  EXPECT_EQ(sequence.gaps(), 1u);
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
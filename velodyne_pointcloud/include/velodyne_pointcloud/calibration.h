@@ -12,8 +12,11 @@
 #ifndef __VELODYNE_CALIBRATION_H
 #define __VELODYNE_CALIBRATION_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <map>
 #include <string>
+#include <boost/shared_ptr.hpp>
 
 namespace velodyne_pointcloud {
 
@@ -51,6 +54,41 @@ namespace velodyne_pointcloud {
     int laser_ring;                        ///< ring number for this laser
   };
 
+  /** \brief Corrections of all lasers, laid out for decoding.
+   *
+   * One array per value, indexed by laser number, each starting on a
+   * cache line.  The decode loops read the values of consecutive
+   * lasers from consecutive addresses, instead of walking the
+   * laser_corrections map for every point.  Lasers missing from the
+   * calibration have all values zero.
+   */
+  struct CorrectionTable {
+
+    static const int MAX_LASERS = 64;
+
+    alignas(64) float rot_correction[MAX_LASERS];
+    alignas(64) float cos_rot_correction[MAX_LASERS];
+    alignas(64) float sin_rot_correction[MAX_LASERS];
+    alignas(64) float cos_vert_correction[MAX_LASERS];
+    alignas(64) float sin_vert_correction[MAX_LASERS];
+    alignas(64) float dist_correction[MAX_LASERS];
+    alignas(64) float dist_correction_x[MAX_LASERS];
+    alignas(64) float dist_correction_y[MAX_LASERS];
+    alignas(64) float vert_offset_correction[MAX_LASERS];
+    alignas(64) float horiz_offset_correction[MAX_LASERS];
+    alignas(64) float min_intensity[MAX_LASERS];
+    alignas(64) float max_intensity[MAX_LASERS];
+    alignas(64) float focal_distance[MAX_LASERS];
+    alignas(64) float focal_slope[MAX_LASERS];
+    alignas(64) uint8_t two_pt_correction_available[MAX_LASERS];
+    alignas(64) uint16_t laser_ring[MAX_LASERS];
+
+    /** heap allocation honouring the alignment, which plain new
+     *  does not before C++17 */
+    static void *operator new(size_t size);
+    static void operator delete(void *p);
+  };
+
   /** \brief Calibration information for the entire device. */
   class Calibration {
 
@@ -61,6 +99,9 @@ namespace velodyne_pointcloud {
     bool initialized;
     bool ros_info;
 
+    /** laser_corrections as compiled for decoding */
+    boost::shared_ptr<const CorrectionTable> table;
+
   public:
 
     Calibration(bool info=true):
@@ -74,6 +115,10 @@ namespace velodyne_pointcloud {
 
     void read(const std::string& calibration_file);
     void write(const std::string& calibration_file);
+
+    /** \brief Compile laser_corrections into a new table, after
+     * changing them (read() does it). */
+    void compile();
   };
   
 } /* velodyne_pointcloud */
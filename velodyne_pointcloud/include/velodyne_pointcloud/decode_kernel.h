@@ -0,0 +1,99 @@
+/* -*- mode: C++ -*-
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Vectorised decoding of the points of a Velodyne data block.
+ *
+ *  The kernel computes the coordinates, corrected intensity and
+ *  distance of up to 32 points at once, eight lanes at a time, with
+ *  the formulas of the scalar decode loops in RawData.  It is written
+ *  with GCC vector extensions, so the same source compiles to SSE2,
+ *  AVX2 or NEON instructions.  On x86 an AVX2 and FMA build is chosen
+ *  at run time when the CPU supports it.
+ *
+ *  The caller gathers the raw values and the azimuth of each lane
+ *  beforehand, and filters the points afterwards.  Results match the
+ *  scalar loops to within float rounding: the scalar two point
+ *  correction is computed in double.
+ */
+
+#ifndef __VELODYNE_DECODE_KERNEL_H
+#define __VELODYNE_DECODE_KERNEL_H
+
+#include <vector>
+#include <velodyne_pointcloud/calibration.h>
+
+namespace velodyne_rawdata {
+
+/** most points decoded by one call, a data block */
+static const int KERNEL_MAX_LANES = 32;
+
+/** options of a DecodeKernel call */
+enum DecodeFlags
+{
+  /** the focal intensity correction has a quadratic distance term;
+   *  the VLP loop uses 256 instead */
+  DECODE_FOCAL_QUADRATIC = 0x1,
+  /** cos_rot and sin_rot already have the rot_correction of each
+   *  laser subtracted */
+  DECODE_ROT_CORRECTED = 0x2,
+  /** raw_intensity already has the focal correction added, only
+   *  clamp it */
+  DECODE_FOCAL_CORRECTED = 0x4
+};
+
+/** raw values of each lane */
+struct KernelInput
+{
+  alignas(32) float raw_distance[KERNEL_MAX_LANES];
+  alignas(32) float raw_intensity[KERNEL_MAX_LANES];
+  alignas(32) float cos_rot[KERNEL_MAX_LANES]; ///< of the azimuth fired at
+  alignas(32) float sin_rot[KERNEL_MAX_LANES];
+};
+
+/** decoded values of each lane, in the ROS coordinate system */
+struct KernelOutput
+{
+  alignas(32) float x[KERNEL_MAX_LANES];
+  alignas(32) float y[KERNEL_MAX_LANES];
+  alignas(32) float z[KERNEL_MAX_LANES];
+  alignas(32) float intensity[KERNEL_MAX_LANES];
+  alignas(32) float distance[KERNEL_MAX_LANES]; ///< for the range filter
+};
+
+/** Decode lanes points: lane i was fired by laser
+ *  first_laser + i % lasers.  Both lanes and lasers are multiples
+ *  of 8, so each group of 8 lanes reads 8 consecutive lasers.
+ *
+ *  @param flags DecodeFlags mask
+ */
+typedef void (*DecodeKernel)(const velodyne_pointcloud::CorrectionTable& table,
+                             int first_laser, int lasers, int lanes,
+                             float distance_resolution, int flags,
+                             const KernelInput& in, KernelOutput* out);
+
+/** a build of the kernel, by the instruction set it uses */
+struct DecodeKernelVariant
+{
+  const char* name;
+  DecodeKernel kernel;
+};
+
+/** @returns every kernel this CPU runs, the baseline first and the
+ *           fastest last, so tests can compare them
+ */
+std::vector<DecodeKernelVariant> decodeKernels();
+
+/** @returns the fastest kernel this CPU runs
+ *  @param name set to the instruction set it uses
+ */
+DecodeKernel selectDecodeKernel(const char** name);
+
+} // namespace velodyne_rawdata
+
+#endif // __VELODYNE_DECODE_KERNEL_H
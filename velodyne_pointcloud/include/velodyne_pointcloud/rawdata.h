@@ -28,8 +28,10 @@
 
 #include <pcl_ros/point_cloud.h>
 #include <ros/ros.h>
+#include <velodyne_driver/model.h>
 #include <velodyne_msgs/VelodyneScan.h>
 #include <velodyne_pointcloud/calibration.h>
+#include <velodyne_pointcloud/decode_kernel.h>
 
 #include <utils/point_cloud/point_types.h>
 
@@ -50,25 +52,27 @@ static const float ROTATION_RESOLUTION = 0.01f;    // [deg]
 static const uint16_t ROTATION_MAX_UNITS = 36000u; // [deg/100]
 static const float DISTANCE_RESOLUTION = 0.002f;   // [m]
 
+/** the corrected trig table quantises rot_correction to 0.001 degree */
+static const int TRIG_TABLE_SCALE = 10;            // [units/(deg/100)]
+static const int TRIG_TABLE_UNITS = ROTATION_MAX_UNITS * TRIG_TABLE_SCALE;
+
 /** @todo make this work for both big and little-endian machines */
 static const uint16_t UPPER_BANK = 0xeeff;
 static const uint16_t LOWER_BANK = 0xddff;
 
-/** Special defines for VLP support **/
-typedef struct vlp_spec
+/** Returns decoded from dual return packets.
+ *
+ *  Dual return packets hold pairs of blocks from the same firings: the
+ *  even block the last return, the odd block the strongest one.  If a
+ *  laser saw only one return, both blocks report it.
+ */
+enum DualReturnPolicy
 {
-  int firing_seqs_per_block;
-  int lasers_per_firing_seq;
-  int lasers_per_firing;
-  float firing_duration;     // [us]
-  float firing_seq_duration; // [us]
-  float block_duration;      // [us] = firing_seq_duration * firing_seqs_per_block
-  float distance_resolution; // [us]
-} vlp_spec_t;
-
-static const vlp_spec_t VLP_16_SPEC = { 2, 16, 1, 2.304f, 55.296f, 110.592f, 0.002f };
-
-static const vlp_spec_t VLP_32_SPEC = { 1, 32, 2, 2.304f, 55.296f, 55.296f, 0.004f };
+  DUAL_STRONGEST,  ///< odd blocks only
+  DUAL_LAST,       ///< even blocks only
+  DUAL_BOTH,       ///< all blocks
+  DUAL_BOTH_DEDUP  ///< all blocks, without returns reported twice
+};
 
 /** \brief Raw Velodyne data block.
  *
@@ -99,6 +103,11 @@ static const int PACKET_SIZE = 1206;
 static const int BLOCKS_PER_PACKET = 12;
 static const int PACKET_STATUS_SIZE = 4;
 static const int SCANS_PER_PACKET = (SCANS_PER_BLOCK * BLOCKS_PER_PACKET);
+static const int MAX_POINTS_PER_PACKET = SCANS_PER_PACKET;
+
+/** return mode factory byte, on all but the HDL-64E */
+static const int RETURN_MODE_OFFSET = 1204;
+static const uint8_t RETURN_MODE_DUAL = 0x39;
 
 /** \brief Raw Velodyne packet.
  *
@@ -141,13 +150,63 @@ class RawData
    */
   int setup(ros::NodeHandle private_nh);
 
+  /** \brief Options setup() reads from ROS parameters. */
+  struct Options
+  {
+    Options():
+      dual_policy(DUAL_BOTH_DEDUP),
+      kernel(NULL),
+      intensity_tables(false),
+      trig_tables(false)
+    {}
+
+    std::string device_model;    ///< model name, "" to guess it
+    DualReturnPolicy dual_policy;
+    DecodeKernel kernel;         ///< NULL to decode a point at a time
+    bool intensity_tables;       ///< look up the focal correction
+    bool trig_tables;            ///< look up each laser's azimuth trig
+  };
+
+  /** \brief Set up for data processing without a ROS node, for
+   *         example in unit tests.
+   *
+   *  @param calibration_file device-specific angles calibration
+   *  @param options as setup() reads them
+   *  @returns 0 if successful;
+   *           errno value for failure
+   */
+  int setupOffline(const std::string& calibration_file, const Options& options);
+
   /**
    * Unpack pkt points, filter based on configuration, and add OK points to pc.
+   * The first packets also tell the model and return mode of the device.
    * @param pkt velodyne UDP packet payload (no UDP header)
    * @param pc output pointcloud that we add data to
    * @return azimuth value of the last point in pkt if VLP otherwise -1.0
    */
-  float unpackAndAdd(const velodyne_msgs::VelodynePacket& pkt, VPointCloud& pc) const;
+  float unpackAndAdd(const velodyne_msgs::VelodynePacket& pkt, VPointCloud& pc);
+
+  /**
+   * Unpack pkt points, filter based on configuration, and write OK points
+   * to a buffer the caller reserved, without growing a cloud a point at
+   * a time.
+   * @param pkt velodyne UDP packet payload (no UDP header)
+   * @param out room for MAX_POINTS_PER_PACKET points
+   * @param slice_angle if not NULL, set to what unpackAndAdd returns
+   * @return number of points written
+   */
+  int unpack(const velodyne_msgs::VelodynePacket& pkt, VPoint* out, float* slice_angle = NULL);
+
+  /** @returns most points a revolution at rpm unpacks to, for
+   *           reserving clouds; depends on the model and return mode
+   *           detected so far */
+  size_t pointsPerRevolution(double rpm) const;
+
+  /** @returns velodyne_driver::ModelId being decoded */
+  int model() const
+  {
+    return model_;
+  }
 
   void setParameters(double min_range, double max_range, double view_direction, double view_width);
 
@@ -171,14 +230,129 @@ class RawData
    * Calibration file
    */
   velodyne_pointcloud::Calibration calibration_;
-  vlp_spec_t vlp_spec_;
-  bool is_vlp_; // whether or not device model is VLP
+  int model_;   ///< velodyne_driver::ModelId being decoded
+  int return_mode_; ///< velodyne_driver::ReturnMode, 0 if unknown
+  DualReturnPolicy dual_policy_;
+  velodyne_driver::ModelDetector detector_;
   float sin_rot_table_[ROTATION_MAX_UNITS];
   float cos_rot_table_[ROTATION_MAX_UNITS];
-  std::vector<std::vector<ros::Duration>> timing_offsets_;
+  /** firing time of each point, of single and of dual return packets */
+  std::vector<std::vector<ros::Duration>> timing_offsets_[2];
+  DecodeKernel kernel_; ///< NULL to decode a point at a time
+
+  /** cos and sin of an azimuth, one cache access for both */
+  struct Trig
+  {
+    float cos;
+    float sin;
+  };
+
+  /** Trig of all azimuths in TRIG_TABLE_UNITS, shared by the lasers;
+   *  empty unless ~trig_tables is set.  Laser l reads the azimuth
+   *  less its rot_correction at an index offset by trig_offset_[l].
+   */
+  std::vector<Trig> trig_table_;
+  int trig_offset_[velodyne_pointcloud::CorrectionTable::MAX_LASERS];
+
+  void buildTrigTable();
+
+  /** focal intensity correction of each laser, for raw distances
+   *  >> focal_shift_, focal_size_ of them a laser; empty unless
+   *  ~intensity_tables is set */
+  std::vector<float> focal_table_;
+  int focal_shift_;
+  int focal_size_;
+  bool intensity_tables_;
+
+  void buildFocalTable(bool focal_quadratic);
+
+  /** unpack function specialised for the model */
+  typedef int (RawData::*UnpackFn)(const velodyne_msgs::VelodynePacket& pkt, VPoint* out, float& angle) const;
+  UnpackFn unpack_; ///< NULL if packets cannot be decoded
+
+  void selectModel(int model);
+  void detectModel(const velodyne_msgs::VelodynePacket& pkt);
+
+  /** unpack HDL-64E and HDL-32E packets, with upper and lower banks */
+  template <int MODEL>
+  int unpack_hdl(const velodyne_msgs::VelodynePacket& pkt, VPoint* out, float& angle) const;
 
   /** add private function to handle the VLP16 and VLP32 **/
-  float unpack_vlp(const velodyne_msgs::VelodynePacket& pkt, VPointCloud& pc) const;
+  template <int MODEL>
+  int unpack_vlp(const velodyne_msgs::VelodynePacket& pkt, VPoint* out, float& angle) const;
+
+  /** the same, decoding a block at a time with kernel_ */
+  template <int MODEL>
+  int unpack_hdl_simd(const velodyne_msgs::VelodynePacket& pkt, VPoint* out, float& angle) const;
+  template <int MODEL>
+  int unpack_vlp_simd(const velodyne_msgs::VelodynePacket& pkt, VPoint* out, float& angle) const;
+
+  template <int MODEL>
+  UnpackFn hdlUnpacker() const
+  {
+    return kernel_? &RawData::unpack_hdl_simd<MODEL>: &RawData::unpack_hdl<MODEL>;
+  }
+
+  template <int MODEL>
+  UnpackFn vlpUnpacker() const
+  {
+    return kernel_? &RawData::unpack_vlp_simd<MODEL>: &RawData::unpack_vlp<MODEL>;
+  }
+
+  /** in-line test whether a packet holds dual returns, by its own
+   *  return mode byte, so packets decode right before the model is
+   *  detected and when the device switches mode */
+  bool dualReturn(const velodyne_msgs::VelodynePacket &pkt) const
+  {
+    return velodyne_driver::MODELS[model_].product_id != 0
+      && pkt.data[RETURN_MODE_OFFSET] == RETURN_MODE_DUAL;
+  }
+
+  /** in-line test whether a dual return block is decoded at all */
+  bool decodeBlock(int block) const
+  {
+    return (dual_policy_ != DUAL_STRONGEST || (block & 1))
+      && (dual_policy_ != DUAL_LAST || !(block & 1));
+  }
+
+  /** in-line test whether the strongest return at offset k of a
+   *  block is the last return of its pair, by raw distance and
+   *  intensity */
+  static bool sameReturn(const raw_block_t& last, const raw_block_t& strongest, int k)
+  {
+    return last.data[k] == strongest.data[k]
+      && last.data[k+1] == strongest.data[k+1]
+      && last.data[k+2] == strongest.data[k+2];
+  }
+
+  /** in-line lookup of the trig of an azimuth less the
+   *  rot_correction of a laser, when trig_table_ is built */
+  const Trig& correctedTrig(int azimuth, int laser) const
+  {
+    int index = azimuth * TRIG_TABLE_SCALE + trig_offset_[laser];
+    if (index >= TRIG_TABLE_UNITS) {
+      index -= TRIG_TABLE_UNITS;
+    }
+    return trig_table_[index];
+  }
+
+  /** in-line lookup of the focal intensity correction of a point,
+   *  when focal_table_ is built */
+  float focalCorrection(int laser, uint16_t raw_distance) const
+  {
+    return focal_table_[laser * focal_size_ + (raw_distance >> focal_shift_)];
+  }
+
+  /** in-line test whether an azimuth is within the view angles */
+  bool azimuthInView(int azimuth) const
+  {
+    return (azimuth >= config_.min_angle
+            && azimuth <= config_.max_angle
+            && config_.min_angle < config_.max_angle)
+      || (config_.min_angle > config_.max_angle
+          && (azimuth <= config_.max_angle
+              || azimuth >= config_.min_angle));
+  }
 
   /** in-line test whether a point is in range */
   bool pointInRange(float range) const
@@ -186,7 +360,7 @@ class RawData
     return (range >= config_.min_range && range <= config_.max_range);
   }
 
-  static std::vector<std::vector<ros::Duration>> getVLP32TimingOffsets();
+  static std::vector<std::vector<ros::Duration>> getVLP32TimingOffsets(bool dual_mode);
 };
 
 } // namespace velodyne_rawdata
@@ -15,15 +15,43 @@
 
 #include "convert.h"
 
+#include <angles/angles.h>
 #include <pcl_conversions/pcl_conversions.h>
 
 namespace velodyne_pointcloud {
 /** @brief Constructor. */
-Convert::Convert(ros::NodeHandle node, ros::NodeHandle private_nh)
-  : data_(new velodyne_rawdata::RawData()), prev_azimuth_(0.0)
+Convert::Convert(ros::NodeHandle node, ros::NodeHandle private_nh, bool subscribe)
+  : data_(new velodyne_rawdata::RawData()), accumulated_points_(0),
+    cut_azimuth_(0.0), rpm_(600.0),
+    publish_sectors_(false), sector_begin_(0), sector_start_(0.0)
 {
   data_->setup(private_nh);
 
+  // sweeps end where the device passes cut_angle, like the driver's
+  // scans if it cuts them at the same angle, so each scan completes
+  // a sweep as soon as it arrives
+  double cut_angle;
+  private_nh.param("cut_angle", cut_angle, 0.0);
+  if (cut_angle < 0.0 || cut_angle >= 2 * M_PI) {
+    cut_angle = 0.0;
+  }
+
+  // also publish the points of each sector as soon as it is complete,
+  // matching the driver's sector scans?
+  double sector_angle;
+  private_nh.param("sector_angle", sector_angle, 0.0);
+  cut_.setCutAngle(cut_angle, sector_angle);
+  cut_azimuth_ = angles::to_degrees(cut_angle);
+  publish_sectors_ = cut_.sectors() > 1;
+  sector_start_ = cut_azimuth_;
+
+  // the accumulated cloud keeps room for a whole sweep at this rate
+  private_nh.param("rpm", rpm_, 600.0);
+  if (rpm_ <= 0.0) {
+    rpm_ = 600.0;
+  }
+  sector_cloud_.height = 1;
+
   accumulated_cloud_.width = 0;
   accumulated_cloud_.height = 1;
 
@@ -47,17 +75,31 @@ Convert::Convert(ros::NodeHandle node, ros::NodeHandle private_nh)
       node.advertise<velodyne_msgs::VelodyneDeskewInfo>("velodyne_deskew_info", 10))
     ->trace(trace_frame_);
 
+  if (publish_sectors_) {
+    ROS_INFO("publishing %d sectors per sweep", cut_.sectors());
+    sector_publisher_ =
+      diagnostics_utils::createPublisherWrapper<velodyne_rawdata::VPointCloud>(
+        node.advertise<sensor_msgs::PointCloud2>("velodyne_sector_points", 10))
+      ->trace(trace_frame_);
+    sector_info_publisher_ =
+      diagnostics_utils::createPublisherWrapper<velodyne_msgs::VelodyneSectorInfo>(
+        node.advertise<velodyne_msgs::VelodyneSectorInfo>("velodyne_sector_info", 10))
+      ->trace(trace_frame_);
+  }
+
   srv_ = boost::make_shared<dynamic_reconfigure::Server<velodyne_pointcloud::CloudNodeConfig> >(
       private_nh);
   dynamic_reconfigure::Server<velodyne_pointcloud::CloudNodeConfig>::CallbackType f;
   f = boost::bind(&Convert::callback, this, _1, _2);
   srv_->setCallback(f);
 
-  // Add an extra entry for angle 0, for initial sweep
-  deskew_info_.sweep_info.push_back(create_sweep_entry(prev_stamp_, 0.0));
+  // Add an extra entry for the cut angle, for initial sweep
+  deskew_info_.sweep_info.push_back(create_sweep_entry(prev_stamp_, cut_azimuth_));
 
   // subscribe to VelodyneScan packets
-  velodyne_scan_ = createSubscriberWrapper(&node, "velodyne_packets", 10, &Convert::processScan, this, CALLER_INFO(), ros::TransportHints().tcpNoDelay(true));
+  if (subscribe) {
+    velodyne_scan_ = createSubscriberWrapper(&node, "velodyne_packets", 10, &Convert::processScan, this, CALLER_INFO(), ros::TransportHints().tcpNoDelay(true));
+  }
 }
 
 void Convert::callback(velodyne_pointcloud::CloudNodeConfig& config, uint32_t level)
@@ -79,60 +121,112 @@ velodyne_msgs::VelodyneSweepInfo Convert::create_sweep_entry(ros::Time stamp, fl
 void Convert::processScan(const velodyne_msgs::VelodyneScan::ConstPtr& scanMsg)
 {
   for (size_t i = 0; i < scanMsg->packets.size(); ++i) {
-    const velodyne_rawdata::raw_packet_t* raw =
-        (const velodyne_rawdata::raw_packet_t*)&scanMsg->packets[i].data[0];
+    processPacket(scanMsg->packets[i], scanMsg->header.frame_id);
+  }
+}
 
-    // azimuth corresponds to the starting sweep angle for the current packet
-    const float azimuth = float(raw->blocks[0].rotation) / 100.0;
+/** @brief Add the points of the next packet, publishing the sector
+ *         and sweep it completes. */
+void Convert::processPacket(const velodyne_msgs::VelodynePacket& pkt, const std::string& frame_id)
+{
+  const velodyne_rawdata::raw_packet_t* raw =
+      (const velodyne_rawdata::raw_packet_t*)&pkt.data[0];
 
-    // Keep track of the first 
-    if (start_stamp_.isZero()) {
-      start_stamp_ = scanMsg->header.stamp;
-    }
+  // azimuth corresponds to the starting sweep angle for the current packet
+  const float azimuth = float(raw->blocks[0].rotation) / 100.0;
 
-    // azimuth value will wrap around after a full 360 degree sweep
-    if (azimuth < prev_azimuth_) {
-      // Publish data for the full sweep
-      accumulated_cloud_.header.stamp = pcl_conversions::toPCL(scanMsg->header).stamp;
-      accumulated_cloud_.header.frame_id = scanMsg->header.frame_id;
-      assert(accumulated_cloud_.width == accumulated_cloud_.points.size());
-
-      pointcloud_publisher_->publish(accumulated_cloud_, CALLER_INFO());
-
-      // timestamp gets a little screwy in the pcl conversion, so get the same timestamp and use below
-      const ros::Time cloud_stamp = pcl_conversions::fromPCL(accumulated_cloud_.header.stamp);
-
-      deskew_info_.header.stamp = cloud_stamp;
-      deskew_info_.header.frame_id = scanMsg->header.frame_id;
-      deskew_info_publisher_->publish(deskew_info_, CALLER_INFO());
-
-      // We fake a trace span that covers the lidar packet range
-      const ros::WallTime wall_now = ros::WallTime::now();
-      const ros::Time now = ros::Time::now();
-
-      const trace_msgs::TraceId trace_id = diagnostics_utils::TracePublisher::trace_id_from_stamp(trace_frame_, cloud_stamp);
-      const ros::WallTime fake_start_time = wall_now - ros::WallDuration((now - start_stamp_).toSec());
-       const ros::WallTime fake_end_time = wall_now - ros::WallDuration((now - cloud_stamp).toSec());
-      auto trace_pub = diagnostics_utils::TracePublisher::get_instance();
-      auto span_id = trace_pub->executionStarted("Sweep", CALLER_INFO(), trace_id, nullptr, fake_start_time);
-      trace_pub->executionFinished(span_id);
-
-      // Clear data we are accumulating
-      accumulated_cloud_.points.clear();
-      accumulated_cloud_.width = 0;
-      deskew_info_.sweep_info.clear();
-      start_stamp_ = ros::Time(); // zero
-
-      // Add an extra entry for angle 0, for next sweep
-      deskew_info_.sweep_info.push_back(create_sweep_entry(prev_stamp_, 0.0));
-    }
+  // Keep track of the first 
+  if (start_stamp_.isZero()) {
+    start_stamp_ = pkt.stamp;
+  }
 
-    data_->unpackAndAdd(scanMsg->packets[i], accumulated_cloud_);
+  // room for a whole sweep, kept from one sweep to the next, so
+  // points are written in place rather than copied as the cloud grows.
+  // The points of the last sweep are overwritten, and only the room a
+  // sweep takes beyond them is initialised first.
+  velodyne_rawdata::VPointCloud::VectorType& points = accumulated_cloud_.points;
+  if (points.capacity() == 0) {
+    points.reserve(data_->pointsPerRevolution(rpm_));
+  }
+  if (points.size() < accumulated_points_ + velodyne_rawdata::MAX_POINTS_PER_PACKET) {
+    points.resize(accumulated_points_ + velodyne_rawdata::MAX_POINTS_PER_PACKET);
+  }
+  accumulated_points_ += data_->unpack(pkt, &points[accumulated_points_]);
 
-    deskew_info_.sweep_info.push_back(create_sweep_entry(scanMsg->packets[i].stamp, azimuth));
-    prev_azimuth_ = azimuth;
-    prev_stamp_ = scanMsg->packets[i].stamp;
+  deskew_info_.sweep_info.push_back(create_sweep_entry(pkt.stamp, azimuth));
+  prev_stamp_ = pkt.stamp;
+
+  // publish the sector and sweep right after their last packet
+  if (cut_.check(pkt)) {
+    if (publish_sectors_) {
+      publishSector(pkt, frame_id);
+    }
+    if (cut_.revolution()) {
+      publishSweep(pkt, frame_id);
+    }
   }
 }
 
+/** @brief Publish the accumulated sweep, ending with pkt, and start the next. */
+void Convert::publishSweep(const velodyne_msgs::VelodynePacket& pkt, const std::string& frame_id)
+{
+  // Publish data for the full sweep, dropping the room left
+  accumulated_cloud_.points.resize(accumulated_points_);
+  accumulated_cloud_.width = accumulated_points_;
+  accumulated_cloud_.header.stamp = pcl_conversions::toPCL(pkt.stamp);
+  accumulated_cloud_.header.frame_id = frame_id;
+  assert(accumulated_cloud_.width == accumulated_cloud_.points.size());
+
+  pointcloud_publisher_->publish(accumulated_cloud_, CALLER_INFO());
+
+  // timestamp gets a little screwy in the pcl conversion, so get the same timestamp and use below
+  const ros::Time cloud_stamp = pcl_conversions::fromPCL(accumulated_cloud_.header.stamp);
+
+  deskew_info_.header.stamp = cloud_stamp;
+  deskew_info_.header.frame_id = frame_id;
+  deskew_info_publisher_->publish(deskew_info_, CALLER_INFO());
+
+  // We fake a trace span that covers the lidar packet range
+  const ros::WallTime wall_now = ros::WallTime::now();
+  const ros::Time now = ros::Time::now();
+
+  const trace_msgs::TraceId trace_id = diagnostics_utils::TracePublisher::trace_id_from_stamp(trace_frame_, cloud_stamp);
+  const ros::WallTime fake_start_time = wall_now - ros::WallDuration((now - start_stamp_).toSec());
+  auto trace_pub = diagnostics_utils::TracePublisher::get_instance();
+  auto span_id = trace_pub->executionStarted("Sweep", CALLER_INFO(), trace_id, nullptr, fake_start_time);
+  trace_pub->executionFinished(span_id);
+
+  // Clear data we are accumulating, keeping the points to overwrite
+  accumulated_points_ = 0;
+  accumulated_cloud_.width = 0;
+  sector_begin_ = 0;
+  deskew_info_.sweep_info.clear();
+  start_stamp_ = ros::Time(); // zero
+
+  // Add an extra entry for the cut angle, for next sweep
+  deskew_info_.sweep_info.push_back(create_sweep_entry(prev_stamp_, cut_azimuth_));
+}
+
+/** @brief Publish the points of the sector ending with pkt. */
+void Convert::publishSector(const velodyne_msgs::VelodynePacket& pkt, const std::string& frame_id)
+{
+  sector_cloud_.points.assign(accumulated_cloud_.points.begin() + sector_begin_,
+                              accumulated_cloud_.points.begin() + accumulated_points_);
+  sector_cloud_.width = sector_cloud_.points.size();
+  sector_cloud_.header.stamp = pcl_conversions::toPCL(pkt.stamp);
+  sector_cloud_.header.frame_id = frame_id;
+  sector_publisher_->publish(sector_cloud_, CALLER_INFO());
+
+  sector_info_.header.stamp = pcl_conversions::fromPCL(sector_cloud_.header.stamp);
+  sector_info_.header.frame_id = frame_id;
+  sector_info_.start_angle = sector_start_;
+  sector_info_.end_angle = cut_.passed() / 100.0;
+  sector_info_.last = cut_.revolution();
+  sector_info_publisher_->publish(sector_info_, CALLER_INFO());
+
+  // the next sector starts after these points
+  sector_begin_ = accumulated_points_;
+  sector_start_ = sector_info_.end_angle;
+}
+
 } // namespace velodyne_pointcloud
@@ -20,12 +20,14 @@
 #include <ros/ros.h>
 
 #include <sensor_msgs/PointCloud2.h>
+#include <velodyne_driver/azimuth_cut.h>
 #include <velodyne_pointcloud/rawdata.h>
 
 #include <dynamic_reconfigure/server.h>
 #include <velodyne_pointcloud/CloudNodeConfig.h>
 
 #include <velodyne_msgs/VelodyneDeskewInfo.h>
+#include <velodyne_msgs/VelodyneSectorInfo.h>
 #include <velodyne_msgs/VelodyneSweepInfo.h>
 
 #include "diagnostics_utils/instrumentation.h"
@@ -34,15 +36,28 @@ namespace velodyne_pointcloud {
 class Convert
 {
  public:
-  Convert(ros::NodeHandle node, ros::NodeHandle private_nh);
+  /** @param subscribe subscribe to velodyne_packets, unless the
+   *                   packets are passed to processPacket() directly
+   */
+  Convert(ros::NodeHandle node, ros::NodeHandle private_nh, bool subscribe = true);
   ~Convert()
   {
   }
 
+  void processPacket(const velodyne_msgs::VelodynePacket& pkt, const std::string& frame_id);
+
+  /** @returns velodyne_driver::ModelId being decoded */
+  int model() const
+  {
+    return data_->model();
+  }
+
  private:
   void callback(velodyne_pointcloud::CloudNodeConfig& config, uint32_t level);
   velodyne_msgs::VelodyneSweepInfo create_sweep_entry(ros::Time stamp, float angle);
   void processScan(const velodyne_msgs::VelodyneScan::ConstPtr& scanMsg);
+  void publishSweep(const velodyne_msgs::VelodynePacket& pkt, const std::string& frame_id);
+  void publishSector(const velodyne_msgs::VelodynePacket& pkt, const std::string& frame_id);
 
   /// Pointer to dynamic reconfigure service srv_
   boost::shared_ptr<dynamic_reconfigure::Server<velodyne_pointcloud::CloudNodeConfig> > srv_;
@@ -51,12 +66,25 @@ class Convert
   diagnostics_utils::SubscriberWrapper<velodyne_msgs::VelodyneScan> velodyne_scan_;
   diagnostics_utils::PublisherWrapper<velodyne_rawdata::VPointCloud> pointcloud_publisher_;
   diagnostics_utils::PublisherWrapper<velodyne_msgs::VelodyneDeskewInfo> deskew_info_publisher_;
+  diagnostics_utils::PublisherWrapper<velodyne_rawdata::VPointCloud> sector_publisher_;
+  diagnostics_utils::PublisherWrapper<velodyne_msgs::VelodyneSectorInfo> sector_info_publisher_;
   diagnostics_utils::TraceFrame trace_frame_ = diagnostics_utils::TraceFrame::INVALID;
 
   // make the pointcloud container a member variable to append different slices
   velodyne_rawdata::VPointCloud accumulated_cloud_;
+  size_t accumulated_points_;        ///< points of the sweep in accumulated_cloud_
   velodyne_msgs::VelodyneDeskewInfo deskew_info_;
-  float prev_azimuth_;
+  velodyne_driver::AzimuthCut cut_; ///< finds the last packet of each sweep
+  float cut_azimuth_;                ///< azimuth sweeps start at [deg]
+  double rpm_;                       ///< device rotation rate, to size sweeps
+
+  // partial clouds of the sectors of a sweep, if sector_angle is set
+  bool publish_sectors_;
+  size_t sector_begin_; ///< first point of the current sector in accumulated_cloud_
+  float sector_start_;  ///< azimuth the current sector starts at [deg]
+  velodyne_rawdata::VPointCloud sector_cloud_;
+  velodyne_msgs::VelodyneSectorInfo sector_info_;
+
   ros::Time prev_stamp_;
   ros::Time start_stamp_;
   /// configuration parameters
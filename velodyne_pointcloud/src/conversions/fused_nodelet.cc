@@ -0,0 +1,114 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This ROS nodelet reads a Velodyne 3D LIDAR and converts its
+    packets to a PointCloud2, without publishing them in between.
+
+    The driver hands each packet to the converter on the thread
+    reading the device, as soon as it is read, instead of publishing
+    a scan to the CloudNodelet.  This saves the hop through the
+    nodelet manager's queue, and a second pass over each scan, at the
+    cost of reading the device and decoding its packets on the same
+    thread.  Set ~driver/receive_thread to keep reading while a sweep
+    is published.
+
+    The driver parameters are in the ~driver namespace, the
+    converter parameters in the private namespace.  ~driver/model
+    defaults to the model decoded, as ~device_model or the
+    calibration tell.
+
+*/
+
+#include <boost/thread.hpp>
+
+#include <ros/ros.h>
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+#include <velodyne_driver/driver.h>
+
+#include "convert.h"
+
+namespace velodyne_pointcloud
+{
+  class FusedNodelet: public nodelet::Nodelet
+  {
+  public:
+
+    FusedNodelet():
+      running_(false)
+    {}
+
+    ~FusedNodelet()
+    {
+      if (running_) {
+        NODELET_INFO("shutting down driver thread");
+        running_ = false;
+        deviceThread_->join();
+        NODELET_INFO("driver thread stopped");
+      }
+    }
+
+  private:
+
+    virtual void onInit();
+    void devicePoll();
+
+    volatile bool running_;             ///< device thread is running
+    boost::shared_ptr<boost::thread> deviceThread_;
+
+    boost::shared_ptr<Convert> conv_;
+    boost::shared_ptr<velodyne_driver::VelodyneDriver> dvr_;
+  };
+
+  /** @brief Nodelet initialization. */
+  void FusedNodelet::onInit()
+  {
+    ros::NodeHandle node = getNodeHandle();
+    ros::NodeHandle private_nh = getPrivateNodeHandle();
+    diagnostics_utils::TracePublisher::init(&node);
+    conv_.reset(new Convert(node, private_nh, false));
+
+    // unless told, the driver expects the model the converter decodes,
+    // which may have been guessed from the calibration
+    ros::NodeHandle driver_nh(private_nh, "driver");
+    std::string model;
+    if (!driver_nh.getParam("model", model) || model.empty()) {
+      driver_nh.setParam("model",
+                         std::string(velodyne_driver::MODELS[conv_->model()].name));
+    }
+    dvr_.reset(new velodyne_driver::VelodyneDriver
+               (node, driver_nh,
+                boost::bind(&Convert::processPacket, conv_.get(), _1, _2)));
+
+    // spawn device poll thread
+    running_ = true;
+    deviceThread_ = boost::shared_ptr<boost::thread>
+      (new boost::thread(boost::bind(&FusedNodelet::devicePoll, this)));
+  }
+
+  /** @brief Device poll thread main loop. */
+  void FusedNodelet::devicePoll()
+  {
+    while (ros::ok()) {
+      // poll device until end of file
+      running_ = dvr_->poll();
+      if (!running_) {
+        break;
+      }
+    }
+    running_ = false;
+  }
+
+} // namespace velodyne_pointcloud
+
+
+// Register this plugin with pluginlib.  Names must match nodelets.xml.
+//
+// parameters: package, class name, class type, base class type
+PLUGINLIB_DECLARE_CLASS(velodyne_pointcloud, FusedNodelet,
+                        velodyne_pointcloud::FusedNodelet, nodelet::Nodelet);
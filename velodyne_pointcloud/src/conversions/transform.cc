@@ -77,13 +77,16 @@ namespace velodyne_pointcloud
     outMsg->header.stamp = pcl_conversions::toPCL(scanMsg->header).stamp;
     outMsg->header.frame_id = config_.frame_id;
     outMsg->height = 1;
+    outMsg->points.reserve(scanMsg->packets.size()
+                           * velodyne_rawdata::MAX_POINTS_PER_PACKET);
 
     // process each packet provided by the driver
     for (size_t next = 0; next < scanMsg->packets.size(); ++next)
       {
-        // clear input point cloud to handle this packet
-        inPc_.points.clear();
-        inPc_.width = 0;
+        // input point cloud to handle this packet, overwriting the
+        // points of the last one, so only the room they left is
+        // initialised again
+        inPc_.points.resize(velodyne_rawdata::MAX_POINTS_PER_PACKET);
         inPc_.height = 1;
         std_msgs::Header header;
         header.stamp = scanMsg->packets[next].stamp;
@@ -91,7 +94,8 @@ namespace velodyne_pointcloud
         pcl_conversions::toPCL(header, inPc_.header);
 
         // unpack the raw data
-        data_->unpackAndAdd(scanMsg->packets[next], inPc_);
+        inPc_.width = data_->unpack(scanMsg->packets[next], &inPc_.points[0]);
+        inPc_.points.resize(inPc_.width);
 
         // clear transform point cloud for this packet
         tfPc_.points.clear();           // is this needed?
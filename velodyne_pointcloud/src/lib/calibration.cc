@@ -11,8 +11,11 @@
  * $ Id: 02/14/2012 11:36:36 AM piyushk $
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include <fstream>
+#include <new>
 #include <string>
 #include <cmath>
 #include <limits>
@@ -252,6 +255,7 @@ namespace velodyne_pointcloud
       parser.GetNextDocument(doc);
 #endif
       doc >> *this;
+      compile();
     } catch (YAML::Exception &e) {
       std::cerr << "YAML Exception: " << e.what() << std::endl;
       initialized = false;
@@ -259,6 +263,57 @@ namespace velodyne_pointcloud
     fin.close();
   }
 
+  void Calibration::compile()
+  {
+    boost::shared_ptr<CorrectionTable> compiled(new CorrectionTable);
+    memset(compiled.get(), 0, sizeof(CorrectionTable));
+
+    for (std::map<int, LaserCorrection>::const_iterator
+           it = laser_corrections.begin();
+         it != laser_corrections.end(); ++it) {
+      const int laser = it->first;
+      if (laser < 0 || laser >= CorrectionTable::MAX_LASERS) {
+        ROS_WARN("laser_id %d out of range, ignored", laser);
+        continue;
+      }
+      const LaserCorrection &correction = it->second;
+      compiled->rot_correction[laser] = correction.rot_correction;
+      compiled->cos_rot_correction[laser] = correction.cos_rot_correction;
+      compiled->sin_rot_correction[laser] = correction.sin_rot_correction;
+      compiled->cos_vert_correction[laser] = correction.cos_vert_correction;
+      compiled->sin_vert_correction[laser] = correction.sin_vert_correction;
+      compiled->dist_correction[laser] = correction.dist_correction;
+      compiled->dist_correction_x[laser] = correction.dist_correction_x;
+      compiled->dist_correction_y[laser] = correction.dist_correction_y;
+      compiled->vert_offset_correction[laser] =
+        correction.vert_offset_correction;
+      compiled->horiz_offset_correction[laser] =
+        correction.horiz_offset_correction;
+      compiled->min_intensity[laser] = correction.min_intensity;
+      compiled->max_intensity[laser] = correction.max_intensity;
+      compiled->focal_distance[laser] = correction.focal_distance;
+      compiled->focal_slope[laser] = correction.focal_slope;
+      compiled->two_pt_correction_available[laser] =
+        correction.two_pt_correction_available;
+      compiled->laser_ring[laser] = correction.laser_ring;
+    }
+    table = compiled;
+  }
+
+  void *CorrectionTable::operator new(size_t size)
+  {
+    void *p;
+    if (posix_memalign(&p, alignof(CorrectionTable), size) != 0) {
+      throw std::bad_alloc();
+    }
+    return p;
+  }
+
+  void CorrectionTable::operator delete(void *p)
+  {
+    free(p);
+  }
+
   void Calibration::write(const std::string& calibration_file) {
     std::ofstream fout(calibration_file.c_str());
     YAML::Emitter out;
@@ -0,0 +1,206 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Vectorised decoding of the points of a Velodyne data block.
+ *
+ *  decodeLanes() holds the arithmetic once.  It is inlined into a
+ *  kernel for the baseline instruction set and, on x86, into one
+ *  built for AVX2 and FMA, which the compiler then uses for the
+ *  8-wide vector types.
+ */
+
+#include <string.h>
+#include <velodyne_pointcloud/decode_kernel.h>
+
+namespace velodyne_rawdata {
+
+namespace {
+
+// the helpers below are always inlined, their ABI does not matter
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+typedef float v8sf __attribute__((vector_size(32)));
+typedef int v8si __attribute__((vector_size(32)));
+
+static const int LANE_WIDTH = 8;
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+ALWAYS_INLINE v8sf load(const float* p)
+{
+  v8sf v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+ALWAYS_INLINE void store(float* p, const v8sf& v)
+{
+  memcpy(p, &v, sizeof(v));
+}
+
+ALWAYS_INLINE v8sf splat(float f)
+{
+  v8sf v = {f, f, f, f, f, f, f, f};
+  return v;
+}
+
+/** 0 or 1 for each of 8 flags */
+ALWAYS_INLINE v8sf loadFlags(const uint8_t* p)
+{
+  v8sf v = {float(p[0] != 0), float(p[1] != 0), float(p[2] != 0), float(p[3] != 0),
+            float(p[4] != 0), float(p[5] != 0), float(p[6] != 0), float(p[7] != 0)};
+  return v;
+}
+
+ALWAYS_INLINE v8sf vabs(const v8sf& v)
+{
+  return (v8sf)((v8si)v & 0x7fffffff);   // clear the sign bits
+}
+
+ALWAYS_INLINE v8sf vmin(const v8sf& a, const v8sf& b)
+{
+  return a < b ? a : b;
+}
+
+ALWAYS_INLINE v8sf vmax(const v8sf& a, const v8sf& b)
+{
+  return a > b ? a : b;
+}
+
+ALWAYS_INLINE void decodeLanes(const velodyne_pointcloud::CorrectionTable& table,
+                               int first_laser, int lasers, int lanes,
+                               float distance_resolution, int flags,
+                               const KernelInput& in, KernelOutput* out)
+{
+  const v8sf resolution = splat(distance_resolution);
+
+  for (int i = 0; i < lanes; i += LANE_WIDTH) {
+    const int l = first_laser + i % lasers;
+
+    const v8sf raw_distance = load(in.raw_distance + i);
+    const v8sf dist_correction = load(table.dist_correction + l);
+    const v8sf distance = raw_distance * resolution + dist_correction;
+
+    const v8sf cos_vert_angle = load(table.cos_vert_correction + l);
+    const v8sf sin_vert_angle = load(table.sin_vert_correction + l);
+    v8sf cos_rot_angle = load(in.cos_rot + i);
+    v8sf sin_rot_angle = load(in.sin_rot + i);
+    if (!(flags & DECODE_ROT_CORRECTED)) {
+      const v8sf cos_rot = cos_rot_angle;
+      const v8sf sin_rot = sin_rot_angle;
+      const v8sf cos_rot_correction = load(table.cos_rot_correction + l);
+      const v8sf sin_rot_correction = load(table.sin_rot_correction + l);
+
+      // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
+      // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
+      cos_rot_angle = cos_rot * cos_rot_correction + sin_rot * sin_rot_correction;
+      sin_rot_angle = sin_rot * cos_rot_correction - cos_rot * sin_rot_correction;
+    }
+
+    const v8sf horiz_offset = load(table.horiz_offset_correction + l);
+    const v8sf vert_offset = load(table.vert_offset_correction + l);
+
+    v8sf xy_distance = distance * cos_vert_angle - vert_offset * sin_vert_angle;
+    const v8sf xx = vabs(xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle);
+    const v8sf yy = vabs(xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle);
+
+    // two point correction, zero for lasers without it
+    const v8sf two_pt = loadFlags(table.two_pt_correction_available + l);
+    const v8sf dist_correction_x = load(table.dist_correction_x + l);
+    const v8sf dist_correction_y = load(table.dist_correction_y + l);
+    const v8sf distance_corr_x =
+      two_pt * ((dist_correction - dist_correction_x)
+                * (xx - splat(2.4f)) / splat(25.04f - 2.4f)
+                + dist_correction_x - dist_correction);
+    const v8sf distance_corr_y =
+      two_pt * ((dist_correction - dist_correction_y)
+                * (yy - splat(1.93f)) / splat(25.04f - 1.93f)
+                + dist_correction_y - dist_correction);
+
+    const v8sf distance_x = distance + distance_corr_x;
+    xy_distance = distance_x * cos_vert_angle - vert_offset * sin_vert_angle;
+    const v8sf x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
+
+    const v8sf distance_y = distance + distance_corr_y;
+    xy_distance = distance_y * cos_vert_angle - vert_offset * sin_vert_angle;
+    const v8sf y = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
+
+    const v8sf z = distance_y * sin_vert_angle + vert_offset * cos_vert_angle;
+
+    // standard ROS coordinate system (right-hand rule)
+    store(out->x + i, y);
+    store(out->y + i, -x);
+    store(out->z + i, z);
+    store(out->distance + i, distance);
+
+    // intensity
+    v8sf intensity = load(in.raw_intensity + i);
+    if (!(flags & DECODE_FOCAL_CORRECTED)) {
+      const v8sf focal_scale = splat(1.0f) - load(table.focal_distance + l) / splat(13100.0f);
+      const v8sf focal_offset = splat(256.0f) * focal_scale * focal_scale;
+      v8sf distance_term = splat(256.0f);
+      if (flags & DECODE_FOCAL_QUADRATIC) {
+        const v8sf distance_scale = splat(1.0f) - raw_distance / splat(65535.0f);
+        distance_term = distance_term * distance_scale * distance_scale;
+      }
+      intensity += load(table.focal_slope + l) * vabs(focal_offset - distance_term);
+    }
+    intensity = vmax(intensity, load(table.min_intensity + l));
+    intensity = vmin(intensity, load(table.max_intensity + l));
+    store(out->intensity + i, intensity);
+  }
+}
+
+void decodeBaseline(const velodyne_pointcloud::CorrectionTable& table,
+                    int first_laser, int lasers, int lanes,
+                    float distance_resolution, int flags,
+                    const KernelInput& in, KernelOutput* out)
+{
+  decodeLanes(table, first_laser, lasers, lanes, distance_resolution,
+              flags, in, out);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma")))
+void decodeAvx2(const velodyne_pointcloud::CorrectionTable& table,
+                int first_laser, int lasers, int lanes,
+                float distance_resolution, int flags,
+                const KernelInput& in, KernelOutput* out)
+{
+  decodeLanes(table, first_laser, lasers, lanes, distance_resolution,
+              flags, in, out);
+}
+#endif
+
+} // namespace
+
+std::vector<DecodeKernelVariant> decodeKernels()
+{
+  std::vector<DecodeKernelVariant> kernels;
+#if defined(__x86_64__) || defined(__i386__)
+  kernels.push_back(DecodeKernelVariant{"SSE2", &decodeBaseline});
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    kernels.push_back(DecodeKernelVariant{"AVX2", &decodeAvx2});
+  }
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+  kernels.push_back(DecodeKernelVariant{"NEON", &decodeBaseline});
+#else
+  kernels.push_back(DecodeKernelVariant{"generic", &decodeBaseline});
+#endif
+  return kernels;
+}
+
+DecodeKernel selectDecodeKernel(const char** name)
+{
+  const DecodeKernelVariant fastest = decodeKernels().back();
+  *name = fastest.name;
+  return fastest.kernel;
+}
+
+} // namespace velodyne_rawdata
@@ -25,6 +25,7 @@
  *  HDL-64E S2 calibration support provided by Nick Hillier
  */
 
+#include <algorithm>
 #include <fstream>
 #include <math.h>
 
@@ -42,7 +43,18 @@ namespace velodyne_rawdata
   //
   ////////////////////////////////////////////////////////////////////////
 
-  RawData::RawData() {}
+  using velodyne_driver::MODELS;
+
+  RawData::RawData():
+    model_(velodyne_driver::MODEL_64E),
+    return_mode_(0),
+    dual_policy_(DUAL_BOTH_DEDUP),
+    kernel_(NULL),
+    focal_shift_(0),
+    focal_size_(0),
+    intensity_tables_(false),
+    unpack_(NULL)
+  {}
 
   /** Update parameters: conversions and update */
   void RawData::setParameters(double min_range,
@@ -86,6 +98,50 @@ namespace velodyne_rawdata
         config_.calibrationFile = pkgPath + "/params/64e_utexas.yaml";
       }
 
+    Options options;
+    if (!private_nh.getParam("device_model", options.device_model)) {
+      ROS_WARN_STREAM("device_model not specified");
+    }
+
+    // which returns to publish from dual return packets
+    std::string dual_returns;
+    private_nh.param("dual_returns", dual_returns, std::string("both_dedup"));
+    if (dual_returns == "strongest") {
+      options.dual_policy = DUAL_STRONGEST;
+    } else if (dual_returns == "last") {
+      options.dual_policy = DUAL_LAST;
+    } else if (dual_returns == "both") {
+      options.dual_policy = DUAL_BOTH;
+    } else {
+      if (dual_returns != "both_dedup") {
+        ROS_ERROR_STREAM("unknown dual_returns value: " << dual_returns);
+      }
+      options.dual_policy = DUAL_BOTH_DEDUP;
+    }
+    // decode a block at a time with the vectorised kernel, rather
+    // than a point at a time?
+    bool simd_decode;
+    private_nh.param("simd_decode", simd_decode, true);
+    if (simd_decode) {
+      const char *instructions;
+      options.kernel = selectDecodeKernel(&instructions);
+      ROS_INFO("decoding with %s instructions", instructions);
+    }
+    // look up the focal intensity correction of each point, rather
+    // than compute it?
+    private_nh.param("intensity_tables", options.intensity_tables, false);
+    // look up the trig of each laser's corrected azimuth, rather than
+    // combine the azimuth's with the laser's rot_correction?
+    private_nh.param("trig_tables", options.trig_tables, false);
+
+    return setupOffline(config_.calibrationFile, options);
+  }
+
+  /** Set up for decoding without ROS parameters. */
+  int RawData::setupOffline(const std::string &calibration_file,
+                            const Options &options)
+  {
+    config_.calibrationFile = calibration_file;
     ROS_INFO_STREAM("correction angles: " << config_.calibrationFile);
 
     calibration_.read(config_.calibrationFile);
@@ -97,23 +153,30 @@ namespace velodyne_rawdata
 
     ROS_INFO_STREAM("Number of lasers: " << calibration_.num_lasers << ".");
 
-    if (!private_nh.getParam("device_model", config_.deviceModel)) {
-      ROS_WARN_STREAM("device_model not specified");
+    config_.deviceModel = options.device_model;
+    model_ = velodyne_driver::findModel(config_.deviceModel);
+    if (model_ < 0) {
+      // guess from the calibration
+      if (calibration_.num_lasers == 16) {
+        model_ = velodyne_driver::MODEL_VLP16;
+      } else if (calibration_.num_lasers == 32) {
+        model_ = velodyne_driver::MODEL_32E;
+      } else {
+        model_ = velodyne_driver::MODEL_64E;
+      }
+    } else if (MODELS[model_].lasers != calibration_.num_lasers) {
+      ROS_WARN_STREAM("calibration has " << calibration_.num_lasers
+                      << " lasers, " << MODELS[model_].full_name
+                      << " has " << MODELS[model_].lasers);
     }
+    ROS_INFO_STREAM("decoding " << MODELS[model_].full_name << " packets");
 
+    dual_policy_ = options.dual_policy;
+    kernel_ = options.kernel;
+    intensity_tables_ = options.intensity_tables;
 
-    if (calibration_.num_lasers == 16) {
-      vlp_spec_ = VLP_16_SPEC;
-      timing_offsets_ = {};
-      is_vlp_ = true;
-    } else if (config_.deviceModel == "VLP32") {
-      vlp_spec_ = VLP_32_SPEC;
-      timing_offsets_ = getVLP32TimingOffsets();
-      is_vlp_ = true;
-    } else {
-      timing_offsets_ = {};
-      is_vlp_ = false;
-    }
+    selectModel(model_);
+    detector_.reset();
 
     // Set up cached values for sin and cos of all the possible headings
     for (uint16_t rot_index = 0; rot_index < ROTATION_MAX_UNITS; ++rot_index) {
@@ -121,11 +184,168 @@ namespace velodyne_rawdata
       cos_rot_table_[rot_index] = cosf(rotation);
       sin_rot_table_[rot_index] = sinf(rotation);
     }
+
+    if (options.trig_tables) {
+      buildTrigTable();
+    } else {
+      trig_table_.clear();
+    }
    return 0;
   }
 
+  /** Build the trig table and the offset of each laser into it.
+   *
+   *  Quantising rot_correction to 0.001 degree moves points by less
+   *  than 1 mm at 100 m.  The table takes about 3 MB.
+   */
+  void RawData::buildTrigTable()
+  {
+    trig_table_.resize(TRIG_TABLE_UNITS);
+    for (int index = 0; index < TRIG_TABLE_UNITS; ++index) {
+      double rotation = angles::from_degrees(index / (100.0 * TRIG_TABLE_SCALE));
+      trig_table_[index].cos = cos(rotation);
+      trig_table_[index].sin = sin(rotation);
+    }
+
+    const velodyne_pointcloud::CorrectionTable &table = *calibration_.table;
+    for (int laser = 0; laser < velodyne_pointcloud::CorrectionTable::MAX_LASERS; ++laser) {
+      // subtract the correction, modulo one turn
+      long correction = lround(angles::to_degrees(table.rot_correction[laser])
+                               * 100.0 * TRIG_TABLE_SCALE);
+      trig_offset_[laser] = ((-correction) % TRIG_TABLE_UNITS + TRIG_TABLE_UNITS)
+        % TRIG_TABLE_UNITS;
+    }
+  }
+
+  /** Use the unpack function specialised for a model. */
+  void RawData::selectModel(int model)
+  {
+    model_ = model;
+    timing_offsets_[0] = {};
+    timing_offsets_[1] = {};
+    switch (model_) {
+    case velodyne_driver::MODEL_64E_S2:
+      unpack_ = hdlUnpacker<velodyne_driver::MODEL_64E_S2>();
+      break;
+    case velodyne_driver::MODEL_64E_S21:
+      unpack_ = hdlUnpacker<velodyne_driver::MODEL_64E_S21>();
+      break;
+    case velodyne_driver::MODEL_64E:
+      unpack_ = hdlUnpacker<velodyne_driver::MODEL_64E>();
+      break;
+    case velodyne_driver::MODEL_32E:
+      unpack_ = hdlUnpacker<velodyne_driver::MODEL_32E>();
+      break;
+    case velodyne_driver::MODEL_VLP16:
+      unpack_ = vlpUnpacker<velodyne_driver::MODEL_VLP16>();
+      break;
+    case velodyne_driver::MODEL_VLP32:
+      unpack_ = vlpUnpacker<velodyne_driver::MODEL_VLP32>();
+      timing_offsets_[0] = getVLP32TimingOffsets(false);
+      timing_offsets_[1] = getVLP32TimingOffsets(true);
+      break;
+    }
+
+    // the correction table has zeros for lasers not calibrated
+    if (!calibration_.table) {
+      unpack_ = NULL;
+    } else if (MODELS[model_].lasers > calibration_.num_lasers) {
+      ROS_ERROR_STREAM("calibration has " << calibration_.num_lasers
+                       << " lasers, " << MODELS[model_].full_name
+                       << " needs " << MODELS[model_].lasers
+                       << "; not decoding packets");
+      unpack_ = NULL;
+    }
+
+    // the VLP loop corrects intensities without the distance term
+    if (unpack_ && intensity_tables_) {
+      buildFocalTable(model_ != velodyne_driver::MODEL_VLP16
+                      && model_ != velodyne_driver::MODEL_VLP32);
+    } else {
+      focal_table_.clear();
+    }
+  }
 
-  std::vector<std::vector<ros::Duration>> RawData::getVLP32TimingOffsets() {
+  /** Build the focal intensity correction table of each laser.
+   *
+   *  The correction changes by at most focal_slope * 512 / 65535 a
+   *  raw distance unit.  Each entry is the correction in the middle
+   *  of its raw distance step, so steps are made as long as that
+   *  keeps its error within half an intensity unit.  The calibrations
+   *  shipped need 1024 entries a laser, 256 KB for 64 lasers.
+   */
+  void RawData::buildFocalTable(bool focal_quadratic)
+  {
+    const velodyne_pointcloud::CorrectionTable &table = *calibration_.table;
+    const int lasers = velodyne_pointcloud::CorrectionTable::MAX_LASERS;
+
+    float max_slope = 0;
+    for (int laser = 0; focal_quadratic && laser < lasers; ++laser) {
+      max_slope = std::max(max_slope, fabsf(table.focal_slope[laser]));
+    }
+    focal_shift_ = 16;
+    while (focal_shift_ > 0
+           && max_slope * 512 / 65535 * (1 << (focal_shift_ - 1)) > 0.5f) {
+      --focal_shift_;
+    }
+    focal_size_ = 65536 >> focal_shift_;
+
+    focal_table_.resize(lasers * focal_size_);
+    for (int laser = 0; laser < lasers; ++laser) {
+      float focal_offset = 256
+                         * (1 - table.focal_distance[laser] / 13100)
+                         * (1 - table.focal_distance[laser] / 13100);
+      for (int i = 0; i < focal_size_; ++i) {
+        float distance_term = 256;
+        if (focal_quadratic) {
+          float raw_distance = (i << focal_shift_) + ((1 << focal_shift_) >> 1);
+          distance_term *= (1 - raw_distance/65535) * (1 - raw_distance/65535);
+        }
+        focal_table_[laser * focal_size_ + i] =
+          table.focal_slope[laser] * fabsf(focal_offset - distance_term);
+      }
+    }
+  }
+
+  /** Check the model configured against the one the packets come from.
+   *
+   *  If they differ, decode packets as the detected model when the
+   *  calibration has the right number of lasers, otherwise stop
+   *  decoding them.
+   */
+  void RawData::detectModel(const velodyne_msgs::VelodynePacket &pkt)
+  {
+    if (!detector_.check(&pkt.data[0])) {
+      return;
+    }
+
+    const int detected = detector_.model();
+    return_mode_ = detector_.returnMode();
+    if (detected < 0 && detector_.productId() == 0) {
+      ROS_INFO("packets do not tell the device model, decoding as %s",
+               MODELS[model_].full_name);
+    } else if (detected < 0) {
+      ROS_WARN("unknown Velodyne product ID 0x%02x, decoding as %s",
+               detector_.productId(), MODELS[model_].full_name);
+    } else if (velodyne_driver::modelMatches(model_, detected)) {
+      ROS_INFO_STREAM("packets come from " << MODELS[detected].full_name
+                      << ", " << velodyne_driver::returnModeName(return_mode_));
+    } else if (MODELS[detected].lasers == calibration_.num_lasers) {
+      ROS_WARN_STREAM("packets come from " << MODELS[detected].full_name
+                      << ", not " << MODELS[model_].full_name
+                      << ", decoding them as such");
+      selectModel(detected);
+    } else {
+      ROS_ERROR_STREAM("packets come from " << MODELS[detected].full_name
+                       << ", but the calibration has "
+                       << calibration_.num_lasers << " lasers;"
+                       << " not decoding them");
+      unpack_ = NULL;
+    }
+  }
+
+
+  std::vector<std::vector<ros::Duration>> RawData::getVLP32TimingOffsets(bool dual_mode) {
     // timing table calculation, from velodyne user manual
 
     // 12 firings cycles in a data package, 32 lasers:
@@ -133,9 +353,9 @@ namespace velodyne_rawdata
     std::vector<std::vector<ros::Duration>> offsets(12, std::vector<Duration>(32, Duration(0)));
 
     // Time constants
-    const double full_firing_cycle = VLP_32_SPEC.firing_seq_duration * 1e-6;
-    const double single_firing = VLP_32_SPEC.firing_duration * 1e-6;
-    const bool dual_mode = false;
+    const velodyne_driver::ModelSpec &spec = MODELS[velodyne_driver::MODEL_VLP32];
+    const double full_firing_cycle = spec.firing_seq_duration * 1e-6;
+    const double single_firing = spec.firing_duration * 1e-6;
 
     double block_idx, pt_idx;
     for (size_t i = 0; i < offsets.size(); ++i){
@@ -154,43 +374,105 @@ namespace velodyne_rawdata
   }
 
 
+  /** @brief convert raw packet to points
+   *
+   *  @param pkt raw packet to unpack
+   *  @param out room for MAX_POINTS_PER_PACKET points
+   *  @param slice_angle set to the azimuth the packet covers if VLP,
+   *                     otherwise -1.0, unless NULL
+   *  @returns number of points written to out
+   */
+  int RawData::unpack(const velodyne_msgs::VelodynePacket &pkt,
+                      VPoint *out, float *slice_angle)
+  {
+    ROS_DEBUG_STREAM("Received packet, time: " << pkt.stamp);
+
+    // until the model is known, decode packets as configured
+    if (!detector_.done()) {
+      detectModel(pkt);
+    }
+    float angle = -1.0;
+    int count = 0;
+    if (unpack_ != NULL) {
+      count = (this->*unpack_)(pkt, out, angle);
+    }
+    if (slice_angle) {
+      *slice_angle = angle;
+    }
+    return count;
+  }
+
   /** @brief convert raw packet to point cloud
    *
    *  @param pkt raw packet to unpack
    *  @param pc shared pointer to point cloud (points are appended)
    */
   float RawData::unpackAndAdd(const velodyne_msgs::VelodynePacket &pkt,
-                       VPointCloud &pc) const
+                       VPointCloud &pc)
   {
-    ROS_DEBUG_STREAM("Received packet, time: " << pkt.stamp);
+    // write the points in place, then drop the room left
+    const size_t size = pc.points.size();
+    pc.points.resize(size + MAX_POINTS_PER_PACKET);
+    float slice_angle;
+    const int count = unpack(pkt, &pc.points[size], &slice_angle);
+    pc.points.resize(size + count);
+    pc.width += count;
+    return slice_angle;
+  }
 
-    /** special parsing for the VLP16 and VLP32 **/
-    if (is_vlp_)
-    {
-      return unpack_vlp(pkt, pc);
+  /** @returns most points a revolution unpacks to */
+  size_t RawData::pointsPerRevolution(double rpm) const
+  {
+    double packets = MODELS[model_].packet_rate * 60.0 / rpm;
+    if (return_mode_ == velodyne_driver::RETURN_DUAL) {
+      packets *= 2;
     }
+    return size_t(ceil(packets)) * MAX_POINTS_PER_PACKET;
+  }
 
+  /** @brief convert raw HDL-64E or HDL-32E packet to point cloud
+   *
+   *  @param pkt raw packet to unpack
+   *  @param out room for the points
+   *  @param angle set to -1.0
+   *  @returns number of points written
+   */
+  template <int MODEL>
+  int RawData::unpack_hdl(const velodyne_msgs::VelodynePacket &pkt,
+                          VPoint *out, float &angle) const
+  {
+    constexpr velodyne_driver::ModelSpec spec = MODELS[MODEL];
     const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
+    int count = 0;
+    const velodyne_pointcloud::CorrectionTable &table = *calibration_.table;
+    const bool dual = dualReturn(pkt);
 
     for (int i = 0; i < BLOCKS_PER_PACKET; i++) {
 
+      if (dual && !decodeBlock(i)) {
+        continue;
+      }
+      const bool dedup = dual && dual_policy_ == DUAL_BOTH_DEDUP && (i & 1);
+
       // upper bank lasers are numbered [0..31]
       // NOTE: this is a change from the old velodyne_common implementation
       int bank_origin = 0;
-      if (raw->blocks[i].header == LOWER_BANK) {
+      if (spec.lasers > SCANS_PER_BLOCK && raw->blocks[i].header == LOWER_BANK) {
         // lower bank lasers are [32..63]
         bank_origin = 32;
       }
 
       for (int j = 0, k = 0; j < SCANS_PER_BLOCK; j++, k += RAW_SCAN_SIZE) {
 
+        if (dedup && sameReturn(raw->blocks[i - 1], raw->blocks[i], k)) {
+          continue;
+        }
+
         float x, y, z;
         float intensity;
         uint8_t laser_number;       ///< hardware laser number
 
         laser_number = j + bank_origin;
-        const velodyne_pointcloud::LaserCorrection &corrections =
-          calibration_.laser_corrections.at(laser_number);
 
         /** Position Calculation */
 
@@ -199,31 +481,34 @@ namespace velodyne_rawdata
         tmp.bytes[1] = raw->blocks[i].data[k+1];
         /*condition added to avoid calculating points which are not
           in the interesting defined area (min_angle < area < max_angle)*/
-        if ((raw->blocks[i].rotation >= config_.min_angle
-             && raw->blocks[i].rotation <= config_.max_angle
-             && config_.min_angle < config_.max_angle)
-             ||(config_.min_angle > config_.max_angle
-             && (raw->blocks[i].rotation <= config_.max_angle
-             || raw->blocks[i].rotation >= config_.min_angle))){
-          float distance = tmp.uint * DISTANCE_RESOLUTION;
-          distance += corrections.dist_correction;
-
-          float cos_vert_angle = corrections.cos_vert_correction;
-          float sin_vert_angle = corrections.sin_vert_correction;
-          float cos_rot_correction = corrections.cos_rot_correction;
-          float sin_rot_correction = corrections.sin_rot_correction;
-
-          // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
-          // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
-          float cos_rot_angle =
-            cos_rot_table_[raw->blocks[i].rotation] * cos_rot_correction +
-            sin_rot_table_[raw->blocks[i].rotation] * sin_rot_correction;
-          float sin_rot_angle =
-            sin_rot_table_[raw->blocks[i].rotation] * cos_rot_correction -
-            cos_rot_table_[raw->blocks[i].rotation] * sin_rot_correction;
-
-          float horiz_offset = corrections.horiz_offset_correction;
-          float vert_offset = corrections.vert_offset_correction;
+        if (azimuthInView(raw->blocks[i].rotation)) {
+          float distance = tmp.uint * spec.distance_resolution;
+          distance += table.dist_correction[laser_number];
+
+          float cos_vert_angle = table.cos_vert_correction[laser_number];
+          float sin_vert_angle = table.sin_vert_correction[laser_number];
+
+          float cos_rot_angle, sin_rot_angle;
+          if (trig_table_.empty()) {
+            float cos_rot_correction = table.cos_rot_correction[laser_number];
+            float sin_rot_correction = table.sin_rot_correction[laser_number];
+
+            // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
+            // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
+            cos_rot_angle =
+              cos_rot_table_[raw->blocks[i].rotation] * cos_rot_correction +
+              sin_rot_table_[raw->blocks[i].rotation] * sin_rot_correction;
+            sin_rot_angle =
+              sin_rot_table_[raw->blocks[i].rotation] * cos_rot_correction -
+              cos_rot_table_[raw->blocks[i].rotation] * sin_rot_correction;
+          } else {
+            const Trig &trig = correctedTrig(raw->blocks[i].rotation, laser_number);
+            cos_rot_angle = trig.cos;
+            sin_rot_angle = trig.sin;
+          }
+
+          float horiz_offset = table.horiz_offset_correction[laser_number];
+          float vert_offset = table.vert_offset_correction[laser_number];
 
           // Compute the distance in the xy plane (w/o accounting for rotation)
           /**the new term of 'vert_offset * sin_vert_angle'
@@ -244,17 +529,20 @@ namespace velodyne_rawdata
           // different value at different distance
           float distance_corr_x = 0;
           float distance_corr_y = 0;
-          if (corrections.two_pt_correction_available) {
+          if (table.two_pt_correction_available[laser_number]) {
+            const float dist_correction = table.dist_correction[laser_number];
+            const float dist_correction_x = table.dist_correction_x[laser_number];
+            const float dist_correction_y = table.dist_correction_y[laser_number];
             distance_corr_x =
-              (corrections.dist_correction - corrections.dist_correction_x)
+              (dist_correction - dist_correction_x)
                 * (xx - 2.4) / (25.04 - 2.4)
-              + corrections.dist_correction_x;
-            distance_corr_x -= corrections.dist_correction;
+              + dist_correction_x;
+            distance_corr_x -= dist_correction;
             distance_corr_y =
-              (corrections.dist_correction - corrections.dist_correction_y)
+              (dist_correction - dist_correction_y)
                 * (yy - 1.93) / (25.04 - 1.93)
-              + corrections.dist_correction_y;
-            distance_corr_y -= corrections.dist_correction;
+              + dist_correction_y;
+            distance_corr_y -= dist_correction;
           }
 
           float distance_x = distance + distance_corr_x;
@@ -289,17 +577,21 @@ namespace velodyne_rawdata
 
           /** Intensity Calculation */
 
-          float min_intensity = corrections.min_intensity;
-          float max_intensity = corrections.max_intensity;
+          float min_intensity = table.min_intensity[laser_number];
+          float max_intensity = table.max_intensity[laser_number];
 
           intensity = raw->blocks[i].data[k+2];
 
-          float focal_offset = 256
-                             * (1 - corrections.focal_distance / 13100)
-                             * (1 - corrections.focal_distance / 13100);
-          float focal_slope = corrections.focal_slope;
-          intensity += focal_slope * (abs(focal_offset - 256 *
-            (1 - static_cast<float>(tmp.uint)/65535)*(1 - static_cast<float>(tmp.uint)/65535)));
+          if (focal_table_.empty()) {
+            float focal_offset = 256
+                               * (1 - table.focal_distance[laser_number] / 13100)
+                               * (1 - table.focal_distance[laser_number] / 13100);
+            float focal_slope = table.focal_slope[laser_number];
+            intensity += focal_slope * (abs(focal_offset - 256 *
+              (1 - static_cast<float>(tmp.uint)/65535)*(1 - static_cast<float>(tmp.uint)/65535)));
+          } else {
+            intensity += focalCorrection(laser_number, tmp.uint);
+          }
           intensity = (intensity < min_intensity) ? min_intensity : intensity;
           intensity = (intensity > max_intensity) ? max_intensity : intensity;
 
@@ -307,7 +599,7 @@ namespace velodyne_rawdata
             const ros::Time pt_time = pkt.stamp; // No firing correction for this model
 
             // convert polar coordinates to Euclidean XYZ
-            VPoint point;
+            VPoint &point = out[count++];
             point.x = x_coord;
             point.y = y_coord;
             point.z = z_coord;
@@ -315,25 +607,27 @@ namespace velodyne_rawdata
 
             point.time_sec = pt_time.sec;
             point.time_nsec = pt_time.nsec;
-            point.laser_id = corrections.laser_ring;
-            // append this point to the cloud
-            pc.points.push_back(point);
-            ++pc.width;
+            point.laser_id = table.laser_ring[laser_number];
           }
         }
       }
     }
-    return -1.0;
+    angle = -1.0;
+    return count;
   }
 
   /** @brief convert raw VLP16 and VLP32 packet to point cloud
    *
    *  @param pkt raw packet to unpack
-   *  @param pc shared pointer to point cloud (points are appended)
+   *  @param out room for the points
+   *  @param angle set to the azimuth the packet covers
+   *  @returns number of points written
    */
-  float RawData::unpack_vlp(const velodyne_msgs::VelodynePacket &pkt,
-                             VPointCloud &pc) const
+  template <int MODEL>
+  int RawData::unpack_vlp(const velodyne_msgs::VelodynePacket &pkt,
+                          VPoint *out, float &angle) const
   {
+    constexpr velodyne_driver::ModelSpec spec = MODELS[MODEL];
     float azimuth;
     float azimuth_diff;
     float last_azimuth_diff=0;
@@ -344,6 +638,12 @@ namespace velodyne_rawdata
     float slice_angle = 0.0;
 
     const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
+    int count = 0;
+    const velodyne_pointcloud::CorrectionTable &table = *calibration_.table;
+
+    // in dual return mode, both blocks of a pair have the same azimuth
+    const bool dual = dualReturn(pkt);
+    const int block_step = dual? 2: 1;
 
     for (int block = 0; block < BLOCKS_PER_PACKET; block++) {
 
@@ -354,7 +654,8 @@ namespace velodyne_rawdata
         ROS_WARN_STREAM_THROTTLE(60, "skipping invalid VLP packet: block "
                                  << block << " header value is "
                                  << raw->blocks[block].header);
-        return -1;                         // bad packet: skip the rest
+        angle = -1.0;
+        return count;                      // bad packet: skip the rest
       }
 
       // Calculate difference between current and next block's azimuth angle.
@@ -363,18 +664,26 @@ namespace velodyne_rawdata
       //Debug
       //std::cout << "Block: " << block << ", Azimuth: " << azimuth << std::endl;
 
-      if (block < (BLOCKS_PER_PACKET-1)){
-        azimuth_diff = (float)((36000 + raw->blocks[block+1].rotation - raw->blocks[block].rotation)%36000);
-        slice_angle += azimuth_diff;
+      if (block < (BLOCKS_PER_PACKET-block_step)){
+        azimuth_diff = (float)((36000 + raw->blocks[block+block_step].rotation - raw->blocks[block].rotation)%36000);
+        if (block % block_step == 0) {
+          slice_angle += azimuth_diff;
+        }
         last_azimuth_diff = azimuth_diff;
       }else{
         azimuth_diff = last_azimuth_diff;
       }
 
-      for (int firing_seq=0, k=0; firing_seq < vlp_spec_.firing_seqs_per_block; firing_seq++){
-        for (int laser=0; laser < vlp_spec_.lasers_per_firing_seq; laser++, k+=RAW_SCAN_SIZE){
-          const velodyne_pointcloud::LaserCorrection &corrections =
-            calibration_.laser_corrections.at(laser);
+      if (dual && !decodeBlock(block)) {
+        continue;
+      }
+      const bool dedup = dual && dual_policy_ == DUAL_BOTH_DEDUP && (block & 1);
+
+      for (int firing_seq=0, k=0; firing_seq < spec.firing_seqs_per_block; firing_seq++){
+        for (int laser=0; laser < spec.lasers; laser++, k+=RAW_SCAN_SIZE){
+          if (dedup && sameReturn(raw->blocks[block - 1], raw->blocks[block], k)) {
+            continue;
+          }
 
           /** Position Calculation */
           union two_bytes tmp;
@@ -382,40 +691,43 @@ namespace velodyne_rawdata
           tmp.bytes[1] = raw->blocks[block].data[k+1];
 
           /** correct for the laser rotation as a function of timing during the firings **/
-          float firing_offset = (laser / vlp_spec_.lasers_per_firing) * vlp_spec_.firing_duration;
-          float firing_seq_offset = firing_seq * vlp_spec_.firing_seq_duration;
-          azimuth_corrected_f = azimuth + (azimuth_diff * (firing_offset + firing_seq_offset) / vlp_spec_.block_duration);
+          float firing_offset = (laser / spec.lasers_per_firing) * spec.firing_duration;
+          float firing_seq_offset = firing_seq * spec.firing_seq_duration;
+          azimuth_corrected_f = azimuth + (azimuth_diff * (firing_offset + firing_seq_offset) / spec.block_duration());
           azimuth_corrected = ((int)round(azimuth_corrected_f)) % 36000;
 
           /*condition added to avoid calculating points which are not
             in the interesting defined area (min_angle < area < max_angle)*/
-          if ((azimuth_corrected >= config_.min_angle
-               && azimuth_corrected <= config_.max_angle
-               && config_.min_angle < config_.max_angle)
-               ||(config_.min_angle > config_.max_angle
-               && (azimuth_corrected <= config_.max_angle
-               || azimuth_corrected >= config_.min_angle))){
+          if (azimuthInView(azimuth_corrected)) {
 
             // convert polar coordinates to Euclidean XYZ
-            float distance = tmp.uint * vlp_spec_.distance_resolution;
-            distance += corrections.dist_correction;
-
-            float cos_vert_angle = corrections.cos_vert_correction;
-            float sin_vert_angle = corrections.sin_vert_correction;
-            float cos_rot_correction = corrections.cos_rot_correction;
-            float sin_rot_correction = corrections.sin_rot_correction;
-
-            // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
-            // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
-            float cos_rot_angle =
-              cos_rot_table_[azimuth_corrected] * cos_rot_correction +
-              sin_rot_table_[azimuth_corrected] * sin_rot_correction;
-            float sin_rot_angle =
-              sin_rot_table_[azimuth_corrected] * cos_rot_correction -
-              cos_rot_table_[azimuth_corrected] * sin_rot_correction;
+            float distance = tmp.uint * spec.distance_resolution;
+            distance += table.dist_correction[laser];
+
+            float cos_vert_angle = table.cos_vert_correction[laser];
+            float sin_vert_angle = table.sin_vert_correction[laser];
+
+            float cos_rot_angle, sin_rot_angle;
+            if (trig_table_.empty()) {
+              float cos_rot_correction = table.cos_rot_correction[laser];
+              float sin_rot_correction = table.sin_rot_correction[laser];
+
+              // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
+              // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
+              cos_rot_angle =
+                cos_rot_table_[azimuth_corrected] * cos_rot_correction +
+                sin_rot_table_[azimuth_corrected] * sin_rot_correction;
+              sin_rot_angle =
+                sin_rot_table_[azimuth_corrected] * cos_rot_correction -
+                cos_rot_table_[azimuth_corrected] * sin_rot_correction;
+            } else {
+              const Trig &trig = correctedTrig(azimuth_corrected, laser);
+              cos_rot_angle = trig.cos;
+              sin_rot_angle = trig.sin;
+            }
 
-            float horiz_offset = corrections.horiz_offset_correction;
-            float vert_offset = corrections.vert_offset_correction;
+            float horiz_offset = table.horiz_offset_correction[laser];
+            float vert_offset = table.vert_offset_correction[laser];
 
             // Compute the distance in the xy plane (w/o accounting for rotation)
             /**the new term of 'vert_offset * sin_vert_angle'
@@ -436,17 +748,20 @@ namespace velodyne_rawdata
             // different value at different distance
             float distance_corr_x = 0;
             float distance_corr_y = 0;
-            if (corrections.two_pt_correction_available) {
+            if (table.two_pt_correction_available[laser]) {
+              const float dist_correction = table.dist_correction[laser];
+              const float dist_correction_x = table.dist_correction_x[laser];
+              const float dist_correction_y = table.dist_correction_y[laser];
               distance_corr_x =
-                (corrections.dist_correction - corrections.dist_correction_x)
+                (dist_correction - dist_correction_x)
                   * (xx - 2.4) / (25.04 - 2.4)
-                + corrections.dist_correction_x;
-              distance_corr_x -= corrections.dist_correction;
+                + dist_correction_x;
+              distance_corr_x -= dist_correction;
               distance_corr_y =
-                (corrections.dist_correction - corrections.dist_correction_y)
+                (dist_correction - dist_correction_y)
                   * (yy - 1.93) / (25.04 - 1.93)
-                + corrections.dist_correction_y;
-              distance_corr_y -= corrections.dist_correction;
+                + dist_correction_y;
+              distance_corr_y -= dist_correction;
             }
 
             float distance_x = distance + distance_corr_x;
@@ -480,47 +795,261 @@ namespace velodyne_rawdata
             float z_coord = z;
 
             /** Intensity Calculation */
-            float min_intensity = corrections.min_intensity;
-            float max_intensity = corrections.max_intensity;
+            float min_intensity = table.min_intensity[laser];
+            float max_intensity = table.max_intensity[laser];
 
             intensity = raw->blocks[block].data[k+2];
 
-            float focal_offset = 256
-                               * (1 - corrections.focal_distance / 13100)
-                               * (1 - corrections.focal_distance / 13100);
-            float focal_slope = corrections.focal_slope;
-            intensity += focal_slope * (abs(focal_offset - 256 *
-              (1 - tmp.uint/65535)*(1 - tmp.uint/65535)));
+            if (focal_table_.empty()) {
+              float focal_offset = 256
+                                 * (1 - table.focal_distance[laser] / 13100)
+                                 * (1 - table.focal_distance[laser] / 13100);
+              float focal_slope = table.focal_slope[laser];
+              intensity += focal_slope * (abs(focal_offset - 256 *
+                (1 - tmp.uint/65535)*(1 - tmp.uint/65535)));
+            } else {
+              intensity += focalCorrection(laser, tmp.uint);
+            }
             intensity = (intensity < min_intensity) ? min_intensity : intensity;
             intensity = (intensity > max_intensity) ? max_intensity : intensity;
 
             if (pointInRange(distance)) {
               // Set point time as beginning of scan and then apply timing offset:
               ros::Time pt_time = pkt.stamp;
-              if (!timing_offsets_.empty()) {
+              if (!timing_offsets_[dual].empty()) {
                   // Adjust point time to account for the time it takes between when the scan
                   // starts and the point actually fired.
-                  pt_time = pt_time + timing_offsets_[block][firing_seq];
+                  pt_time = pt_time + timing_offsets_[dual][block][laser];
               }
 
-              // Append this point to the cloud
-              VPoint point;
+              // Append this point to the output
+              VPoint &point = out[count++];
               point.x = x_coord;
               point.y = y_coord;
               point.z = z_coord;
               point.intensity = intensity;
               point.time_sec = pt_time.sec;
               point.time_nsec = pt_time.nsec;
-              point.laser_id = corrections.laser_ring;
-
-              pc.points.push_back(point);
-              ++pc.width;
+              point.laser_id = table.laser_ring[laser];
             }
           }
         }
       }
     }
-    return slice_angle;
+    angle = slice_angle;
+    return count;
+  }
+
+  /** @brief convert raw HDL-64E or HDL-32E packet to point cloud,
+   *         a block at a time with the vectorised kernel
+   *
+   *  @param pkt raw packet to unpack
+   *  @param out room for the points
+   *  @param angle set to -1.0
+   *  @returns number of points written
+   */
+  template <int MODEL>
+  int RawData::unpack_hdl_simd(const velodyne_msgs::VelodynePacket &pkt,
+                               VPoint *out, float &angle) const
+  {
+    constexpr velodyne_driver::ModelSpec spec = MODELS[MODEL];
+    const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
+    int count = 0;
+    const velodyne_pointcloud::CorrectionTable &table = *calibration_.table;
+    const bool dual = dualReturn(pkt);
+    const ros::Time pt_time = pkt.stamp; // No firing correction for this model
+    const int flags = DECODE_FOCAL_QUADRATIC
+      | (trig_table_.empty()? 0: DECODE_ROT_CORRECTED)
+      | (focal_table_.empty()? 0: DECODE_FOCAL_CORRECTED);
+    KernelInput in;
+    KernelOutput decoded;
+
+    for (int i = 0; i < BLOCKS_PER_PACKET; i++) {
+      const raw_block_t &block = raw->blocks[i];
+
+      if (dual && !decodeBlock(i)) {
+        continue;
+      }
+      if (!azimuthInView(block.rotation)) {
+        continue;
+      }
+      const bool dedup = dual && dual_policy_ == DUAL_BOTH_DEDUP && (i & 1);
+
+      // lower bank lasers are [32..63]
+      int bank_origin = 0;
+      if (spec.lasers > SCANS_PER_BLOCK && block.header == LOWER_BANK) {
+        bank_origin = 32;
+      }
+
+      const float cos_rot = cos_rot_table_[block.rotation];
+      const float sin_rot = sin_rot_table_[block.rotation];
+      for (int j = 0, k = 0; j < SCANS_PER_BLOCK; j++, k += RAW_SCAN_SIZE) {
+        union two_bytes tmp;
+        tmp.bytes[0] = block.data[k];
+        tmp.bytes[1] = block.data[k+1];
+        in.raw_distance[j] = tmp.uint;
+        in.raw_intensity[j] = block.data[k+2];
+        if (!focal_table_.empty()) {
+          in.raw_intensity[j] += focalCorrection(bank_origin + j, tmp.uint);
+        }
+        if (trig_table_.empty()) {
+          in.cos_rot[j] = cos_rot;
+          in.sin_rot[j] = sin_rot;
+        } else {
+          const Trig &trig = correctedTrig(block.rotation, bank_origin + j);
+          in.cos_rot[j] = trig.cos;
+          in.sin_rot[j] = trig.sin;
+        }
+      }
+
+      kernel_(table, bank_origin, SCANS_PER_BLOCK, SCANS_PER_BLOCK,
+              spec.distance_resolution, flags, in, &decoded);
+
+      for (int j = 0, k = 0; j < SCANS_PER_BLOCK; j++, k += RAW_SCAN_SIZE) {
+        if (dedup && sameReturn(raw->blocks[i - 1], block, k)) {
+          continue;
+        }
+        if (!pointInRange(decoded.distance[j])) {
+          continue;
+        }
+
+        VPoint &point = out[count++];
+        point.x = decoded.x[j];
+        point.y = decoded.y[j];
+        point.z = decoded.z[j];
+        point.intensity = decoded.intensity[j];
+        point.time_sec = pt_time.sec;
+        point.time_nsec = pt_time.nsec;
+        point.laser_id = table.laser_ring[bank_origin + j];
+      }
+    }
+    angle = -1.0;
+    return count;
+  }
+
+  /** @brief convert raw VLP16 and VLP32 packet to point cloud, a
+   *         block at a time with the vectorised kernel
+   *
+   *  @param pkt raw packet to unpack
+   *  @param out room for the points
+   *  @param angle set to the azimuth the packet covers
+   *  @returns number of points written
+   */
+  template <int MODEL>
+  int RawData::unpack_vlp_simd(const velodyne_msgs::VelodynePacket &pkt,
+                               VPoint *out, float &angle) const
+  {
+    constexpr velodyne_driver::ModelSpec spec = MODELS[MODEL];
+    constexpr int lanes = spec.firing_seqs_per_block * spec.lasers;
+    static_assert(lanes <= KERNEL_MAX_LANES, "block too large for the kernel");
+
+    const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
+    int count = 0;
+    const velodyne_pointcloud::CorrectionTable &table = *calibration_.table;
+    float azimuth_diff;
+    float last_azimuth_diff = 0;
+    float slice_angle = 0.0;
+    const int flags = (trig_table_.empty()? 0: DECODE_ROT_CORRECTED)
+      | (focal_table_.empty()? 0: DECODE_FOCAL_CORRECTED);
+    KernelInput in;
+    KernelOutput decoded;
+    bool in_view[lanes];
+
+    // in dual return mode, both blocks of a pair have the same azimuth
+    const bool dual = dualReturn(pkt);
+    const int block_step = dual? 2: 1;
+
+    for (int block = 0; block < BLOCKS_PER_PACKET; block++) {
+
+      // ignore packets with mangled or otherwise different contents
+      if (UPPER_BANK != raw->blocks[block].header) {
+        ROS_WARN_STREAM_THROTTLE(60, "skipping invalid VLP packet: block "
+                                 << block << " header value is "
+                                 << raw->blocks[block].header);
+        angle = -1.0;
+        return count;                      // bad packet: skip the rest
+      }
+
+      // Calculate difference between current and next block's azimuth angle.
+      const float azimuth = (float)(raw->blocks[block].rotation);
+      if (block < (BLOCKS_PER_PACKET-block_step)){
+        azimuth_diff = (float)((36000 + raw->blocks[block+block_step].rotation - raw->blocks[block].rotation)%36000);
+        if (block % block_step == 0) {
+          slice_angle += azimuth_diff;
+        }
+        last_azimuth_diff = azimuth_diff;
+      }else{
+        azimuth_diff = last_azimuth_diff;
+      }
+
+      if (dual && !decodeBlock(block)) {
+        continue;
+      }
+      const bool dedup = dual && dual_policy_ == DUAL_BOTH_DEDUP && (block & 1);
+
+      // gather the raw values and the azimuth each laser fired at
+      for (int lane = 0, k = 0; lane < lanes; lane++, k += RAW_SCAN_SIZE) {
+        const int firing_seq = lane / spec.lasers;
+        const int laser = lane % spec.lasers;
+
+        union two_bytes tmp;
+        tmp.bytes[0] = raw->blocks[block].data[k];
+        tmp.bytes[1] = raw->blocks[block].data[k+1];
+        in.raw_distance[lane] = tmp.uint;
+        in.raw_intensity[lane] = raw->blocks[block].data[k+2];
+        if (!focal_table_.empty()) {
+          in.raw_intensity[lane] += focalCorrection(laser, tmp.uint);
+        }
+
+        /** correct for the laser rotation as a function of timing during the firings **/
+        float firing_offset = (laser / spec.lasers_per_firing) * spec.firing_duration;
+        float firing_seq_offset = firing_seq * spec.firing_seq_duration;
+        float azimuth_corrected_f = azimuth + (azimuth_diff * (firing_offset + firing_seq_offset) / spec.block_duration());
+        int azimuth_corrected = ((int)round(azimuth_corrected_f)) % 36000;
+
+        in_view[lane] = azimuthInView(azimuth_corrected);
+        if (trig_table_.empty()) {
+          in.cos_rot[lane] = cos_rot_table_[azimuth_corrected];
+          in.sin_rot[lane] = sin_rot_table_[azimuth_corrected];
+        } else {
+          const Trig &trig = correctedTrig(azimuth_corrected, laser);
+          in.cos_rot[lane] = trig.cos;
+          in.sin_rot[lane] = trig.sin;
+        }
+      }
+
+      kernel_(table, 0, spec.lasers, lanes, spec.distance_resolution, flags,
+              in, &decoded);
+
+      for (int lane = 0, k = 0; lane < lanes; lane++, k += RAW_SCAN_SIZE) {
+        if (!in_view[lane]) {
+          continue;
+        }
+        if (dedup && sameReturn(raw->blocks[block - 1], raw->blocks[block], k)) {
+          continue;
+        }
+        if (!pointInRange(decoded.distance[lane])) {
+          continue;
+        }
+
+        const int laser = lane % spec.lasers;
+        ros::Time pt_time = pkt.stamp;
+        if (!timing_offsets_[dual].empty()) {
+          pt_time = pt_time + timing_offsets_[dual][block][laser];
+        }
+
+        VPoint &point = out[count++];
+        point.x = decoded.x[lane];
+        point.y = decoded.y[lane];
+        point.z = decoded.z[lane];
+        point.intensity = decoded.intensity[lane];
+        point.time_sec = pt_time.sec;
+        point.time_nsec = pt_time.nsec;
+        point.laser_id = table.laser_ring[laser];
+      }
+    }
+    angle = slice_angle;
+    return count;
   }
 
 } // namespace velodyne_rawdata
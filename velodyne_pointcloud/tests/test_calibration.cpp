@@ -154,6 +154,37 @@ TEST(Calibration, hdl64e_s2_float_intensities)
   EXPECT_EQ(laser.min_intensity, 0);
 }
 
+TEST(Calibration, correction_table)
+{
+  Calibration calibration(g_package_path + "/params/64e_s2.1-sztaki.yaml",
+                          false);
+  EXPECT_TRUE(calibration.initialized);
+  ASSERT_TRUE(calibration.table);
+
+  // the arrays are cache line aligned
+  const CorrectionTable &table = *calibration.table;
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(&table) % 64, 0u);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(table.focal_slope) % 64, 0u);
+
+  // and hold the same values as the map
+  for (int i = 0; i < calibration.num_lasers; ++i) {
+    const LaserCorrection &laser = calibration.laser_corrections[i];
+    EXPECT_FLOAT_EQ(table.cos_rot_correction[i], laser.cos_rot_correction);
+    EXPECT_FLOAT_EQ(table.sin_vert_correction[i], laser.sin_vert_correction);
+    EXPECT_FLOAT_EQ(table.dist_correction[i], laser.dist_correction);
+    EXPECT_FLOAT_EQ(table.horiz_offset_correction[i],
+                    laser.horiz_offset_correction);
+    EXPECT_FLOAT_EQ(table.min_intensity[i], laser.min_intensity);
+    EXPECT_FLOAT_EQ(table.max_intensity[i], laser.max_intensity);
+    EXPECT_EQ(table.laser_ring[i], laser.laser_ring);
+  }
+
+  // changes show after compiling again
+  calibration.laser_corrections[5].dist_correction = 1.5;
+  calibration.compile();
+  EXPECT_FLOAT_EQ(calibration.table->dist_correction[5], 1.5);
+}
+
 // Run all the tests that were declared with TEST()
 int main(int argc, char **argv)
 {
@@ -0,0 +1,314 @@
+//
+// C++ unit tests for the vectorised packet decode kernel.
+//
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <boost/shared_ptr.hpp>
+#include <ros/package.h>
+#include <velodyne_pointcloud/decode_kernel.h>
+#include <velodyne_pointcloud/rawdata.h>
+using namespace velodyne_pointcloud;
+using namespace velodyne_rawdata;
+using velodyne_driver::MODELS;
+
+// global test data
+std::string g_package_name("velodyne_pointcloud");
+std::string g_package_path;
+
+void init_global_data(void)
+{
+  g_package_path = ros::package::getPath(g_package_name);
+}
+
+/** the formulas of the scalar HDL decode loop, for one point; the
+ *  VLP loop has no quadratic focal distance term */
+static void decodePoint(const CorrectionTable& t, int l, float res,
+                        float raw_distance, float raw_intensity,
+                        float cos_rot, float sin_rot, float* p,
+                        bool quadratic = true)
+{
+  float distance = raw_distance * res + t.dist_correction[l];
+  float cv = t.cos_vert_correction[l], sv = t.sin_vert_correction[l];
+  float cra = cos_rot * t.cos_rot_correction[l] + sin_rot * t.sin_rot_correction[l];
+  float sra = sin_rot * t.cos_rot_correction[l] - cos_rot * t.sin_rot_correction[l];
+  float ho = t.horiz_offset_correction[l], vo = t.vert_offset_correction[l];
+  float xy = distance * cv - vo * sv;
+  float xx = std::abs(xy * sra - ho * cra);
+  float yy = std::abs(xy * cra + ho * sra);
+  float dcx = 0, dcy = 0;
+  if (t.two_pt_correction_available[l]) {
+    float dc = t.dist_correction[l];
+    dcx = (dc - t.dist_correction_x[l]) * (xx - 2.4) / (25.04 - 2.4)
+      + t.dist_correction_x[l] - dc;
+    dcy = (dc - t.dist_correction_y[l]) * (yy - 1.93) / (25.04 - 1.93)
+      + t.dist_correction_y[l] - dc;
+  }
+  xy = (distance + dcx) * cv - vo * sv;
+  float x = xy * sra - ho * cra;
+  xy = (distance + dcy) * cv - vo * sv;
+  float y = xy * cra + ho * sra;
+  p[0] = y;
+  p[1] = -x;
+  p[2] = (distance + dcy) * sv + vo * cv;
+
+  float fo = 256 * (1 - t.focal_distance[l] / 13100) * (1 - t.focal_distance[l] / 13100);
+  float s = quadratic? 1 - raw_distance / 65535: 1;
+  float intensity = raw_intensity + t.focal_slope[l] * std::abs(fo - 256 * s * s);
+  intensity = std::max(intensity, t.min_intensity[l]);
+  p[3] = std::min(intensity, t.max_intensity[l]);
+}
+
+/** random lanes of a block */
+static void randomInput(KernelInput* in)
+{
+  for (int i = 0; i < KERNEL_MAX_LANES; ++i) {
+    in->raw_distance[i] = rand() & 0xffff;
+    in->raw_intensity[i] = rand() & 0xff;
+    const float azimuth = (rand() % 36000) * M_PI / 18000;
+    in->cos_rot[i] = cosf(azimuth);
+    in->sin_rot[i] = sinf(azimuth);
+  }
+}
+
+/** @returns a packet of random returns of a model, its first block
+ *           fired at azimuth; the strongest returns of a dual return
+ *           packet repeat half the last ones
+ */
+static velodyne_msgs::VelodynePacket randomPacket(int model, int azimuth,
+                                                  bool dual)
+{
+  velodyne_msgs::VelodynePacket pkt;
+  memset(&pkt.data[0], 0, pkt.data.size());
+  pkt.stamp = ros::Time(1500000000, 0);
+  const bool banks = MODELS[model].lasers > SCANS_PER_BLOCK;
+  const int step = MODELS[model].firing_seqs_per_block * 20;
+  for (int block = 0; block < BLOCKS_PER_PACKET; ++block) {
+    uint8_t* data = &pkt.data[block * SIZE_BLOCK];
+    const uint16_t header = (banks && (block & 1))? LOWER_BANK: UPPER_BANK;
+    const int firing = (banks || dual)? block / 2: block;
+    const uint16_t rotation = (azimuth + firing * step) % ROTATION_MAX_UNITS;
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + 2, &rotation, sizeof(rotation));
+    for (int k = 4; k < SIZE_BLOCK; k += RAW_SCAN_SIZE) {
+      if (dual && (block & 1) && (rand() & 1)) {
+        memcpy(data + k, data + k - SIZE_BLOCK, RAW_SCAN_SIZE);
+        continue;
+      }
+      const uint16_t distance = rand() % 66000;  // some out of range
+      data[k] = distance & 0xff;
+      data[k + 1] = distance >> 8;
+      data[k + 2] = rand() & 0xff;
+    }
+  }
+  pkt.data[RETURN_MODE_OFFSET] = dual? RETURN_MODE_DUAL: 0x37;
+  pkt.data[RETURN_MODE_OFFSET + 1] = MODELS[model].product_id;
+  return pkt;
+}
+
+/** @returns points of a packet, decoded with a kernel, or with the
+ *           scalar loops if NULL
+ */
+static std::vector<VPoint> decodePacket(const std::string& calibration,
+                                        int model, DecodeKernel kernel,
+                                        const velodyne_msgs::VelodynePacket& pkt)
+{
+  boost::shared_ptr<RawData> data(new RawData);
+  RawData::Options options;
+  options.device_model = MODELS[model].name;
+  options.kernel = kernel;
+  EXPECT_EQ(data->setupOffline(g_package_path + "/params/" + calibration,
+                               options), 0);
+  data->setParameters(0.4, 130.0, 0.0, 2 * M_PI);
+  std::vector<VPoint> points(MAX_POINTS_PER_PACKET);
+  points.resize(data->unpack(pkt, &points[0]));
+  return points;
+}
+
+/** check that every kernel decodes packets as the scalar loops do */
+static void expectKernelsMatchScalar(const std::string& calibration,
+                                     int model, bool dual)
+{
+  const int azimuths[] = {0, 17000, 35950};
+  for (int a = 0; a < 3; ++a) {
+    srand(azimuths[a]);
+    const velodyne_msgs::VelodynePacket pkt =
+      randomPacket(model, azimuths[a], dual);
+    const std::vector<VPoint> scalar = decodePacket(calibration, model,
+                                                    NULL, pkt);
+    EXPECT_GT(scalar.size(), 100u);
+
+    const std::vector<DecodeKernelVariant> kernels = decodeKernels();
+    for (size_t v = 0; v < kernels.size(); ++v) {
+      const std::vector<VPoint> simd = decodePacket(calibration, model,
+                                                    kernels[v].kernel, pkt);
+      ASSERT_EQ(simd.size(), scalar.size()) << kernels[v].name;
+      for (size_t i = 0; i < scalar.size(); ++i) {
+        EXPECT_EQ(simd[i].laser_id, scalar[i].laser_id)
+          << kernels[v].name << " point " << i;
+        EXPECT_NEAR(simd[i].x, scalar[i].x, 1e-4)
+          << kernels[v].name << " point " << i;
+        EXPECT_NEAR(simd[i].y, scalar[i].y, 1e-4)
+          << kernels[v].name << " point " << i;
+        EXPECT_NEAR(simd[i].z, scalar[i].z, 1e-4)
+          << kernels[v].name << " point " << i;
+        EXPECT_NEAR(simd[i].intensity, scalar[i].intensity, 1e-3)
+          << kernels[v].name << " point " << i;
+        EXPECT_EQ(simd[i].time_sec, scalar[i].time_sec);
+        EXPECT_EQ(simd[i].time_nsec, scalar[i].time_nsec);
+      }
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(DecodeKernel, variants)
+{
+  const std::vector<DecodeKernelVariant> kernels = decodeKernels();
+  ASSERT_FALSE(kernels.empty());
+  const char* name;
+  EXPECT_EQ(selectDecodeKernel(&name), kernels.back().kernel);
+  EXPECT_STREQ(name, kernels.back().name);
+}
+
+TEST(DecodeKernel, matches_scalar)
+{
+  Calibration calibration(g_package_path + "/params/64e_s2.1-sztaki.yaml",
+                          false);
+  ASSERT_TRUE(calibration.initialized);
+  CorrectionTable table = *calibration.table;
+  for (int l = 0; l < CorrectionTable::MAX_LASERS; l += 3) {
+    table.two_pt_correction_available[l] = 1;
+    table.dist_correction_x[l] = table.dist_correction[l] + 0.01;
+    table.dist_correction_y[l] = table.dist_correction[l] - 0.01;
+  }
+
+  const std::vector<DecodeKernelVariant> kernels = decodeKernels();
+  for (size_t v = 0; v < kernels.size(); ++v) {
+    const char* name = kernels[v].name;
+    srand(42);
+    KernelInput in;
+    KernelOutput out;
+    for (int bank = 0; bank < 64; bank += 32) {
+      randomInput(&in);
+      kernels[v].kernel(table, bank, 32, 32, 0.002f, DECODE_FOCAL_QUADRATIC,
+                        in, &out);
+
+      for (int i = 0; i < KERNEL_MAX_LANES; ++i) {
+        float p[4];
+        decodePoint(table, bank + i, 0.002f, in.raw_distance[i],
+                    in.raw_intensity[i], in.cos_rot[i], in.sin_rot[i], p);
+        EXPECT_NEAR(out.x[i], p[0], 1e-4) << name << " lane " << i;
+        EXPECT_NEAR(out.y[i], p[1], 1e-4) << name << " lane " << i;
+        EXPECT_NEAR(out.z[i], p[2], 1e-4) << name << " lane " << i;
+        EXPECT_NEAR(out.intensity[i], p[3], 1e-3) << name << " lane " << i;
+      }
+    }
+  }
+}
+
+TEST(DecodeKernel, vlp_lanes)
+{
+  // 32 lanes of 16 lasers wrap around to the first laser, and the
+  // focal correction has no quadratic term
+  Calibration calibration(g_package_path + "/params/VLP16db.yaml", false);
+  ASSERT_TRUE(calibration.initialized);
+  CorrectionTable table = *calibration.table;
+  for (int l = 0; l < 16; ++l) {
+    table.focal_slope[l] = 0.5 + l * 0.1;
+    table.focal_distance[l] = 1000 * l;
+    table.min_intensity[l] = 0;
+    table.max_intensity[l] = 255;
+  }
+
+  const std::vector<DecodeKernelVariant> kernels = decodeKernels();
+  for (size_t v = 0; v < kernels.size(); ++v) {
+    const char* name = kernels[v].name;
+    srand(7);
+    KernelInput in;
+    KernelOutput out;
+    randomInput(&in);
+    kernels[v].kernel(table, 0, 16, 32, 0.002f, 0, in, &out);
+
+    for (int i = 0; i < KERNEL_MAX_LANES; ++i) {
+      float p[4];
+      decodePoint(table, i % 16, 0.002f, in.raw_distance[i],
+                  in.raw_intensity[i], in.cos_rot[i], in.sin_rot[i], p,
+                  false);
+      EXPECT_NEAR(out.x[i], p[0], 1e-4) << name << " lane " << i;
+      EXPECT_NEAR(out.y[i], p[1], 1e-4) << name << " lane " << i;
+      EXPECT_NEAR(out.z[i], p[2], 1e-4) << name << " lane " << i;
+      EXPECT_NEAR(out.intensity[i], p[3], 1e-3) << name << " lane " << i;
+    }
+  }
+}
+
+TEST(DecodeKernel, rot_corrected)
+{
+  Calibration calibration(g_package_path + "/params/64e_s2.1-sztaki.yaml",
+                          false);
+  ASSERT_TRUE(calibration.initialized);
+  const CorrectionTable& table = *calibration.table;
+
+  const std::vector<DecodeKernelVariant> kernels = decodeKernels();
+  for (size_t v = 0; v < kernels.size(); ++v) {
+    const char* name = kernels[v].name;
+
+    // the same points, with the rot_correction applied by the caller
+    srand(42);
+    KernelInput in, corrected;
+    KernelOutput out, out_corrected;
+    randomInput(&in);
+    corrected = in;
+    for (int i = 0; i < KERNEL_MAX_LANES; ++i) {
+      const float azimuth = atan2f(in.sin_rot[i], in.cos_rot[i]);
+      corrected.cos_rot[i] = cosf(azimuth - table.rot_correction[i]);
+      corrected.sin_rot[i] = sinf(azimuth - table.rot_correction[i]);
+    }
+    kernels[v].kernel(table, 0, 32, 32, 0.002f, 0, in, &out);
+    kernels[v].kernel(table, 0, 32, 32, 0.002f, DECODE_ROT_CORRECTED,
+                      corrected, &out_corrected);
+
+    for (int i = 0; i < KERNEL_MAX_LANES; ++i) {
+      EXPECT_NEAR(out.x[i], out_corrected.x[i], 1e-4) << name << " lane " << i;
+      EXPECT_NEAR(out.y[i], out_corrected.y[i], 1e-4) << name << " lane " << i;
+      EXPECT_FLOAT_EQ(out.z[i], out_corrected.z[i]) << name << " lane " << i;
+    }
+  }
+}
+
+TEST(RawData, hdl32e_kernels_match_scalar)
+{
+  expectKernelsMatchScalar("32db.yaml", velodyne_driver::MODEL_32E, false);
+  expectKernelsMatchScalar("32db.yaml", velodyne_driver::MODEL_32E, true);
+}
+
+TEST(RawData, vlp16_kernels_match_scalar)
+{
+  expectKernelsMatchScalar("VLP16db.yaml", velodyne_driver::MODEL_VLP16,
+                           false);
+  expectKernelsMatchScalar("VLP16db.yaml", velodyne_driver::MODEL_VLP16,
+                           true);
+}
+
+TEST(RawData, hdl64e_kernels_match_scalar)
+{
+  expectKernelsMatchScalar("64e_utexas.yaml", velodyne_driver::MODEL_64E,
+                           false);
+  expectKernelsMatchScalar("64e_s2.1-sztaki.yaml",
+                           velodyne_driver::MODEL_64E_S21, false);
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  init_global_data();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,290 @@
+//
+// C++ unit tests for the lookup tables of the raw data decoder.
+//
+
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstring>
+#include <boost/shared_ptr.hpp>
+#include <ros/package.h>
+#include <velodyne_pointcloud/decode_kernel.h>
+#include <velodyne_pointcloud/rawdata.h>
+using namespace velodyne_pointcloud;
+using namespace velodyne_rawdata;
+using velodyne_driver::MODELS;
+
+// global test data
+std::string g_package_name("velodyne_pointcloud");
+std::string g_package_path;
+
+void init_global_data(void)
+{
+  g_package_path = ros::package::getPath(g_package_name);
+}
+
+///////////////////////////////////////////////////////////////
+// Test data
+///////////////////////////////////////////////////////////////
+
+/** @returns a single return packet of a model, whose returns all have
+ *           the same raw distance and intensity; block i is fired at
+ *           azimuths[i]
+ */
+static velodyne_msgs::VelodynePacket packet(int model, const int* azimuths,
+                                            uint16_t raw_distance,
+                                            uint8_t raw_intensity)
+{
+  velodyne_msgs::VelodynePacket pkt;
+  memset(&pkt.data[0], 0, pkt.data.size());
+  const bool banks = MODELS[model].lasers > SCANS_PER_BLOCK;
+  for (int block = 0; block < BLOCKS_PER_PACKET; ++block) {
+    uint8_t* data = &pkt.data[block * SIZE_BLOCK];
+    const uint16_t header = (banks && (block & 1))? LOWER_BANK: UPPER_BANK;
+    const uint16_t rotation = azimuths[block];
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + 2, &rotation, sizeof(rotation));
+    for (int k = 4; k < SIZE_BLOCK; k += RAW_SCAN_SIZE) {
+      data[k] = raw_distance & 0xff;
+      data[k + 1] = raw_distance >> 8;
+      data[k + 2] = raw_intensity;
+    }
+  }
+  pkt.data[RETURN_MODE_OFFSET] = 0x37;
+  pkt.data[RETURN_MODE_OFFSET + 1] = MODELS[model].product_id;
+  return pkt;
+}
+
+/** @returns a decoder of a model's packets, or NULL */
+static boost::shared_ptr<RawData> decoder(const std::string& calibration,
+                                          int model,
+                                          const RawData::Options& options)
+{
+  boost::shared_ptr<RawData> data(new RawData);
+  RawData::Options model_options = options;
+  model_options.device_model = MODELS[model].name;
+  if (data->setupOffline(g_package_path + "/params/" + calibration,
+                         model_options) != 0) {
+    return boost::shared_ptr<RawData>();
+  }
+  data->setParameters(0.4, 130.0, 0.0, 2 * M_PI);
+  return data;
+}
+
+/** @returns every way of decoding a block: the scalar loops (NULL)
+ *           and each kernel
+ */
+static std::vector<DecodeKernel> decodeWays()
+{
+  std::vector<DecodeKernel> ways(1, DecodeKernel(NULL));
+  const std::vector<DecodeKernelVariant> kernels = decodeKernels();
+  for (size_t v = 0; v < kernels.size(); ++v) {
+    ways.push_back(kernels[v].kernel);
+  }
+  return ways;
+}
+
+/** check that the points of an HDL packet, looking up each laser's
+ *  corrected azimuth, are where the sin and cos of that azimuth put
+ *  them
+ */
+static void expectTrigTableMatches(const std::string& calibration_file,
+                                   int model, const int* azimuths)
+{
+  Calibration calibration(g_package_path + "/params/" + calibration_file,
+                          false);
+  ASSERT_TRUE(calibration.initialized);
+  const CorrectionTable& table = *calibration.table;
+  const uint16_t raw_distance = 25000;  // 50 m
+  const velodyne_msgs::VelodynePacket pkt =
+    packet(model, azimuths, raw_distance, 100);
+  const bool banks = MODELS[model].lasers > SCANS_PER_BLOCK;
+
+  const std::vector<DecodeKernel> ways = decodeWays();
+  for (size_t w = 0; w < ways.size(); ++w) {
+    RawData::Options options;
+    options.kernel = ways[w];
+    options.trig_tables = true;
+    boost::shared_ptr<RawData> data = decoder(calibration_file, model,
+                                              options);
+    ASSERT_TRUE(data);
+    std::vector<VPoint> points(MAX_POINTS_PER_PACKET);
+    ASSERT_EQ(data->unpack(pkt, &points[0]),
+              BLOCKS_PER_PACKET * SCANS_PER_BLOCK);
+
+    for (int i = 0; i < BLOCKS_PER_PACKET * SCANS_PER_BLOCK; ++i) {
+      const int block = i / SCANS_PER_BLOCK;
+      const int l = i % SCANS_PER_BLOCK + ((banks && (block & 1))? 32: 0);
+      const double azimuth = azimuths[block] * M_PI / 18000;
+      const double cos_rot = cos(azimuth - table.rot_correction[l]);
+      const double sin_rot = sin(azimuth - table.rot_correction[l]);
+      const double distance = raw_distance * DISTANCE_RESOLUTION
+                            + table.dist_correction[l];
+      const double xy = distance * table.cos_vert_correction[l]
+                      - table.vert_offset_correction[l]
+                      * table.sin_vert_correction[l];
+      const double ho = table.horiz_offset_correction[l];
+      EXPECT_NEAR(points[i].x, xy * cos_rot + ho * sin_rot, 2e-3)
+        << "laser " << l << " at " << azimuths[block] << " way " << w;
+      EXPECT_NEAR(points[i].y, -(xy * sin_rot - ho * cos_rot), 2e-3)
+        << "laser " << l << " at " << azimuths[block] << " way " << w;
+      EXPECT_EQ(points[i].laser_id, table.laser_ring[l]);
+    }
+  }
+}
+
+/** @returns the name of a copy of a calibration, whose lasers have
+ *           every combination of eight focal slopes and eight focal
+ *           distances, and intensities that are never clamped
+ */
+static std::string focalSweepCalibration(const std::string& calibration_file)
+{
+  static const float slopes[] = {0, 0.3, 0.75, 1.2, 1.5, 2, 3, 5};
+  static const float distances[] = {0, 500, 1500, 3000,
+                                    6000, 9000, 12000, 13100};
+  Calibration calibration(g_package_path + "/params/" + calibration_file,
+                          false);
+  if (!calibration.initialized) {
+    return "";
+  }
+  for (std::map<int, LaserCorrection>::iterator it =
+         calibration.laser_corrections.begin();
+       it != calibration.laser_corrections.end(); ++it) {
+    const int l = it->first;
+    it->second.focal_slope = slopes[l / 8 % 8];
+    it->second.focal_distance = distances[l % 8];
+    it->second.min_intensity = 0;
+    it->second.max_intensity = 100000;
+  }
+
+  char name[] = "/tmp/velodyne_calibration.XXXXXX";
+  const int fd = mkstemp(name);
+  if (fd < 0) {
+    return "";
+  }
+  close(fd);
+  calibration.write(name);
+  return name;
+}
+
+/** @returns the focal intensity correction of a laser, computed */
+static double focalCorrection(const CorrectionTable& table, int l,
+                              uint16_t raw_distance, bool quadratic)
+{
+  const double focal_offset = 256
+                            * (1 - table.focal_distance[l] / 13100)
+                            * (1 - table.focal_distance[l] / 13100);
+  double distance_term = 256;
+  if (quadratic) {
+    distance_term *= (1 - raw_distance / 65535.0)
+                   * (1 - raw_distance / 65535.0);
+  }
+  return table.focal_slope[l] * fabs(focal_offset - distance_term);
+}
+
+/** check the intensities of packets of a model, at raw distances
+ *  across the whole range, against the computed focal correction:
+ *  within half a unit when looked up, exactly when not
+ */
+static void expectFocalCorrection(const std::string& calibration_file,
+                                  int model, const int* azimuths)
+{
+  const std::string name = focalSweepCalibration(calibration_file);
+  ASSERT_FALSE(name.empty());
+  Calibration calibration(name, false);
+  ASSERT_TRUE(calibration.initialized);
+  const CorrectionTable& table = *calibration.table;
+  const int lasers = MODELS[model].lasers;
+  const bool banks = lasers > SCANS_PER_BLOCK;
+  const bool quadratic = model != velodyne_driver::MODEL_VLP16
+                      && model != velodyne_driver::MODEL_VLP32;
+  const uint8_t raw_intensity = 10;
+
+  const std::vector<DecodeKernel> ways = decodeWays();
+  for (int tables = 0; tables < 2; ++tables) {
+    for (size_t w = 0; w < ways.size(); ++w) {
+      RawData::Options options;
+      options.kernel = ways[w];
+      options.intensity_tables = tables;
+      boost::shared_ptr<RawData> data(new RawData);
+      options.device_model = MODELS[model].name;
+      ASSERT_EQ(data->setupOffline(name, options), 0);
+      data->setParameters(-10.0, 1000.0, 0.0, 2 * M_PI);
+
+      double max_error = 0;
+      for (int raw_distance = 0; raw_distance < 65536; raw_distance += 97) {
+        const velodyne_msgs::VelodynePacket pkt =
+          packet(model, azimuths, raw_distance, raw_intensity);
+        std::vector<VPoint> points(MAX_POINTS_PER_PACKET);
+        ASSERT_EQ(data->unpack(pkt, &points[0]),
+                  BLOCKS_PER_PACKET * SCANS_PER_BLOCK);
+
+        for (int i = 0; i < BLOCKS_PER_PACKET * SCANS_PER_BLOCK; ++i) {
+          const int block = i / SCANS_PER_BLOCK;
+          const int l = (i % SCANS_PER_BLOCK + ((banks && (block & 1))? 32: 0))
+                      % lasers;
+          const double expected = raw_intensity
+            + focalCorrection(table, l, raw_distance, quadratic);
+          const double error = fabs(points[i].intensity - expected);
+          max_error = std::max(max_error, error);
+          ASSERT_LE(error, tables? 0.5: 2e-3)
+            << "laser " << l << " at raw distance " << raw_distance
+            << " way " << w;
+        }
+      }
+      if (tables && quadratic) {
+        // else the exact check above would not show it is bypassed
+        EXPECT_GT(max_error, 0.01) << "way " << w;
+      }
+    }
+  }
+  unlink(name.c_str());
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST(RawData, trig_table_hdl64e)
+{
+  // both banks of each firing, so every laser, at the ends of the
+  // azimuth range, where corrections wrap around
+  const int azimuths[] = {0, 0, 1, 1, 9000, 9000,
+                          18000, 18000, 35998, 35998, 35999, 35999};
+  expectTrigTableMatches("64e_s2.1-sztaki.yaml",
+                         velodyne_driver::MODEL_64E_S21, azimuths);
+}
+
+TEST(RawData, trig_table_hdl32e)
+{
+  const int azimuths[] = {0, 1, 2, 4500, 9000, 13500,
+                          18000, 22500, 27000, 31500, 35998, 35999};
+  expectTrigTableMatches("32db.yaml", velodyne_driver::MODEL_32E, azimuths);
+}
+
+TEST(RawData, focal_table_hdl64e)
+{
+  const int azimuths[] = {0, 0, 3000, 3000, 9000, 9000,
+                          18000, 18000, 27000, 27000, 35999, 35999};
+  expectFocalCorrection("64e_s2.1-sztaki.yaml",
+                        velodyne_driver::MODEL_64E_S21, azimuths);
+}
+
+TEST(RawData, focal_table_vlp16)
+{
+  // a constant correction a laser, without the quadratic term
+  const int azimuths[] = {0, 40, 80, 120, 160, 200,
+                          240, 280, 320, 360, 400, 440};
+  expectFocalCorrection("VLP16db.yaml", velodyne_driver::MODEL_VLP16,
+                        azimuths);
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  init_global_data();
+  return RUN_ALL_TESTS();
+}